@@ -0,0 +1,43 @@
+/*
+ * Copyright 2017 Joyent, Inc.
+ */
+
+/*
+ * Measure the throughput of blocking cross-thread calls from C into
+ * JavaScript as the number of producer threads grows.  Each run makes the
+ * same total number of calls, divided among the producers.  See
+ * example_static_crossthread_bench() in example.c.
+ */
+
+var example = require('./example');
+
+var TOTAL_CALLS = 200000;
+var PRODUCERS = [ 1, 2, 4, 8, 16, 32, 64 ];
+
+function
+run(idx)
+{
+	var nprod, ncalls, seen;
+
+	if (idx >= PRODUCERS.length)
+		return;
+
+	nprod = PRODUCERS[idx];
+	ncalls = Math.ceil(TOTAL_CALLS / nprod);
+	seen = 0;
+
+	example.static_crossthread_bench(nprod, ncalls, function () {
+		++seen;
+	}, function (ms, total) {
+		if (seen !== total) {
+			throw new Error('expected ' + total + ' calls, saw ' +
+			    seen);
+		}
+		console.log('producers: %d\tcalls: %d\telapsed: %s ms\t' +
+		    'calls/s: %d', nprod, total, ms.toFixed(1),
+		    Math.round(total / (ms / 1000)));
+		run(idx + 1);
+	});
+}
+
+run(0);
@@ -3,9 +3,16 @@
  */
 
 #include <sys/ccompile.h>
+#include <sys/time.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
 #include <float.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <libnvpair.h>
 #include "example.h"
 
@@ -115,7 +122,6 @@ example_add(void *op, const nvlist_t *ap)
 	example_t ae;
 	nvpair_t *pp;
 	nvlist_t *eap;
-	nvlist_t *erp;
 
 	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
 	    V8PLUS_TYPE_ANY, &pp, V8PLUS_TYPE_NONE) != 0)
@@ -127,12 +133,13 @@ example_add(void *op, const nvlist_t *ap)
 
 	ep->e_val += ae.e_val;
 
+	/*
+	 * Nobody cares what the event emitter returns, so there is no need
+	 * to wait for it.
+	 */
 	eap = v8plus_obj(V8PLUS_TYPE_STRING, "0", "add", V8PLUS_TYPE_NONE);
-	if (eap != NULL) {
-		erp = v8plus_method_call(op, "__emit", eap);
-		nvlist_free(eap);
-		nvlist_free(erp);
-	}
+	if (eap != NULL)
+		(void) v8plus_method_post(op, "__emit", eap);
 
 	return (v8plus_void());
 }
@@ -406,53 +413,1684 @@ example_static_exception(const nvlist_t *ap)
 }
 
 /*
- * v8+ boilerplate
+ * A simple benchmark of the cross-thread call path.  Some number of producer
+ * threads each make a fixed number of blocking v8plus_call()s into the
+ * supplied JS function, which must therefore run on the event loop thread.
+ * When all producers have finished, the second function is called with the
+ * elapsed wall time in milliseconds.  See bench.js.
  */
-const v8plus_c_ctor_f v8plus_ctor = example_ctor;
-const v8plus_c_dtor_f v8plus_dtor = example_dtor;
-const char *v8plus_js_factory_name = "create";
-const char *v8plus_js_class_name = "Example";
-const v8plus_method_descr_t v8plus_methods[] = {
-	{
-		md_name: "set",
-		md_c_func: example_set
-	},
-	{
-		md_name: "add",
-		md_c_func: example_add
-	},
-	{
-		md_name: "multiply",
-		md_c_func: example_multiply
-	},
-	{
-		md_name: "toString",
-		md_c_func: example_toString
-	},
-	{
-		md_name: "multiplyAsync",
-		md_c_func: example_multiplyAsync
+typedef struct crossthread_bench_ctx {
+	v8plus_jsfunc_t cbc_cb;
+	v8plus_jsfunc_t cbc_done;
+	uint_t cbc_producers;
+	uint_t cbc_calls;
+	hrtime_t cbc_elapsed;
+} crossthread_bench_ctx_t;
+
+static void *
+crossthread_bench_producer(void *arg)
+{
+	crossthread_bench_ctx_t *cp = arg;
+	nvlist_t *ap;
+	nvlist_t *rp;
+	uint_t i;
+
+	for (i = 0; i < cp->cbc_calls; i++) {
+		ap = v8plus_obj(V8PLUS_TYPE_NUMBER, "0", (double)i,
+		    V8PLUS_TYPE_NONE);
+		if (ap == NULL)
+			break;
+		rp = v8plus_call(cp->cbc_cb, ap);
+		nvlist_free(ap);
+		nvlist_free(rp);
 	}
-};
-const uint_t v8plus_method_count =
-    sizeof (v8plus_methods) / sizeof (v8plus_methods[0]);
 
-const v8plus_static_descr_t v8plus_static_methods[] = {
-	{
-		sd_name: "static_add",
-		sd_c_func: example_static_add
-	},
-	{
-		sd_name: "static_object",
-		sd_c_func: example_static_object
-	},
-	{
-		sd_name: "static_multiplyAsync",
-		sd_c_func: example_static_multiplyAsync
-	},
-	{
-		sd_name: "static_exception",
-		sd_c_func: example_static_exception
+	return (NULL);
+}
+
+static void *
+crossthread_bench_worker(void *op __UNUSED, void *ctx)
+{
+	crossthread_bench_ctx_t *cp = ctx;
+	pthread_t *tids;
+	hrtime_t start;
+	uint_t i;
+
+	if ((tids = calloc(cp->cbc_producers, sizeof (pthread_t))) == NULL)
+		return (NULL);
+
+	start = gethrtime();
+	for (i = 0; i < cp->cbc_producers; i++) {
+		if (pthread_create(&tids[i], NULL,
+		    crossthread_bench_producer, cp) != 0)
+			break;
+	}
+	cp->cbc_producers = i;
+	for (i = 0; i < cp->cbc_producers; i++)
+		(void) pthread_join(tids[i], NULL);
+	cp->cbc_elapsed = gethrtime() - start;
+
+	free(tids);
+
+	return (NULL);
+}
+
+static void
+crossthread_bench_done(void *op __UNUSED, void *ctx, void *res __UNUSED)
+{
+	crossthread_bench_ctx_t *cp = ctx;
+	nvlist_t *rp;
+	nvlist_t *ap;
+
+	ap = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "0", (double)cp->cbc_elapsed / 1000000.0,
+	    V8PLUS_TYPE_NUMBER, "1",
+		(double)cp->cbc_producers * cp->cbc_calls,
+	    V8PLUS_TYPE_NONE);
+
+	if (ap != NULL) {
+		rp = v8plus_call(cp->cbc_done, ap);
+		nvlist_free(ap);
+		nvlist_free(rp);
+	}
+
+	v8plus_jsfunc_rele(cp->cbc_cb);
+	v8plus_jsfunc_rele(cp->cbc_done);
+	free(cp);
+}
+
+static nvlist_t *
+example_static_crossthread_bench(const nvlist_t *ap)
+{
+	double producers, calls;
+	v8plus_jsfunc_t cb, done;
+	crossthread_bench_ctx_t *cp;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_NUMBER, &producers,
+	    V8PLUS_TYPE_NUMBER, &calls,
+	    V8PLUS_TYPE_JSFUNC, &cb,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (producers < 1 || calls < 1) {
+		return (v8plus_throw_exception("RangeError",
+		    "producer and call counts must be positive",
+		    V8PLUS_TYPE_NONE));
+	}
+
+	if ((cp = malloc(sizeof (crossthread_bench_ctx_t))) == NULL)
+		return (v8plus_error(V8PLUSERR_NOMEM, "no memory for context"));
+
+	v8plus_jsfunc_hold(cb);
+	v8plus_jsfunc_hold(done);
+	cp->cbc_cb = cb;
+	cp->cbc_done = done;
+	cp->cbc_producers = (uint_t)producers;
+	cp->cbc_calls = (uint_t)calls;
+	cp->cbc_elapsed = 0;
+
+	v8plus_defer(NULL, cp, crossthread_bench_worker,
+	    crossthread_bench_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * The remaining methods exercise the interfaces through which C code on
+ * other threads, or driven by the event loop itself, calls into JavaScript;
+ * see test_crossthread.js.  Most take the functions to be called followed by
+ * a function to which the findings are reported, as a single object, once
+ * the test has finished.
+ */
+typedef struct crossthread_test_ctx {
+	v8plus_jsfunc_t ctc_funcs[2];
+	uint_t ctc_nfuncs;
+	v8plus_jsfunc_t ctc_done;
+	uint_t ctc_count;
+	uint_t ctc_threads;
+	char ctc_msg[128];
+	v8plus_buffer_t ctc_buf;
+	v8plus_channel_t *ctc_chan;
+	uint_t ctc_steps;
+	nvlist_t *ctc_report;
+} crossthread_test_ctx_t;
+
+static crossthread_test_ctx_t *
+crossthread_test_ctx(v8plus_jsfunc_t done, uint_t count)
+{
+	crossthread_test_ctx_t *cp;
+
+	if ((cp = calloc(1, sizeof (crossthread_test_ctx_t))) == NULL) {
+		(void) v8plus_error(V8PLUSERR_NOMEM, "no memory for context");
+		return (NULL);
+	}
+
+	v8plus_jsfunc_hold(done);
+	cp->ctc_done = done;
+	cp->ctc_count = count;
+
+	return (cp);
+}
+
+static void
+crossthread_test_hold(crossthread_test_ctx_t *cp, v8plus_jsfunc_t f)
+{
+	v8plus_jsfunc_hold(f);
+	cp->ctc_funcs[cp->ctc_nfuncs++] = f;
+}
+
+/*
+ * Copy the message of the exception pending in a worker, if any, and clear
+ * it; otherwise it would be preserved in place of any later exception.
+ */
+static void
+crossthread_test_errmsg(char *buf, size_t len)
+{
+	nvlist_t *ep = v8plus_pending_exception();
+	char *msg = "";
+
+	if (ep != NULL)
+		(void) nvlist_lookup_string(ep, "message", &msg);
+	(void) snprintf(buf, len, "%s", msg);
+	(void) v8plus_void();
+}
+
+static void
+crossthread_test_deadline(struct timespec *tsp, uint_t ms)
+{
+	(void) clock_gettime(CLOCK_REALTIME, tsp);
+	tsp->tv_sec += ms / 1000;
+	tsp->tv_nsec += (long)(ms % 1000) * 1000000L;
+	if (tsp->tv_nsec >= 1000000000L) {
+		tsp->tv_sec++;
+		tsp->tv_nsec -= 1000000000L;
+	}
+}
+
+/*
+ * Report the findings, if any, and drop the test's holds; this must be done
+ * on the event loop thread.
+ */
+static void
+crossthread_test_report(crossthread_test_ctx_t *cp)
+{
+	nvlist_t *rp;
+	nvlist_t *ap;
+	uint_t i;
+
+	if (cp->ctc_chan != NULL)
+		v8plus_channel_close(cp->ctc_chan);
+
+	if (cp->ctc_report != NULL) {
+		ap = v8plus_obj(V8PLUS_TYPE_OBJECT, "0", cp->ctc_report,
+		    V8PLUS_TYPE_NONE);
+		if (ap != NULL) {
+			rp = v8plus_call(cp->ctc_done, ap);
+			nvlist_free(ap);
+			nvlist_free(rp);
+		}
+		nvlist_free(cp->ctc_report);
+	}
+
+	for (i = 0; i < cp->ctc_nfuncs; i++)
+		v8plus_jsfunc_rele(cp->ctc_funcs[i]);
+	v8plus_jsfunc_rele(cp->ctc_done);
+	free(cp);
+}
+
+static void
+crossthread_test_done(void *op __UNUSED, void *ctx, void *res __UNUSED)
+{
+	crossthread_test_report(ctx);
+}
+
+/*
+ * Some number of threads each post numbered calls to the function as fast
+ * as they can, ending with a synchronous call numbered one past the last,
+ * which cannot return until all of that thread's posts have been made.
+ * JavaScript checks that it sees every call from each thread exactly once
+ * and in the order in which the thread made them.
+ */
+typedef struct crossthread_test_producer {
+	crossthread_test_ctx_t *ctp_ctx;
+	uint_t ctp_id;
+	uint_t ctp_failed;
+} crossthread_test_producer_t;
+
+static void *
+crossthread_test_mpsc_producer(void *arg)
+{
+	crossthread_test_producer_t *pp = arg;
+	crossthread_test_ctx_t *cp = pp->ctp_ctx;
+	nvlist_t *ap;
+	nvlist_t *rp;
+	uint_t i;
+
+	for (i = 0; i <= cp->ctc_count; i++) {
+		ap = v8plus_obj(
+		    V8PLUS_TYPE_NUMBER, "0", (double)pp->ctp_id,
+		    V8PLUS_TYPE_NUMBER, "1", (double)i,
+		    V8PLUS_TYPE_NONE);
+		if (ap == NULL) {
+			(void) v8plus_void();
+			pp->ctp_failed++;
+			continue;
+		}
+
+		if (i < cp->ctc_count) {
+			if (v8plus_call_post(cp->ctc_funcs[0], ap) != 0) {
+				(void) v8plus_void();
+				pp->ctp_failed++;
+			}
+			continue;
+		}
+
+		if ((rp = v8plus_call(cp->ctc_funcs[0], ap)) == NULL) {
+			(void) v8plus_void();
+			pp->ctp_failed++;
+		}
+		nvlist_free(rp);
+		nvlist_free(ap);
+	}
+
+	return (NULL);
+}
+
+static void *
+crossthread_test_mpsc_worker(void *op __UNUSED, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+	crossthread_test_producer_t *producers;
+	pthread_t *tids;
+	uint_t failed = 0;
+	uint_t n, i;
+
+	producers = calloc(cp->ctc_threads,
+	    sizeof (crossthread_test_producer_t));
+	tids = calloc(cp->ctc_threads, sizeof (pthread_t));
+	if (producers == NULL || tids == NULL) {
+		free(producers);
+		free(tids);
+		return (NULL);
+	}
+
+	for (n = 0; n < cp->ctc_threads; n++) {
+		producers[n].ctp_ctx = cp;
+		producers[n].ctp_id = n;
+		if (pthread_create(&tids[n], NULL,
+		    crossthread_test_mpsc_producer, &producers[n]) != 0)
+			break;
+	}
+	for (i = 0; i < n; i++) {
+		(void) pthread_join(tids[i], NULL);
+		failed += producers[i].ctp_failed;
+	}
+
+	free(producers);
+	free(tids);
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "threads", (double)n,
+	    V8PLUS_TYPE_NUMBER, "failed", (double)failed,
+	    V8PLUS_TYPE_NONE);
+
+	return (NULL);
+}
+
+static nvlist_t *
+example_static_test_mpsc(const nvlist_t *ap)
+{
+	v8plus_jsfunc_t f, done;
+	crossthread_test_ctx_t *cp;
+	double threads, calls;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &f,
+	    V8PLUS_TYPE_NUMBER, &threads,
+	    V8PLUS_TYPE_NUMBER, &calls,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (threads < 1) {
+		return (v8plus_throw_exception("RangeError",
+		    "thread count must be positive", V8PLUS_TYPE_NONE));
+	}
+
+	if ((cp = crossthread_test_ctx(done, (uint_t)calls)) == NULL)
+		return (NULL);
+	cp->ctc_threads = (uint_t)threads;
+	crossthread_test_hold(cp, f);
+
+	v8plus_defer(NULL, cp, crossthread_test_mpsc_worker,
+	    crossthread_test_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * Call the object's __check() method through futures that are freed at
+ * once, along with the arguments, which include a function, and a method
+ * name that is then overwritten.  None of them may be needed again.
+ */
+static void *
+crossthread_test_future_worker(void *op, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+	v8plus_future_t *fp;
+	nvlist_t *ap;
+	char name[16];
+	uint_t failed = 0;
+	uint_t i;
+
+	for (i = 0; i < cp->ctc_count; i++) {
+		(void) snprintf(name, sizeof (name), "__check");
+		ap = v8plus_obj(
+		    V8PLUS_TYPE_NUMBER, "0", (double)i,
+		    V8PLUS_TYPE_JSFUNC, "1", cp->ctc_funcs[0],
+		    V8PLUS_TYPE_NONE);
+		if (ap == NULL) {
+			(void) v8plus_void();
+			failed++;
+			continue;
+		}
+
+		fp = v8plus_method_call_async(op, name, ap);
+		nvlist_free(ap);
+		(void) memset(name, 'x', sizeof (name) - 1);
+
+		if (fp == NULL) {
+			(void) v8plus_void();
+			failed++;
+			continue;
+		}
+		v8plus_future_free(fp);
+	}
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "failed", (double)failed,
+	    V8PLUS_TYPE_NONE);
+
+	return (NULL);
+}
+
+static nvlist_t *
+example_testFutureFree(void *op, const nvlist_t *ap)
+{
+	v8plus_jsfunc_t f, done;
+	crossthread_test_ctx_t *cp;
+	double calls;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_NUMBER, &calls,
+	    V8PLUS_TYPE_JSFUNC, &f,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((cp = crossthread_test_ctx(done, (uint_t)calls)) == NULL)
+		return (NULL);
+	crossthread_test_hold(cp, f);
+
+	v8plus_defer(op, cp, crossthread_test_future_worker,
+	    crossthread_test_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * Post numbered calls to the first function, then one to the second, which
+ * throws, and finally make a synchronous call numbered -1, by which time the
+ * posts have all been made and the exception passed to our handler.
+ */
+static void
+crossthread_test_post_error(const nvlist_t *excp, void *arg)
+{
+	crossthread_test_ctx_t *cp = arg;
+	char *msg = "";
+
+	(void) nvlist_lookup_string((nvlist_t *)excp, "message", &msg);
+	(void) snprintf(cp->ctc_msg, sizeof (cp->ctc_msg), "%s", msg);
+}
+
+static void *
+crossthread_test_post_worker(void *op __UNUSED, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+	nvlist_t *ap;
+	nvlist_t *rp;
+	uint_t failed = 0;
+	uint_t i;
+
+	for (i = 0; i < cp->ctc_count; i++) {
+		ap = v8plus_obj(V8PLUS_TYPE_NUMBER, "0", (double)i,
+		    V8PLUS_TYPE_NONE);
+		if (ap == NULL || v8plus_call_post(cp->ctc_funcs[0], ap) != 0) {
+			(void) v8plus_void();
+			failed++;
+		}
+	}
+
+	if (v8plus_call_post(cp->ctc_funcs[1], NULL) != 0) {
+		(void) v8plus_void();
+		failed++;
+	}
+
+	if ((ap = v8plus_obj(V8PLUS_TYPE_NUMBER, "0", (double)-1,
+	    V8PLUS_TYPE_NONE)) != NULL) {
+		rp = v8plus_call(cp->ctc_funcs[0], ap);
+		nvlist_free(rp);
+		nvlist_free(ap);
+	}
+	(void) v8plus_void();
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "failed", (double)failed,
+	    V8PLUS_TYPE_STRING, "message", cp->ctc_msg,
+	    V8PLUS_TYPE_NONE);
+
+	return (NULL);
+}
+
+static void
+crossthread_test_post_done(void *op, void *ctx, void *res)
+{
+	v8plus_post_error_handler(NULL, NULL);
+	crossthread_test_done(op, ctx, res);
+}
+
+static nvlist_t *
+example_static_test_post(const nvlist_t *ap)
+{
+	v8plus_jsfunc_t f, thrower, done;
+	crossthread_test_ctx_t *cp;
+	double calls;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &f,
+	    V8PLUS_TYPE_JSFUNC, &thrower,
+	    V8PLUS_TYPE_NUMBER, &calls,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((cp = crossthread_test_ctx(done, (uint_t)calls)) == NULL)
+		return (NULL);
+	crossthread_test_hold(cp, f);
+	crossthread_test_hold(cp, thrower);
+
+	v8plus_post_error_handler(crossthread_test_post_error, cp);
+	v8plus_defer(NULL, cp, crossthread_test_post_worker,
+	    crossthread_test_post_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * Make some number of batches of calls to a function that throws for the
+ * call with argument 5, summing the results of the others.
+ */
+#define	CROSSTHREAD_TEST_BATCH	16
+
+static void *
+crossthread_test_batch_worker(void *op __UNUSED, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+	v8plus_batch_call_t calls[CROSSTHREAD_TEST_BATCH];
+	nvlist_t *results[CROSSTHREAD_TEST_BATCH];
+	char msg[128] = "";
+	uint_t failed = 0;
+	uint_t raised = 0;
+	uint_t round, i;
+	double sum = 0;
+	double v;
+
+	bzero(calls, sizeof (calls));
+	for (round = 0; round < cp->ctc_count; round++) {
+		for (i = 0; i < CROSSTHREAD_TEST_BATCH; i++) {
+			calls[i].vbc_func = cp->ctc_funcs[0];
+			calls[i].vbc_args = v8plus_obj(
+			    V8PLUS_TYPE_NUMBER, "0", (double)i,
+			    V8PLUS_TYPE_NONE);
+		}
+
+		if (v8plus_call_batch(calls, CROSSTHREAD_TEST_BATCH,
+		    results) != 0) {
+			raised++;
+			crossthread_test_errmsg(msg, sizeof (msg));
+		}
+		for (i = 0; i < CROSSTHREAD_TEST_BATCH; i++) {
+			if (results[i] == NULL)
+				failed++;
+			else if (nvlist_lookup_double(results[i],
+			    "res", &v) == 0)
+				sum += v;
+			nvlist_free(results[i]);
+		}
+
+		for (i = 0; i < CROSSTHREAD_TEST_BATCH; i++)
+			nvlist_free((nvlist_t *)calls[i].vbc_args);
+	}
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "sum", sum,
+	    V8PLUS_TYPE_NUMBER, "failed", (double)failed,
+	    V8PLUS_TYPE_NUMBER, "raised", (double)raised,
+	    V8PLUS_TYPE_STRING, "message", msg,
+	    V8PLUS_TYPE_NONE);
+
+	return (NULL);
+}
+
+static nvlist_t *
+example_static_test_batch(const nvlist_t *ap)
+{
+	v8plus_jsfunc_t f, done;
+	crossthread_test_ctx_t *cp;
+	double rounds;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &f,
+	    V8PLUS_TYPE_NUMBER, &rounds,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((cp = crossthread_test_ctx(done, (uint_t)rounds)) == NULL)
+		return (NULL);
+	crossthread_test_hold(cp, f);
+
+	v8plus_defer(NULL, cp, crossthread_test_batch_worker,
+	    crossthread_test_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * JavaScript keeps the event loop busy for half a second after starting this
+ * worker, while it posts coalescing updates to two keys of the first function
+ * and to the object's __update() method.  Each should be delivered once, with
+ * its last value, before a final synchronous call.
+ */
+static void *
+crossthread_test_latest_worker(void *op, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+	v8plus_jsfunc_t f = cp->ctc_funcs[0];
+	nvlist_t *lp;
+	nvlist_t *rp;
+	uint_t failed = 0;
+	uint_t i;
+
+	for (i = 0; i < cp->ctc_count; i++) {
+		if ((lp = v8plus_obj(
+		    V8PLUS_TYPE_NUMBER, "0", (double)1,
+		    V8PLUS_TYPE_NUMBER, "1", (double)i,
+		    V8PLUS_TYPE_NONE)) == NULL ||
+		    v8plus_call_post_latest(f, 1, lp) != 0)
+			failed++;
+
+		if ((lp = v8plus_obj(
+		    V8PLUS_TYPE_NUMBER, "0", (double)2,
+		    V8PLUS_TYPE_NUMBER, "1", (double)i * 2,
+		    V8PLUS_TYPE_NONE)) == NULL ||
+		    v8plus_call_post_latest(f, 2, lp) != 0)
+			failed++;
+
+		if ((lp = v8plus_obj(
+		    V8PLUS_TYPE_NUMBER, "0", (double)i,
+		    V8PLUS_TYPE_NONE)) == NULL ||
+		    v8plus_method_post_latest(op, "__update", lp) != 0)
+			failed++;
+	}
+
+	if ((lp = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "0", (double)0,
+	    V8PLUS_TYPE_NUMBER, "1", (double)-1,
+	    V8PLUS_TYPE_NONE)) != NULL) {
+		rp = v8plus_call(f, lp);
+		nvlist_free(rp);
+		nvlist_free(lp);
+	}
+	(void) v8plus_void();
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "failed", (double)failed,
+	    V8PLUS_TYPE_NONE);
+
+	return (NULL);
+}
+
+static nvlist_t *
+example_testLatest(void *op, const nvlist_t *ap)
+{
+	v8plus_jsfunc_t f, done;
+	crossthread_test_ctx_t *cp;
+	double count;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_NUMBER, &count,
+	    V8PLUS_TYPE_JSFUNC, &f,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((cp = crossthread_test_ctx(done, (uint_t)count)) == NULL)
+		return (NULL);
+	crossthread_test_hold(cp, f);
+
+	v8plus_defer(op, cp, crossthread_test_latest_worker,
+	    crossthread_test_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * JavaScript keeps the event loop busy for half a second after starting this
+ * worker, so nothing is taken off the queue while we limit it to four calls
+ * and post ten under each of the failing and dropping policies; dropped
+ * posts are not refused.  Ten more posts under the blocking policy must wait
+ * for the loop to make room, and all are admitted.  Each phase counts the
+ * posts refused.
+ */
+#define	CROSSTHREAD_TEST_LIMIT	4
+#define	CROSSTHREAD_TEST_POSTS	10
+
+static uint_t
+crossthread_test_admit(v8plus_jsfunc_t f, char *msg, size_t len)
+{
+	nvlist_t *ap;
+	uint_t refused = 0;
+	uint_t i;
+
+	for (i = 0; i < CROSSTHREAD_TEST_POSTS; i++) {
+		if ((ap = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL ||
+		    v8plus_call_post(f, ap) != 0) {
+			refused++;
+			crossthread_test_errmsg(msg, len);
+		}
+	}
+
+	return (refused);
+}
+
+static void *
+crossthread_test_admission_worker(void *op __UNUSED, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+	v8plus_queue_policy_t policy;
+	v8plus_queue_stats_t before, after;
+	char msg[128] = "";
+	uint_t rejected, dropped, blocked;
+	nvlist_t *ap;
+	nvlist_t *rp;
+
+	v8plus_queue_stats(&before);
+	v8plus_queue_limit(CROSSTHREAD_TEST_LIMIT);
+
+	policy = v8plus_queue_policy(V8PLUS_QUEUE_FAIL);
+	rejected = crossthread_test_admit(cp->ctc_funcs[0], msg, sizeof (msg));
+
+	(void) v8plus_queue_policy(V8PLUS_QUEUE_DROP);
+	dropped = crossthread_test_admit(cp->ctc_funcs[0], NULL, 0);
+
+	(void) v8plus_queue_policy(V8PLUS_QUEUE_BLOCK);
+	blocked = crossthread_test_admit(cp->ctc_funcs[0], NULL, 0);
+	v8plus_queue_stats(&after);
+
+	v8plus_queue_limit(0);
+	(void) v8plus_queue_policy(policy);
+
+	if ((ap = v8plus_obj(V8PLUS_TYPE_NONE)) != NULL) {
+		rp = v8plus_call(cp->ctc_funcs[0], ap);
+		nvlist_free(rp);
+		nvlist_free(ap);
+	}
+	(void) v8plus_void();
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "rejected", (double)rejected,
+	    V8PLUS_TYPE_STRING, "message", msg,
+	    V8PLUS_TYPE_NUMBER, "dropped", (double)dropped,
+	    V8PLUS_TYPE_NUMBER, "blocked", (double)blocked,
+	    V8PLUS_TYPE_NUMBER, "stats_rejected",
+		(double)(after.vqs_rejected - before.vqs_rejected),
+	    V8PLUS_TYPE_NUMBER, "stats_dropped",
+		(double)(after.vqs_dropped - before.vqs_dropped),
+	    V8PLUS_TYPE_NUMBER, "stats_blocked",
+		(double)(after.vqs_blocked - before.vqs_blocked),
+	    V8PLUS_TYPE_NONE);
+
+	return (NULL);
+}
+
+static nvlist_t *
+example_static_test_admission(const nvlist_t *ap)
+{
+	v8plus_jsfunc_t f, done;
+	crossthread_test_ctx_t *cp;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &f,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((cp = crossthread_test_ctx(done, 0)) == NULL)
+		return (NULL);
+	crossthread_test_hold(cp, f);
+
+	v8plus_defer(NULL, cp, crossthread_test_admission_worker,
+	    crossthread_test_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * JavaScript keeps the event loop busy for a second after starting this
+ * worker, so a timed call to the first function cannot be made before its
+ * deadline, and a future for another can be cancelled.  Once the cancelled
+ * future has completed, the loop is free again, and a timed call to the
+ * second function, which takes half a second, times out while in progress.
+ */
+static void *
+crossthread_test_timed_worker(void *op __UNUSED, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+	struct timespec deadline;
+	v8plus_future_t *fp;
+	nvlist_t *ap;
+	nvlist_t *rp;
+	char before[128] = "";
+	char cancel[128] = "";
+	char during[128] = "";
+	boolean_t cancelled = B_FALSE;
+
+	if ((ap = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL) {
+		(void) v8plus_void();
+		return (NULL);
+	}
+
+	crossthread_test_deadline(&deadline, 100);
+	rp = v8plus_call_timed(cp->ctc_funcs[0], ap, &deadline);
+	nvlist_free(rp);
+	crossthread_test_errmsg(before, sizeof (before));
+
+	if ((fp = v8plus_call_async(cp->ctc_funcs[0], ap)) != NULL) {
+		cancelled = v8plus_future_cancel(fp);
+		rp = v8plus_future_result(fp);
+		nvlist_free(rp);
+		v8plus_future_free(fp);
+	}
+	crossthread_test_errmsg(cancel, sizeof (cancel));
+
+	crossthread_test_deadline(&deadline, 100);
+	rp = v8plus_call_timed(cp->ctc_funcs[1], ap, &deadline);
+	nvlist_free(rp);
+	crossthread_test_errmsg(during, sizeof (during));
+
+	nvlist_free(ap);
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_STRING, "before", before,
+	    V8PLUS_TYPE_BOOLEAN, "cancelled", cancelled,
+	    V8PLUS_TYPE_STRING, "cancel", cancel,
+	    V8PLUS_TYPE_STRING, "during", during,
+	    V8PLUS_TYPE_NONE);
+
+	return (NULL);
+}
+
+static nvlist_t *
+example_static_test_timed(const nvlist_t *ap)
+{
+	v8plus_jsfunc_t never, slow, done;
+	crossthread_test_ctx_t *cp;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &never,
+	    V8PLUS_TYPE_JSFUNC, &slow,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((cp = crossthread_test_ctx(done, 0)) == NULL)
+		return (NULL);
+	crossthread_test_hold(cp, never);
+	crossthread_test_hold(cp, slow);
+
+	v8plus_defer(NULL, cp, crossthread_test_timed_worker,
+	    crossthread_test_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * Write the numbers from 0 as records to a channel with the smallest ring,
+ * waiting whenever it is full or JavaScript has paused delivery.  The
+ * channel is closed, delivering whatever is left, on completion.
+ */
+static void *
+crossthread_test_channel_worker(void *op __UNUSED, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+	char rec[16];
+	uint_t waits = 0;
+	uint_t i = 0;
+	int len;
+
+	while (i < cp->ctc_count) {
+		len = snprintf(rec, sizeof (rec), "%u", i);
+		if (!v8plus_channel_writable(cp->ctc_chan) ||
+		    v8plus_channel_write(cp->ctc_chan, rec, len) != 0) {
+			(void) v8plus_void();
+			(void) usleep(1000);
+			waits++;
+			continue;
+		}
+		i++;
+	}
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "waits", (double)waits,
+	    V8PLUS_TYPE_NONE);
+
+	return (NULL);
+}
+
+static nvlist_t *
+example_static_test_channel(const nvlist_t *ap)
+{
+	v8plus_jsfunc_t f, done;
+	crossthread_test_ctx_t *cp;
+	double records;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &f,
+	    V8PLUS_TYPE_NUMBER, &records,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((cp = crossthread_test_ctx(done, (uint_t)records)) == NULL)
+		return (NULL);
+
+	if ((cp->ctc_chan = v8plus_channel_create(f, 0, 0)) == NULL) {
+		v8plus_jsfunc_rele(done);
+		free(cp);
+		return (NULL);
+	}
+
+	v8plus_defer(NULL, cp, crossthread_test_channel_worker,
+	    crossthread_test_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * Wait, both synchronously and through a future, for the Promise returned
+ * by the first function to be fulfilled, then for the one returned by the
+ * second to be rejected.
+ */
+static void *
+crossthread_test_promise_worker(void *op __UNUSED, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+	v8plus_future_t *fp;
+	boolean_t await;
+	nvlist_t *ap;
+	nvlist_t *rp;
+	char msg[128] = "";
+	double value = -1;
+	double fvalue = -1;
+
+	if ((ap = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL) {
+		(void) v8plus_void();
+		return (NULL);
+	}
+
+	await = v8plus_await_promises(B_TRUE);
+
+	if ((rp = v8plus_call(cp->ctc_funcs[0], ap)) != NULL)
+		(void) nvlist_lookup_double(rp, "res", &value);
+	nvlist_free(rp);
+
+	if ((fp = v8plus_call_async(cp->ctc_funcs[0], ap)) != NULL) {
+		if ((rp = v8plus_future_result(fp)) != NULL)
+			(void) nvlist_lookup_double(rp, "res", &fvalue);
+		nvlist_free(rp);
+		v8plus_future_free(fp);
+	}
+	(void) v8plus_void();
+
+	rp = v8plus_call(cp->ctc_funcs[1], ap);
+	nvlist_free(rp);
+	crossthread_test_errmsg(msg, sizeof (msg));
+
+	(void) v8plus_await_promises(await);
+	nvlist_free(ap);
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "value", value,
+	    V8PLUS_TYPE_NUMBER, "future_value", fvalue,
+	    V8PLUS_TYPE_STRING, "message", msg,
+	    V8PLUS_TYPE_NONE);
+
+	return (NULL);
+}
+
+static nvlist_t *
+example_static_test_promise(const nvlist_t *ap)
+{
+	v8plus_jsfunc_t resolves, rejects, done;
+	crossthread_test_ctx_t *cp;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &resolves,
+	    V8PLUS_TYPE_JSFUNC, &rejects,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((cp = crossthread_test_ctx(done, 0)) == NULL)
+		return (NULL);
+	crossthread_test_hold(cp, resolves);
+	crossthread_test_hold(cp, rejects);
+
+	v8plus_defer(NULL, cp, crossthread_test_promise_worker,
+	    crossthread_test_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * Some number of threads each add 1 to the first counter of a block, and set
+ * the second to their loop index, some number of times.  JavaScript reads the
+ * block through its own array while they do so.  A block of the same name
+ * but a different size may not be created.
+ */
+#define	CROSSTHREAD_TEST_COUNTERS	"example_test"
+
+static void *
+crossthread_test_counters_thread(void *arg)
+{
+	crossthread_test_ctx_t *cp = arg;
+	v8plus_counters_t *vcp;
+	uint_t i;
+
+	if ((vcp = v8plus_counters_create(CROSSTHREAD_TEST_COUNTERS,
+	    2)) == NULL) {
+		(void) v8plus_void();
+		return (NULL);
+	}
+
+	for (i = 0; i < cp->ctc_count; i++) {
+		v8plus_counter_add(vcp, 0, 1);
+		v8plus_counter_set(vcp, 1, (double)i);
+	}
+
+	return (NULL);
+}
+
+static void *
+crossthread_test_counters_worker(void *op __UNUSED, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+	v8plus_counters_t *vcp;
+	pthread_t *tids;
+	uint_t n, i;
+
+	if ((tids = calloc(cp->ctc_threads, sizeof (pthread_t))) == NULL)
+		return (NULL);
+
+	for (n = 0; n < cp->ctc_threads; n++) {
+		if (pthread_create(&tids[n], NULL,
+		    crossthread_test_counters_thread, cp) != 0)
+			break;
+	}
+	for (i = 0; i < n; i++)
+		(void) pthread_join(tids[i], NULL);
+	free(tids);
+
+	if ((vcp = v8plus_counters_create(CROSSTHREAD_TEST_COUNTERS,
+	    2)) == NULL) {
+		(void) v8plus_void();
+		return (NULL);
+	}
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "threads", (double)n,
+	    V8PLUS_TYPE_NUMBER, "total", v8plus_counter_get(vcp, 0),
+	    V8PLUS_TYPE_NUMBER, "last", v8plus_counter_get(vcp, 1),
+	    V8PLUS_TYPE_NONE);
+
+	return (NULL);
+}
+
+static nvlist_t *
+example_static_test_counters(const nvlist_t *ap)
+{
+	v8plus_jsfunc_t done;
+	crossthread_test_ctx_t *cp;
+	double threads, adds;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_NUMBER, &threads,
+	    V8PLUS_TYPE_NUMBER, &adds,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (v8plus_counters_create(CROSSTHREAD_TEST_COUNTERS, 2) == NULL)
+		return (NULL);
+	if (v8plus_counters_create(CROSSTHREAD_TEST_COUNTERS, 3) != NULL) {
+		return (v8plus_error(V8PLUSERR_UNKNOWN,
+		    "counter block created again with a different size"));
+	}
+	(void) v8plus_void();
+
+	if ((cp = crossthread_test_ctx(done, (uint_t)adds)) == NULL)
+		return (NULL);
+	cp->ctc_threads = (uint_t)threads;
+
+	v8plus_defer(NULL, cp, crossthread_test_counters_worker,
+	    crossthread_test_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * Start three timers on the event loop thread: a one-shot timer that stops a
+ * third, longer one before it can fire, and a repeating timer that stops
+ * itself after its fifth run.  The findings are reported once both of the
+ * first two have finished.
+ */
+typedef struct timer_test_ctx {
+	crossthread_test_ctx_t *ttc_ctx;
+	v8plus_timer_t *ttc_once;
+	v8plus_timer_t *ttc_repeat;
+	v8plus_timer_t *ttc_never;
+	uint_t ttc_once_runs;
+	uint_t ttc_repeat_runs;
+	uint_t ttc_never_runs;
+	uint_t ttc_pending;
+} timer_test_ctx_t;
+
+static void
+timer_test_finish(timer_test_ctx_t *tp)
+{
+	crossthread_test_ctx_t *cp = tp->ttc_ctx;
+
+	if (--tp->ttc_pending != 0)
+		return;
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "once", (double)tp->ttc_once_runs,
+	    V8PLUS_TYPE_NUMBER, "repeat", (double)tp->ttc_repeat_runs,
+	    V8PLUS_TYPE_NUMBER, "never", (double)tp->ttc_never_runs,
+	    V8PLUS_TYPE_NONE);
+	free(tp);
+
+	crossthread_test_report(cp);
+}
+
+static void
+timer_test_once(v8plus_timer_t *tmp, void *arg)
+{
+	timer_test_ctx_t *tp = arg;
+
+	tp->ttc_once_runs++;
+	v8plus_timer_stop(tp->ttc_never);
+	v8plus_timer_stop(tmp);
+	timer_test_finish(tp);
+}
+
+static void
+timer_test_repeat(v8plus_timer_t *tmp, void *arg)
+{
+	timer_test_ctx_t *tp = arg;
+
+	if (++tp->ttc_repeat_runs < 5)
+		return;
+
+	v8plus_timer_stop(tmp);
+	timer_test_finish(tp);
+}
+
+static void
+timer_test_never(v8plus_timer_t *tmp __UNUSED, void *arg)
+{
+	timer_test_ctx_t *tp = arg;
+
+	tp->ttc_never_runs++;
+}
+
+static nvlist_t *
+example_static_test_timers(const nvlist_t *ap)
+{
+	v8plus_jsfunc_t done;
+	crossthread_test_ctx_t *cp;
+	timer_test_ctx_t *tp;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((tp = calloc(1, sizeof (timer_test_ctx_t))) == NULL)
+		return (v8plus_error(V8PLUSERR_NOMEM, "no memory for context"));
+
+	if ((cp = crossthread_test_ctx(done, 0)) == NULL) {
+		free(tp);
+		return (NULL);
+	}
+	tp->ttc_ctx = cp;
+	tp->ttc_pending = 2;
+
+	if ((tp->ttc_never = v8plus_timer_start(timer_test_never, tp,
+	    1000, 0)) == NULL)
+		return (NULL);
+	if ((tp->ttc_once = v8plus_timer_start(timer_test_once, tp,
+	    20, 0)) == NULL)
+		return (NULL);
+	if ((tp->ttc_repeat = v8plus_timer_start(timer_test_repeat, tp,
+	    5, 5)) == NULL)
+		return (NULL);
+
+	return (v8plus_void());
+}
+
+/*
+ * Watch both ends of a pipe.  When the write end is writable, write a byte
+ * and suspend that watch; when the byte arrives, read it and stop watching
+ * altogether.  The write end must have been reported writable only once.
+ */
+typedef struct fd_test_ctx {
+	crossthread_test_ctx_t *ftc_ctx;
+	int ftc_fds[2];
+	v8plus_fd_watch_t *ftc_reader;
+	v8plus_fd_watch_t *ftc_writer;
+	uint_t ftc_writable;
+	int ftc_suspend;
+} fd_test_ctx_t;
+
+static void
+fd_test_writable(v8plus_fd_watch_t *wp, int fd, int events, void *arg)
+{
+	fd_test_ctx_t *fp = arg;
+
+	if (!(events & V8PLUS_FD_WRITABLE))
+		return;
+
+	fp->ftc_writable++;
+	(void) write(fd, "x", 1);
+	fp->ftc_suspend = v8plus_fd_watch_events(wp, 0);
+}
+
+static void
+fd_test_readable(v8plus_fd_watch_t *wp, int fd, int events, void *arg)
+{
+	fd_test_ctx_t *fp = arg;
+	crossthread_test_ctx_t *cp = fp->ftc_ctx;
+	char buf[8];
+	ssize_t n;
+
+	n = read(fd, buf, sizeof (buf));
+
+	v8plus_fd_unwatch(wp);
+	v8plus_fd_unwatch(fp->ftc_writer);
+	(void) close(fp->ftc_fds[0]);
+	(void) close(fp->ftc_fds[1]);
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_BOOLEAN, "readable",
+		(boolean_t)((events & V8PLUS_FD_READABLE) != 0),
+	    V8PLUS_TYPE_NUMBER, "read", (double)n,
+	    V8PLUS_TYPE_NUMBER, "writable", (double)fp->ftc_writable,
+	    V8PLUS_TYPE_NUMBER, "suspend", (double)fp->ftc_suspend,
+	    V8PLUS_TYPE_NONE);
+	free(fp);
+
+	crossthread_test_report(cp);
+}
+
+static nvlist_t *
+example_static_test_fd(const nvlist_t *ap)
+{
+	v8plus_jsfunc_t done;
+	fd_test_ctx_t *fp;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((fp = calloc(1, sizeof (fd_test_ctx_t))) == NULL)
+		return (v8plus_error(V8PLUSERR_NOMEM, "no memory for context"));
+
+	if (pipe(fp->ftc_fds) != 0) {
+		free(fp);
+		return (v8plus_syserr(errno, "could not create pipe"));
+	}
+
+	if ((fp->ftc_ctx = crossthread_test_ctx(done, 0)) == NULL ||
+	    (fp->ftc_reader = v8plus_fd_watch(fp->ftc_fds[0],
+	    V8PLUS_FD_READABLE, fd_test_readable, fp)) == NULL)
+		return (NULL);
+	if ((fp->ftc_writer = v8plus_fd_watch(fp->ftc_fds[1],
+	    V8PLUS_FD_WRITABLE, fd_test_writable, fp)) == NULL)
+		return (NULL);
+
+	return (v8plus_void());
+}
+
+/*
+ * Take holds of our own on the object, a function and the event loop, and
+ * drop the function's first hold, made on the event loop thread, before
+ * using either.  JavaScript has a moment to collect garbage in between.
+ */
+static void *
+crossthread_test_holds_worker(void *op, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+	v8plus_jsfunc_t f = cp->ctc_funcs[0];
+	double twice = 0;
+	char *str = "";
+	nvlist_t *sp = NULL;
+	nvlist_t *ap;
+	nvlist_t *rp;
+
+	v8plus_obj_hold(op);
+	v8plus_jsfunc_hold(f);
+	v8plus_eventloop_hold();
+	v8plus_jsfunc_rele(f);
+	cp->ctc_nfuncs = 0;
+
+	(void) usleep(50000);
+
+	ap = v8plus_obj(V8PLUS_TYPE_NUMBER, "0", (double)21,
+	    V8PLUS_TYPE_NONE);
+	if (ap != NULL) {
+		if ((rp = v8plus_call(f, ap)) != NULL)
+			(void) nvlist_lookup_double(rp, "res", &twice);
+		nvlist_free(rp);
+		nvlist_free(ap);
+	}
+	if ((ap = v8plus_obj(V8PLUS_TYPE_NONE)) != NULL) {
+		if ((sp = v8plus_method_call(op, "toString", ap)) != NULL)
+			(void) nvlist_lookup_string(sp, "res", &str);
+		nvlist_free(ap);
+	}
+	(void) v8plus_void();
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "twice", twice,
+	    V8PLUS_TYPE_STRING, "value", str,
+	    V8PLUS_TYPE_NONE);
+	nvlist_free(sp);
+
+	v8plus_eventloop_rele();
+	v8plus_jsfunc_rele(f);
+	v8plus_obj_rele(op);
+
+	return (NULL);
+}
+
+static nvlist_t *
+example_testHolds(void *op, const nvlist_t *ap)
+{
+	v8plus_jsfunc_t f, done;
+	crossthread_test_ctx_t *cp;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &f,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((cp = crossthread_test_ctx(done, 0)) == NULL)
+		return (NULL);
+	crossthread_test_hold(cp, f);
+
+	v8plus_defer(op, cp, crossthread_test_holds_worker,
+	    crossthread_test_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * Count to some number, one step at a time and sleeping for a millisecond
+ * in each, in an incremental job, so that JavaScript has turns of the loop
+ * in between.  The job reports how many steps it took on completion.
+ */
+static boolean_t
+incremental_test_step(void *op __UNUSED, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+
+	(void) usleep(1000);
+
+	return (++cp->ctc_steps == cp->ctc_count);
+}
+
+static void
+incremental_test_done(void *op __UNUSED, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "steps", (double)cp->ctc_steps,
+	    V8PLUS_TYPE_NONE);
+
+	crossthread_test_report(cp);
+}
+
+static nvlist_t *
+example_static_test_incremental(const nvlist_t *ap)
+{
+	v8plus_jsfunc_t done;
+	crossthread_test_ctx_t *cp;
+	double steps;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_NUMBER, &steps,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (steps < 1) {
+		return (v8plus_throw_exception("RangeError",
+		    "step count must be positive", V8PLUS_TYPE_NONE));
+	}
+
+	if ((cp = crossthread_test_ctx(done, (uint_t)steps)) == NULL)
+		return (NULL);
+
+	v8plus_incremental(NULL, cp, incremental_test_step,
+	    incremental_test_done, 0);
+
+	return (v8plus_void());
+}
+
+/*
+ * Sum the contents of three typed arrays, returning the sums and the last
+ * array doubled, along with an int64 array added directly, which must
+ * become an ordinary array of integers rather than be read as doubles.
+ */
+static nvlist_t *
+example_static_test_arrays(const nvlist_t *ap)
+{
+	int64_t ints[] = { -1, 2, 1LL << 40 };
+	uint8_t *u8;
+	int32_t *i32;
+	double *f64, *twice;
+	uint_t nu8, ni32, nf64, i;
+	double usum = 0, isum = 0, fsum = 0;
+	nvlist_t *rp;
+	nvlist_t *res;
+	int err;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_UINT8_ARRAY, &u8, &nu8,
+	    V8PLUS_TYPE_INT32_ARRAY, &i32, &ni32,
+	    V8PLUS_TYPE_NUMBER_ARRAY, &f64, &nf64,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	for (i = 0; i < nu8; i++)
+		usum += u8[i];
+	for (i = 0; i < ni32; i++)
+		isum += i32[i];
+
+	if ((twice = calloc(nf64 + 1, sizeof (double))) == NULL)
+		return (v8plus_error(V8PLUSERR_NOMEM, "no memory for array"));
+	for (i = 0; i < nf64; i++) {
+		fsum += f64[i];
+		twice[i] = f64[i] * 2;
+	}
+
+	rp = v8plus_obj(
+	    V8PLUS_TYPE_INL_OBJECT, "res",
+		V8PLUS_TYPE_NUMBER, "u8", usum,
+		V8PLUS_TYPE_NUMBER, "i32", isum,
+		V8PLUS_TYPE_NUMBER, "f64", fsum,
+		V8PLUS_TYPE_NUMBER_ARRAY, "twice", twice, nf64,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE);
+	free(twice);
+
+	if (rp != NULL && ((err = nvlist_lookup_nvlist(rp, "res",
+	    &res)) != 0 || (err = nvlist_add_int64_array(res, "ints", ints,
+	    sizeof (ints) / sizeof (ints[0]))) != 0)) {
+		nvlist_free(rp);
+		return (v8plus_nverr(err, "ints"));
+	}
+
+	return (rp);
+}
+
+/*
+ * Sum the contents of a Buffer, inverting each byte in place, and return
+ * the same Buffer.
+ */
+static nvlist_t *
+example_static_test_buffer(const nvlist_t *ap)
+{
+	v8plus_buffer_t vb;
+	uint8_t *bp;
+	double sum = 0;
+	uint_t i;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_BUFFER, &vb,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	bp = vb.vb_data;
+	for (i = 0; i < vb.vb_len; i++) {
+		sum += bp[i];
+		bp[i] ^= 0xff;
+	}
+
+	return (v8plus_obj(
+	    V8PLUS_TYPE_INL_OBJECT, "res",
+		V8PLUS_TYPE_NUMBER, "sum", sum,
+		V8PLUS_TYPE_BUFFER, "same", &vb,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE));
+}
+
+/*
+ * Hold a function and a Buffer on the event loop thread, then take holds of
+ * the worker's own and drop the first ones before using either.  JavaScript
+ * has a moment to collect garbage in between.
+ */
+static void *
+crossthread_test_buffer_worker(void *op __UNUSED, void *ctx)
+{
+	crossthread_test_ctx_t *cp = ctx;
+	v8plus_jsfunc_t f = cp->ctc_funcs[0];
+	boolean_t same = B_FALSE;
+	nvlist_t *ap;
+	nvlist_t *rp;
+
+	v8plus_jsfunc_hold(f);
+	v8plus_buffer_hold(&cp->ctc_buf);
+	v8plus_jsfunc_rele(f);
+	v8plus_buffer_rele(&cp->ctc_buf);
+	cp->ctc_nfuncs = 0;
+
+	(void) usleep(50000);
+
+	(void) memset(cp->ctc_buf.vb_data, 'x', cp->ctc_buf.vb_len);
+	ap = v8plus_obj(V8PLUS_TYPE_BUFFER, "0", &cp->ctc_buf,
+	    V8PLUS_TYPE_NONE);
+	if (ap != NULL) {
+		if ((rp = v8plus_call(f, ap)) != NULL)
+			(void) nvlist_lookup_boolean_value(rp, "res", &same);
+		nvlist_free(rp);
+		nvlist_free(ap);
+	}
+	(void) v8plus_void();
+
+	v8plus_buffer_rele(&cp->ctc_buf);
+	v8plus_jsfunc_rele(f);
+
+	cp->ctc_report = v8plus_obj(
+	    V8PLUS_TYPE_BOOLEAN, "same", same,
+	    V8PLUS_TYPE_NONE);
+
+	return (NULL);
+}
+
+static nvlist_t *
+example_static_test_buffer_hold(const nvlist_t *ap)
+{
+	v8plus_jsfunc_t f, done;
+	v8plus_buffer_t vb;
+	crossthread_test_ctx_t *cp;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &f,
+	    V8PLUS_TYPE_BUFFER, &vb,
+	    V8PLUS_TYPE_JSFUNC, &done,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((cp = crossthread_test_ctx(done, 0)) == NULL)
+		return (NULL);
+	crossthread_test_hold(cp, f);
+	cp->ctc_buf = vb;
+	v8plus_buffer_hold(&cp->ctc_buf);
+
+	v8plus_defer(NULL, cp, crossthread_test_buffer_worker,
+	    crossthread_test_done);
+
+	return (v8plus_void());
+}
+
+/*
+ * v8+ boilerplate
+ */
+const v8plus_c_ctor_f v8plus_ctor = example_ctor;
+const v8plus_c_dtor_f v8plus_dtor = example_dtor;
+const char *v8plus_js_factory_name = "create";
+const char *v8plus_js_class_name = "Example";
+const v8plus_method_descr_t v8plus_methods[] = {
+	{
+		md_name: "set",
+		md_c_func: example_set
+	},
+	{
+		md_name: "add",
+		md_c_func: example_add
+	},
+	{
+		md_name: "multiply",
+		md_c_func: example_multiply
+	},
+	{
+		md_name: "toString",
+		md_c_func: example_toString
+	},
+	{
+		md_name: "multiplyAsync",
+		md_c_func: example_multiplyAsync
+	},
+	{
+		md_name: "testFutureFree",
+		md_c_func: example_testFutureFree
+	},
+	{
+		md_name: "testLatest",
+		md_c_func: example_testLatest
+	},
+	{
+		md_name: "testHolds",
+		md_c_func: example_testHolds
+	}
+};
+const uint_t v8plus_method_count =
+    sizeof (v8plus_methods) / sizeof (v8plus_methods[0]);
+
+const v8plus_static_descr_t v8plus_static_methods[] = {
+	{
+		sd_name: "static_add",
+		sd_c_func: example_static_add
+	},
+	{
+		sd_name: "static_object",
+		sd_c_func: example_static_object
+	},
+	{
+		sd_name: "static_multiplyAsync",
+		sd_c_func: example_static_multiplyAsync
+	},
+	{
+		sd_name: "static_exception",
+		sd_c_func: example_static_exception
+	},
+	{
+		sd_name: "static_crossthread_bench",
+		sd_c_func: example_static_crossthread_bench
+	},
+	{
+		sd_name: "static_test_mpsc",
+		sd_c_func: example_static_test_mpsc
+	},
+	{
+		sd_name: "static_test_post",
+		sd_c_func: example_static_test_post
+	},
+	{
+		sd_name: "static_test_batch",
+		sd_c_func: example_static_test_batch
+	},
+	{
+		sd_name: "static_test_admission",
+		sd_c_func: example_static_test_admission
+	},
+	{
+		sd_name: "static_test_timed",
+		sd_c_func: example_static_test_timed
+	},
+	{
+		sd_name: "static_test_channel",
+		sd_c_func: example_static_test_channel
+	},
+	{
+		sd_name: "static_test_promise",
+		sd_c_func: example_static_test_promise
+	},
+	{
+		sd_name: "static_test_counters",
+		sd_c_func: example_static_test_counters
+	},
+	{
+		sd_name: "static_test_timers",
+		sd_c_func: example_static_test_timers
+	},
+	{
+		sd_name: "static_test_fd",
+		sd_c_func: example_static_test_fd
+	},
+	{
+		sd_name: "static_test_incremental",
+		sd_c_func: example_static_test_incremental
+	},
+	{
+		sd_name: "static_test_arrays",
+		sd_c_func: example_static_test_arrays
+	},
+	{
+		sd_name: "static_test_buffer",
+		sd_c_func: example_static_test_buffer
+	},
+	{
+		sd_name: "static_test_buffer_hold",
+		sd_c_func: example_static_test_buffer_hold
 	}
 };
 const uint_t v8plus_static_method_count =
@@ -0,0 +1,405 @@
+/*
+ * Copyright 2017 Joyent, Inc.
+ */
+
+/*
+ * Exercise the interfaces through which C code calls into JavaScript, from
+ * threads other than the event loop thread or from callbacks driven by the
+ * loop itself.  Each test starts its C side in example.c, which reports what
+ * it saw to a callback; the checks are made on the next turn of the loop, as
+ * an exception thrown back into C from a callback would be lost.
+ * Run with --expose-gc to have the tests of holds collect garbage while a
+ * worker holds its arguments.
+ */
+
+var assert = require('assert');
+var example = require('./example');
+
+/*
+ * Some of the interfaces tested require Node 0.12 or later.
+ */
+var modern = !/^v0\.([0-9]|1[01])\./.test(process.version);
+
+var tests = [];
+var passed = 0;
+
+function
+later(check, next)
+{
+	return (function (r) {
+		setImmediate(function () {
+			check(r);
+			next();
+		});
+	});
+}
+
+function
+spin(ms)
+{
+	var end = Date.now() + ms;
+
+	while (Date.now() < end)
+		;
+}
+
+tests.push(function mpsc(next) {
+	var threads = 16;
+	var calls = 5000;
+	var expected = [];
+	var errors = [];
+	var i;
+
+	for (i = 0; i < threads; i++)
+		expected.push(0);
+
+	example.static_test_mpsc(function (thread, seq) {
+		if (seq !== expected[thread] && errors.length < 10) {
+			errors.push('thread ' + thread + ' made call ' + seq +
+			    ' where ' + expected[thread] + ' was expected');
+		}
+		expected[thread] = seq + 1;
+	}, threads, calls, later(function (r) {
+		assert.equal(r.threads, threads);
+		assert.equal(r.failed, 0);
+		assert.deepEqual(errors, []);
+		for (i = 0; i < threads; i++)
+			assert.equal(expected[i], calls + 1);
+	}, next));
+});
+
+tests.push(function future_free(next) {
+	var ex = example.create();
+	var calls = 100;
+	var seen = [];
+
+	ex.__check = function (i, f) {
+		assert.equal(typeof (f), 'function');
+		seen.push(i);
+	};
+
+	ex.testFutureFree(calls, function () {}, later(function (r) {
+		assert.equal(r.failed, 0);
+	}, function wait() {
+		var i;
+
+		if (seen.length < calls) {
+			setTimeout(wait, 10);
+			return;
+		}
+		for (i = 0; i < calls; i++)
+			assert.equal(seen[i], i);
+		next();
+	}));
+});
+
+tests.push(function post(next) {
+	var calls = 100;
+	var seen = [];
+
+	example.static_test_post(function (n) {
+		seen.push(n);
+	}, function () {
+		throw (new Error('post failed'));
+	}, calls, later(function (r) {
+		var i;
+
+		assert.equal(r.failed, 0);
+		assert.equal(r.message, 'post failed');
+		assert.equal(seen.length, calls + 1);
+		for (i = 0; i < calls; i++)
+			assert.equal(seen[i], i);
+		assert.equal(seen[calls], -1);
+	}, next));
+});
+
+tests.push(function batch(next) {
+	var rounds = 50;
+	var sum = 0;
+	var i;
+
+	for (i = 0; i < 16; i++) {
+		if (i !== 5)
+			sum += i * i;
+	}
+
+	example.static_test_batch(function (n) {
+		if (n === 5)
+			throw (new Error('batch call 5'));
+		return (n * n);
+	}, rounds, later(function (r) {
+		assert.equal(r.sum, sum * rounds);
+		assert.equal(r.failed, rounds);
+		assert.equal(r.raised, rounds);
+		assert.equal(r.message, 'batch call 5');
+	}, next));
+});
+
+tests.push(function latest(next) {
+	var ex = example.create();
+	var count = 1000;
+	var calls = [];
+	var updates = [];
+
+	ex.__update = function (n) {
+		updates.push(n);
+	};
+
+	ex.testLatest(count, function (key, n) {
+		calls.push([ key, n ]);
+	}, later(function (r) {
+		assert.equal(r.failed, 0);
+		assert.deepEqual(calls, [ [ 1, count - 1 ],
+		    [ 2, 2 * (count - 1) ], [ 0, -1 ] ]);
+		assert.deepEqual(updates, [ count - 1 ]);
+	}, next));
+
+	spin(500);
+});
+
+tests.push(function admission(next) {
+	var calls = 0;
+
+	example.static_test_admission(function () {
+		++calls;
+	}, later(function (r) {
+		assert.equal(r.rejected, 6);
+		assert.ok(/queue is full/.test(r.message), r.message);
+		assert.equal(r.dropped, 0);
+		assert.equal(r.blocked, 0);
+		assert.equal(r.stats_rejected, 6);
+		assert.equal(r.stats_dropped, 10);
+		assert.ok(r.stats_blocked > 0);
+		assert.equal(calls, 4 + 10 + 1);
+	}, next));
+
+	spin(500);
+});
+
+tests.push(function timed(next) {
+	var never = 0;
+	var slow = 0;
+
+	example.static_test_timed(function () {
+		++never;
+	}, function () {
+		++slow;
+		spin(500);
+	}, later(function (r) {
+		assert.ok(/timed out before it was made/.test(r.before),
+		    r.before);
+		assert.ok(r.cancelled);
+		assert.ok(/cancelled before it was made/.test(r.cancel),
+		    r.cancel);
+		assert.ok(/timed out while in progress/.test(r.during),
+		    r.during);
+		assert.equal(never, 0);
+		assert.equal(slow, 1);
+	}, next));
+
+	spin(1000);
+});
+
+tests.push(function channel(next) {
+	var records = 2000;
+	var batches = 0;
+	var seen = 0;
+
+	example.static_test_channel(function (buf, ends, id) {
+		var start = 0;
+
+		ends.forEach(function (end) {
+			assert.equal(buf.toString('utf8', start, end),
+			    String(seen));
+			++seen;
+			start = end;
+		});
+
+		/*
+		 * Pause after the first batch, so that the writer must wait
+		 * for us to resume.
+		 */
+		if (batches++ === 0) {
+			setTimeout(function () {
+				example.v8plus_channel_resume(id);
+			}, 20);
+			return (false);
+		}
+		return (true);
+	}, records, later(function (r) {
+		assert.equal(seen, records);
+		assert.ok(batches > 1);
+		assert.ok(r.waits > 0);
+	}, next));
+});
+
+tests.push(function promise(next) {
+	if (!modern) {
+		next();
+		return;
+	}
+
+	example.static_test_promise(function () {
+		return (new Promise(function (resolve) {
+			setTimeout(function () { resolve(42); }, 10);
+		}));
+	}, function () {
+		return (new Promise(function (resolve, reject) {
+			setTimeout(function () {
+				reject(new Error('promise rejected'));
+			}, 10);
+		}));
+	}, later(function (r) {
+		assert.equal(r.value, 42);
+		assert.equal(r.future_value, 42);
+		assert.equal(r.message, 'promise rejected');
+	}, next));
+});
+
+tests.push(function counters(next) {
+	var threads = 8;
+	var adds = 10000;
+	var stats;
+
+	if (!modern) {
+		next();
+		return;
+	}
+
+	example.static_test_counters(threads, adds, later(function (r) {
+		assert.equal(r.threads, threads);
+		assert.equal(r.total, threads * adds);
+		assert.equal(r.last, adds - 1);
+		assert.equal(stats[0], threads * adds);
+		assert.equal(stats[1], adds - 1);
+	}, next));
+
+	stats = example.v8plus_counters('example_test');
+	assert.ok(stats instanceof Float64Array);
+	assert.equal(stats.length, 2);
+	assert.throws(function () {
+		example.v8plus_counters('example_missing');
+	});
+});
+
+tests.push(function timers(next) {
+	example.static_test_timers(later(function (r) {
+		assert.equal(r.once, 1);
+		assert.equal(r.repeat, 5);
+		assert.equal(r.never, 0);
+	}, next));
+});
+
+tests.push(function fd(next) {
+	example.static_test_fd(later(function (r) {
+		assert.ok(r.readable);
+		assert.equal(r.read, 1);
+		assert.equal(r.writable, 1);
+		assert.equal(r.suspend, 0);
+	}, next));
+});
+
+tests.push(function holds(next) {
+	example.create('7').testHolds(function (n) {
+		return (n * 2);
+	}, later(function (r) {
+		assert.equal(r.twice, 42);
+		assert.equal(r.value, '7');
+	}, next));
+
+	if (typeof (gc) === 'function')
+		gc();
+});
+
+tests.push(function incremental(next) {
+	var steps = 50;
+	var ticks = 0;
+	var finished = false;
+
+	function
+	tick()
+	{
+		if (finished)
+			return;
+		++ticks;
+		setImmediate(tick);
+	}
+
+	example.static_test_incremental(steps, later(function (r) {
+		finished = true;
+		assert.equal(r.steps, steps);
+		assert.ok(ticks > 1, 'loop turned only ' + ticks + ' times');
+	}, next));
+
+	setImmediate(tick);
+});
+
+tests.push(function arrays(next) {
+	var r;
+
+	if (!modern) {
+		next();
+		return;
+	}
+
+	r = example.static_test_arrays(new Uint8Array([ 1, 2, 3 ]),
+	    new Int32Array([ -4, 5, 6 ]), new Float64Array([ 0.5, 1.5 ]));
+
+	assert.equal(r.u8, 6);
+	assert.equal(r.i32, 7);
+	assert.equal(r.f64, 2);
+	assert.ok(r.twice instanceof Float64Array);
+	assert.deepEqual(Array.prototype.slice.call(r.twice), [ 1, 3 ]);
+	assert.deepEqual(r.ints, [ -1, 2, Math.pow(2, 40) ]);
+	next();
+});
+
+tests.push(function buffer(next) {
+	var buf = new Buffer([ 1, 2, 3, 250 ]);
+	var r;
+
+	if (!modern) {
+		next();
+		return;
+	}
+
+	r = example.static_test_buffer(buf);
+
+	assert.equal(r.sum, 256);
+	assert.deepEqual(Array.prototype.slice.call(buf), [ 254, 253, 252, 5 ]);
+	assert.ok(r.same === buf);
+	next();
+});
+
+tests.push(function buffer_hold(next) {
+	var buf = new Buffer(64);
+
+	example.static_test_buffer_hold(function (b) {
+		return (b === buf && b.toString() === new Array(65).join('x'));
+	}, buf, later(function (r) {
+		assert.ok(r.same);
+	}, next));
+
+	if (typeof (gc) === 'function')
+		gc();
+});
+
+function
+run(idx)
+{
+	if (idx >= tests.length)
+		return;
+
+	tests[idx](function () {
+		console.log('ok %d - %s', idx + 1, tests[idx].name);
+		++passed;
+		run(idx + 1);
+	});
+}
+
+process.on('exit', function () {
+	assert.equal(passed, tests.length, 'only ' + passed + ' of ' +
+	    tests.length + ' tests completed');
+});
+
+run(0);
@@ -15,10 +15,20 @@ extern "C" {
 
 #define	V8PLUS_OBJ_TYPE_MEMBER	".__v8plus_type"
 #define	V8PLUS_JSF_COOKIE	".__v8plus_jsfunc_cookie"
+#define	V8PLUS_NUM_COOKIE	".__v8plus_number_arrays"
+
+/*
+ * A Buffer passed in place is a uint64 array of its handle, which is held
+ * and released as a function's is, the address of its contents and its
+ * length; a function is an array of only its handle.
+ */
+#define	V8PLUS_BUFFER_NVALS	3
 
 #define	V8PLUS_STRINGIFY_HELPER(_x)	#_x
 #define	V8PLUS_STRINGIFY(_x)	V8PLUS_STRINGIFY_HELPER(_x)
 
+struct uv_loop_s;
+
 extern __thread nv_alloc_t _v8plus_nva;
 extern __thread char _v8plus_exception_buf[1024];
 extern __thread nvlist_t *_v8plus_pending_exception;
@@ -28,9 +38,73 @@ extern __thread nvlist_t *_v8plus_pending_exception;
  */
 extern void v8plus_clear_exception(void);
 extern boolean_t v8plus_in_event_thread(void);
-extern void v8plus_crossthread_init(void);
+extern void v8plus_crossthread_init(struct uv_loop_s *);
+extern void v8plus_crossthread_fini(void);
 extern nvlist_t *_v8plus_alloc_exception(void);
 
+/*
+ * libnvpair has no arrays of doubles, so number arrays are int64 arrays
+ * carrying the bits of doubles, and the names of those in a list are
+ * recorded in its V8PLUS_NUM_COOKIE member, so that int64 arrays added by C
+ * code may still be converted as integers.
+ */
+extern int v8plus_number_array_mark(nvlist_t *, const char *);
+extern boolean_t v8plus_number_array_marked(const nvlist_t *, const char *);
+
+/*
+ * Each event loop's JavaScript function handles are numbered from the base
+ * returned by v8plus_jsfunc_base(), which encodes the loop's number in the
+ * upper bits; objects created on any loop are registered so that calls to
+ * them from other threads can be sent to the right loop.
+ */
+#define	V8PLUS_JSFUNC_LOOP_SHIFT	48
+
+extern uint64_t v8plus_jsfunc_base(void);
+extern void v8plus_obj_register(const void *);
+extern void v8plus_obj_unregister(const void *);
+
+/*
+ * Direct calls that, given a settle function, return NULL and set the flag
+ * if the function returns a Promise, calling the settle function with the
+ * result once the Promise has settled.
+ */
+typedef void (*v8plus_settle_f)(void *, nvlist_t *);
+
+extern nvlist_t *v8plus_call_direct_await(uint64_t, const nvlist_t *,
+    v8plus_settle_f, void *, boolean_t *);
+extern nvlist_t *v8plus_method_call_direct_await(void *, const char *,
+    const nvlist_t *, v8plus_settle_f, void *, boolean_t *);
+extern void v8plus_run_microtasks(void);
+
+extern boolean_t v8plus_channel_call_direct(uint64_t, uint64_t,
+    const void *, size_t, const uint32_t *, uint_t);
+
+extern void *v8plus_counters_lookup(const char *, uint_t *);
+extern boolean_t v8plus_dense_arrays_enabled(void);
+
+/*
+ * Holds are counted in C; these take and drop the single V8 reference each
+ * held object or function carries.
+ */
+extern void v8plus_obj_ref(const void *);
+extern void v8plus_obj_unref(const void *);
+extern void v8plus_jsfunc_register(uint64_t);
+extern void v8plus_jsfunc_persist(uint64_t);
+extern void v8plus_jsfunc_unref(uint64_t);
+
+/*
+ * Called as an event loop exits to destroy the objects and drop the
+ * functions still in this thread's tables.
+ */
+extern void v8plus_obj_fini(void);
+extern void v8plus_jsfunc_fini(void);
+
+/*
+ * Static functions attached by v8plus to every module.
+ */
+extern const struct v8plus_static_descr *const v8plus_builtin_statics;
+extern const uint_t v8plus_builtin_static_count;
+
 #ifdef	__cplusplus
 }
 #endif	/* __cplusplus */
@@ -8,13 +8,17 @@
 #include <sys/types.h>
 #include <sys/atomic.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <errno.h>
 #include <uv.h>
 #include <node_version.h>
 #include <pthread.h>
+#include <sched.h>
 #include <alloca.h>
+#include <limits.h>
+#include <time.h>
 #include <libnvpair.h>
 #include "v8plus_c_impl.h"
 #include "v8plus_glue.h"
@@ -33,8 +37,26 @@
 __thread nv_alloc_t _v8plus_nva;
 __thread char _v8plus_exception_buf[1024];
 __thread nvlist_t *_v8plus_pending_exception;
+static __thread boolean_t _v8plus_nva_ready;
 
-static uint_t init_done;
+static pthread_once_t _v8plus_init_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Each thread that may throw an exception needs its own fixed allocator
+ * backed by its own buffer.  Exceptions may be thrown on any thread; in
+ * particular, the result of a cross-thread call may carry one back to the
+ * thread that made it.
+ */
+static void
+v8plus_nva_init(void)
+{
+	if (_v8plus_nva_ready)
+		return;
+
+	(void) nv_alloc_init(&_v8plus_nva, nv_fixed_ops,
+	    _v8plus_exception_buf, sizeof (_v8plus_exception_buf));
+	_v8plus_nva_ready = B_TRUE;
+}
 
 typedef struct v8plus_uv_ctx {
 	void *vuc_obj;
@@ -42,19 +64,258 @@ typedef struct v8plus_uv_ctx {
 	void *vuc_result;
 	v8plus_worker_f vuc_worker;
 	v8plus_completion_f vuc_completion;
+	struct v8plus_loop *vuc_loop;
 } v8plus_uv_ctx_t;
 
 static pthread_mutexattr_t _v8plus_mutexattr;
 
-static STAILQ_HEAD(v8plus_callq_head, v8plus_async_call) _v8plus_callq =
-    STAILQ_HEAD_INITIALIZER(_v8plus_callq);
-static pthread_mutex_t _v8plus_callq_mtx;
-static pthread_t _v8plus_uv_event_thread;
-static uv_async_t _v8plus_uv_async;
+/*
+ * Cross-thread calls are handed to the event loop thread through lock-free
+ * multiple-producer, single-consumer queues, one for each priority lane.
+ * Producers push each call onto the head of an intrusive singly-linked list
+ * with a compare-and-swap, so the list is in LIFO order.  The event loop
+ * thread takes the entire list at once with a single atomic swap, reverses
+ * it, and appends it to the lane's private FIFO, vcq_runq, from which calls
+ * are then run in the order in which they were posted.  Only the event loop
+ * thread ever touches vcq_runq.
+ *
+ * Because the consumer only ever removes the whole list, never individual
+ * entries, there is no ABA hazard on vcq_head.
+ */
+STAILQ_HEAD(v8plus_callq_head, v8plus_async_call);
+
+typedef struct v8plus_callq {
+	struct v8plus_async_call *volatile vcq_head;
+	struct v8plus_callq_head vcq_runq;
+} v8plus_callq_t;
+
+/*
+ * Latencies are recorded in log-linear histograms in the manner of HDR
+ * histograms: each power of two is split into V8PLUS_HIST_SUB buckets, so
+ * that any value is recorded to within 1/V8PLUS_HIST_SUB of its magnitude
+ * in constant time and space, whatever its range.
+ */
+#define	V8PLUS_HIST_SUBBITS	3
+#define	V8PLUS_HIST_SUB		(1U << V8PLUS_HIST_SUBBITS)
+#define	V8PLUS_HIST_BUCKETS	\
+	((64 - V8PLUS_HIST_SUBBITS + 1) << V8PLUS_HIST_SUBBITS)
+
+typedef struct v8plus_hist {
+	uint64_t vh_total;
+	uint64_t vh_max;
+	uint64_t vh_buckets[V8PLUS_HIST_BUCKETS];
+} v8plus_hist_t;
+
+typedef struct v8plus_call_kind_stats {
+	uint64_t vcks_count;
+	v8plus_hist_t vcks_wait;
+	v8plus_hist_t vcks_exec;
+} v8plus_call_kind_stats_t;
+
+/*
+ * Each thread running a JavaScript event loop into which v8plus has been
+ * loaded has its own queues, async handle, and event loop hold count, along
+ * with the drain policy and the drain and call statistics for its queues.
+ * In Node, these are the main thread and each worker thread; see "Multiple
+ * Event Loops" in README.md.  Only the members marked as such may be touched
+ * by threads other than the loop's own.  Loops are numbered by the slot they
+ * occupy; the number is part of each JavaScript function handle created on
+ * the loop so that calls to the function can be routed there.
+ *
+ * When the last module loaded into a loop is unloaded, the loop exits; see
+ * v8plus_crossthread_fini().  Other threads may still hold pointers to it,
+ * so the structure itself is never freed.  Instead, once its handles have
+ * closed, its slot is marked free and both are reused by the next loop to be
+ * set up.  Producers pin the loop while they queue work and wake it, so that
+ * it cannot close its async handle under them; work queued once it has
+ * exited is cancelled by whoever queued it.  Function handles keep counting
+ * up from where the previous occupant of the slot left off, so that a handle
+ * from an exited loop can never name a function on its successor.
+ */
+#define	V8PLUS_MAX_LOOPS	1024
+
+typedef struct v8plus_loop {
+	uint_t vl_id;
+	uv_loop_t *vl_uv;
+	pthread_t vl_thread;
+	uint_t vl_modules;
+	uv_async_t vl_async;			/* any thread */
+	volatile uint_t vl_users;		/* any thread */
+	volatile boolean_t vl_exited;		/* any thread */
+	uint_t vl_closing;
+	boolean_t vl_free;			/* _v8plus_loops_mtx */
+
+	/*
+	 * The first function handle created by this occupant of the slot,
+	 * and the next to be created by it or its successor.
+	 */
+	uint64_t vl_jsfunc_first;
+	uint64_t vl_jsfunc_next;
+
+	/*
+	 * Deferred work yet to return from its worker; see v8plus_defer().
+	 */
+	pthread_mutex_t vl_deferred_mtx;		/* any thread */
+	pthread_cond_t vl_deferred_cv;			/* any thread */
+	uint_t vl_deferred;				/* any thread */
+	v8plus_callq_t vl_callqs[V8PLUS_LANE_COUNT];	/* vcq_head only */
+	volatile uint_t vl_eventloop_refcount;		/* any thread */
+
+	/*
+	 * Releases that must wait for earlier calls; see
+	 * v8plus_release_ready().
+	 */
+	struct v8plus_callq_head vl_release_deferq;
+
+	/*
+	 * Release buffers filled by other threads, and the releases taken
+	 * from them that are waiting for earlier calls; see
+	 * v8plus_release_flush().
+	 */
+	pthread_mutex_t vl_relbuf_mtx;			/* any thread */
+	LIST_HEAD(, v8plus_relbuf) vl_relbufs;		/* any thread */
+	volatile uint_t vl_relbuf_pending;		/* any thread */
+	struct v8plus_release *vl_rels;
+	uint_t vl_nrels;
+	uint_t vl_maxrels;
+
+	/*
+	 * The lane currently being drained and the number of calls it may
+	 * yet run before we move on to the next; see v8plus_callq_next().
+	 */
+	v8plus_lane_t vl_drain_lane;
+	uint_t vl_drain_credit;
+	uint_t vl_lane_weights[V8PLUS_LANE_COUNT];
+
+	/*
+	 * Drain policy, its state, and statistics; see v8plus_drain_policy()
+	 * and v8plus_drain_account().
+	 */
+	v8plus_drain_policy_t vl_drain_policy;
+	uint_t vl_drain_max_items;
+	uint64_t vl_drain_max_ns;
+	uint_t vl_drain_adaptive_items;
+	uint64_t vl_drain_item_ns;
+	v8plus_drain_stats_t vl_drain_stats;
+
+	v8plus_call_kind_stats_t vl_call_kind_stats[V8PLUS_CALL_KINDS];
+
+	/*
+	 * Record channels delivering to this loop; see
+	 * v8plus_channel_flush().
+	 */
+	LIST_HEAD(, v8plus_channel) vl_channels;
+	volatile uint_t vl_chan_pending;		/* any thread */
+	boolean_t vl_chan_flushing;
+
+	/*
+	 * Native timers, ordered by when they are due, all driven by a single
+	 * libuv timer; see v8plus_timer_callback().
+	 */
+	uv_timer_t vl_timer;
+	TAILQ_HEAD(v8plus_timerq, v8plus_timer) vl_timers;
+	struct v8plus_timerq vl_timer_batch;
+
+	/*
+	 * Incremental jobs and the handles that run them; see
+	 * v8plus_incremental_check().
+	 */
+	uv_idle_t vl_incr_idle;
+	uv_check_t vl_incr_check;
+	TAILQ_HEAD(v8plus_incrq, v8plus_incremental) vl_incrs;
+
+	/*
+	 * Open file descriptor watches, closed if the loop exits first.
+	 */
+	LIST_HEAD(, v8plus_fd_watch) vl_fd_watches;
+} v8plus_loop_t;
+
+static v8plus_loop_t *volatile _v8plus_loops[V8PLUS_MAX_LOOPS];
+static volatile uint_t _v8plus_nloops;
+static pthread_mutex_t _v8plus_loops_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The loop run by this thread, if any.  A thread running work on behalf of
+ * a loop, such as a deferred worker, instead has that loop as its caller
+ * loop, which is where requests not otherwise bound to any loop are sent.
+ */
+static __thread v8plus_loop_t *_v8plus_loop;
+static __thread v8plus_loop_t *_v8plus_caller_loop;
+
+/*
+ * Every call is stamped with a sequence number as it is queued, which lets
+ * the event loop thread keep releases, which jump ahead in the high lane,
+ * from overtaking calls posted before them in other lanes; see
+ * v8plus_release_ready().
+ */
+static volatile uint64_t _v8plus_callq_seq;
+
+/*
+ * The default number of calls each lane may run before the next lane is
+ * drained; each loop has its own weights.
+ */
+static const uint_t _v8plus_lane_weights[V8PLUS_LANE_COUNT] = {
+	16,			/* V8PLUS_LANE_HIGH */
+	4,			/* V8PLUS_LANE_NORMAL */
+	1			/* V8PLUS_LANE_BULK */
+};
+
+static __thread v8plus_lane_t _v8plus_call_lane = V8PLUS_LANE_NORMAL;
+
+/*
+ * The number of calls queued, or about to be, and the limit above which
+ * producers are made to wait, fail or drop their calls according to their
+ * policy; see v8plus_callq_admit().  A limit of 0 means no limit.  Producers
+ * waiting for room sleep on _v8plus_callq_room_cv.
+ */
+static volatile uint_t _v8plus_callq_depth;
+static volatile uint_t _v8plus_callq_hiwat;
+static volatile uint_t _v8plus_callq_waiters;
+static pthread_mutex_t _v8plus_callq_room_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _v8plus_callq_room_cv = PTHREAD_COND_INITIALIZER;
+static v8plus_queue_stats_t _v8plus_queue_stats;
+
+static __thread v8plus_queue_policy_t _v8plus_queue_policy =
+    V8PLUS_QUEUE_BLOCK;
+
+/*
+ * Whether calls made by this thread whose results are wanted wait for a
+ * returned Promise to settle; see v8plus_await_promises().
+ */
+static __thread boolean_t _v8plus_await_promises;
+
+/*
+ * Whether JavaScript arrays whose elements are all numbers, all booleans or
+ * all strings are passed to C as nvlist arrays; see v8plus_dense_arrays().
+ */
+static volatile boolean_t _v8plus_dense_arrays;
+
+/*
+ * Coalescing posts that are queued but not yet running are also found in
+ * this table, hashed by target and key, so that a newer update can replace
+ * the arguments of an older one instead of being queued behind it.
+ */
+#define	V8PLUS_COALESCE_BUCKETS	64
+
+typedef struct v8plus_coalesce_bucket {
+	pthread_mutex_t vcb_mtx;
+	LIST_HEAD(, v8plus_async_call) vcb_calls;
+} v8plus_coalesce_bucket_t;
+
+static v8plus_coalesce_bucket_t _v8plus_coalesce[V8PLUS_COALESCE_BUCKETS];
+
 static char _v8plus_panic_buf[1024];
 
-static int _v8plus_eventloop_refcount;
+/*
+ * Whether queued calls are timestamped as they are queued and run, so that
+ * the time each spends waiting and running can be recorded; see
+ * v8plus_call_stats().
+ */
+static volatile boolean_t _v8plus_call_timing = B_TRUE;
 
+/*
+ * These are in the same order as the public v8plus_call_kind_t.
+ */
 typedef enum v8plus_async_call_type {
 	ACT_OBJECT_CALL = 1,
 	ACT_OBJECT_RELEASE,
@@ -65,12 +326,23 @@ typedef enum v8plus_async_call_type {
 
 typedef enum v8plus_async_call_flags {
 	ACF_COMPLETED	= 0x01,
-	ACF_NOREPLY	= 0x02
+	ACF_NOREPLY	= 0x02,
+	ACF_FUTURE	= 0x04,
+	ACF_DETACHED	= 0x08,
+	ACF_COALESCED	= 0x10,
+	ACF_OWNARGS	= 0x20,
+	ACF_STARTED	= 0x40,
+	ACF_CANCELLED	= 0x80,
+	ACF_AWAIT	= 0x100
 } v8plus_async_call_flags_t;
 
 typedef struct v8plus_async_call {
 	v8plus_async_call_type_t vac_type;
 	v8plus_async_call_flags_t vac_flags;
+	v8plus_loop_t *vac_loop;
+	v8plus_lane_t vac_lane;
+	uint64_t vac_seq;
+	uint64_t vac_enqueued;
 
 	/*
 	 * For ACT_OBJECT_{CALL,RELEASE}:
@@ -88,384 +360,4824 @@ typedef struct v8plus_async_call {
 	const nvlist_t *vac_lp;
 	nvlist_t *vac_return;
 
+	/*
+	 * For ACF_FUTURE calls only: any exception thrown by the call, which
+	 * must be carried back to the thread that collects the result, and
+	 * the continuation, if any, to be run on completion.
+	 */
+	nvlist_t *vac_exception;
+	v8plus_future_f vac_then;
+	void *vac_then_arg;
+
+	/*
+	 * For calls submitted together by v8plus_call_batch(), the batch
+	 * whose waiter is to be woken when the last of them completes.
+	 */
+	struct v8plus_async_batch *vac_batch;
+
+	/*
+	 * For synchronous calls, the calling thread's waiter and the flag it
+	 * watches for completion.  The mutex and condition variable below are
+	 * used only by futures, which may be waited on by any thread.
+	 */
+	struct v8plus_waiter *vac_waiter;
+	volatile uint_t vac_done;
+
 	pthread_cond_t vac_cv;
 	pthread_mutex_t vac_mtx;
 
+	/*
+	 * For ACF_COALESCED posts, the key distinguishing updates to the same
+	 * function, and the linkage on the coalescing table while queued.
+	 */
+	uint64_t vac_key;
+	LIST_ENTRY(v8plus_async_call) vac_coalesce_entry;
+
+	struct v8plus_async_call *vac_next;
 	STAILQ_ENTRY(v8plus_async_call) vac_callq_entry;
 } v8plus_async_call_t;
 
+/*
+ * Each thread that makes synchronous cross-thread calls has a single waiter,
+ * created the first time it is needed and reused for every call the thread
+ * makes thereafter, so that a call need not set up and tear down a mutex and
+ * condition variable of its own.  A caller first spins briefly in the hope
+ * that the event loop thread gets to the call quickly, and only then parks
+ * on its condition variable.  The event loop thread sets vac_done and
+ * signals the waiter only if its owner has parked, all while holding the
+ * waiter's mutex.  The waiter outlives any call; because the event loop
+ * thread drops the mutex only after it has finished with both the call and
+ * the waiter, the destructor can safely take the mutex to wait it out.
+ */
+typedef struct v8plus_waiter {
+	pthread_mutex_t vw_mtx;
+	pthread_cond_t vw_cv;
+	boolean_t vw_parked;
+} v8plus_waiter_t;
+
+#define	V8PLUS_WAITER_SPIN	1000
+
+#if defined(__i386) || defined(__amd64) || defined(__x86_64__)
+#define	V8PLUS_SPIN_PAUSE()	__asm__ __volatile__("pause")
+#else
+#define	V8PLUS_SPIN_PAUSE()	membar_consumer()
+#endif
+
+static pthread_key_t _v8plus_waiter_key;
+static pthread_once_t _v8plus_waiter_once = PTHREAD_ONCE_INIT;
+static __thread v8plus_waiter_t *_v8plus_waiter;
+
+/*
+ * The count of calls yet to complete is protected by vab_mtx, so that the
+ * waiter, which owns this structure, cannot see it reach zero and tear the
+ * structure down while the last completer is still using it.
+ */
+typedef struct v8plus_async_batch {
+	uint_t vab_pending;
+	pthread_cond_t vab_cv;
+	pthread_mutex_t vab_mtx;
+} v8plus_async_batch_t;
+
+/*
+ * nvlist_dup() copies the handles of the functions and Buffers in a list,
+ * but not the holds that freeing the list will release, so we take one more
+ * hold on each for the copy.
+ */
+static int
+v8plus_args_dup(const nvlist_t *lp, nvlist_t **dpp)
+{
+	nvpair_t *pp = NULL;
+	uint64_t *vp;
+	uint_t nv;
+	int err;
+
+	if ((err = nvlist_dup((nvlist_t *)lp, dpp, 0)) != 0)
+		return (err);
+
+	if (!nvlist_exists(*dpp, V8PLUS_JSF_COOKIE))
+		return (0);
+
+	while ((pp = nvlist_next_nvpair(*dpp, pp)) != NULL) {
+		if (nvpair_type(pp) != DATA_TYPE_UINT64_ARRAY)
+			continue;
+		VERIFY(nvpair_value_uint64_array(pp, &vp, &nv) == 0);
+		v8plus_jsfunc_hold(vp[0]);
+	}
+
+	return (0);
+}
+
 boolean_t
 v8plus_in_event_thread(void)
 {
-	return (_v8plus_uv_event_thread == pthread_self() ? B_TRUE : B_FALSE);
+	return (_v8plus_loop != NULL ? B_TRUE : B_FALSE);
 }
 
-static void
-#if NODE_VERSION_AT_LEAST(0, 12, 0)
-v8plus_async_callback(uv_async_t *async __UNUSED)
-#else
-v8plus_async_callback(uv_async_t *async __UNUSED, int status __UNUSED)
-#endif
+static v8plus_loop_t *
+v8plus_loop_self(void)
 {
-	int processed = 0;
-	int err;
+	if (_v8plus_loop == NULL)
+		v8plus_panic("not running on an event loop thread");
 
-	if (v8plus_in_event_thread() != B_TRUE)
-		v8plus_panic("async callback called outside of event loop");
+	return (_v8plus_loop);
+}
 
-	for (;;) {
-		v8plus_async_call_t *vac = NULL;
+/*
+ * The loop to which a request not bound to any object or function, such as
+ * an event loop release, is sent: our own, the one on whose behalf we are
+ * working, or failing those the first.
+ */
+static v8plus_loop_t *
+v8plus_loop_default(void)
+{
+	if (_v8plus_loop != NULL)
+		return (_v8plus_loop);
+	if (_v8plus_caller_loop != NULL)
+		return (_v8plus_caller_loop);
 
-		/*
-		 * If a high rate of work arrives from other threads, it's
-		 * possible that we'll remain in this loop forever.  To
-		 * prevent that from happening, we will process a maximum
-		 * of 1000 function calls per turn of the event loop.
-		 */
-		if (processed > 1000) {
-			/*
-			 * Make sure this callback is called again on the
-			 * next turn.
-			 */
-			uv_async_send(&_v8plus_uv_async);
-			break;
-		}
+	return (_v8plus_loops[0]);
+}
 
-		/*
-		 * Fetch the next queued method:
-		 */
-		err = pthread_mutex_lock(&_v8plus_callq_mtx);
-		if (err != 0) {
-			v8plus_panic("could not lock async queue mutex: %s",
-			    strerror(err));
-		}
-		if (!STAILQ_EMPTY(&_v8plus_callq)) {
-			vac = STAILQ_FIRST(&_v8plus_callq);
-			STAILQ_REMOVE_HEAD(&_v8plus_callq, vac_callq_entry);
-		}
-		err = pthread_mutex_unlock(&_v8plus_callq_mtx);
-		if (err != 0) {
-			v8plus_panic("could not unlock async queue mutex: %s",
-			    strerror(err));
-		}
+/*
+ * Pin a loop while queueing work for it and waking it from another thread,
+ * returning B_FALSE if it has exited.  A loop that is exiting waits for its
+ * pins to be dropped before it takes what has been queued and closes its
+ * async handle.
+ */
+static boolean_t
+v8plus_loop_pin(v8plus_loop_t *loop)
+{
+	atomic_inc_uint(&loop->vl_users);
+	membar_enter();
+	if (loop->vl_exited) {
+		atomic_dec_uint(&loop->vl_users);
+		return (B_FALSE);
+	}
 
-		if (vac == NULL)
-			break;
+	return (B_TRUE);
+}
 
-		/*
-		 * Run the queued method:
-		 */
-		processed++;
-		if (vac->vac_flags & ACF_COMPLETED)
-			v8plus_panic("async call already run");
+static void
+v8plus_loop_unpin(v8plus_loop_t *loop)
+{
+	membar_exit();
+	atomic_dec_uint(&loop->vl_users);
+}
 
-		switch (vac->vac_type) {
-		case ACT_OBJECT_CALL:
-			vac->vac_return = v8plus_method_call_direct(
-			    vac->vac_cop, vac->vac_name, vac->vac_lp);
-			break;
-		case ACT_OBJECT_RELEASE:
-			v8plus_obj_rele_direct(vac->vac_cop);
-			break;
-		case ACT_JSFUNC_CALL:
-			vac->vac_return = v8plus_call_direct(
-			    vac->vac_func, vac->vac_lp);
-			break;
-		case ACT_JSFUNC_RELEASE:
-			v8plus_jsfunc_rele_direct(vac->vac_func);
-			break;
-		case ACT_EVENTLOOP_RELEASE:
-			v8plus_eventloop_rele_direct();
-			break;
-		}
+/*
+ * Event loop holds are counted atomically so that other threads may add to
+ * them, but only the loop's own thread may reference or unreference its
+ * async handle; a release that drops the count to zero on another thread is
+ * completed here, provided no new hold has been taken in the meantime.
+ */
+static void
+v8plus_eventloop_unref(v8plus_loop_t *loop)
+{
+	if (loop->vl_eventloop_refcount == 0)
+		uv_unref((uv_handle_t *)&loop->vl_async);
+}
 
-		if (vac->vac_flags & ACF_NOREPLY) {
-			/*
-			 * The caller posted this event and is not sleeping
-			 * on a reply.  Just free the call structure and move
-			 * on.
-			 */
-			if (vac->vac_lp != NULL)
-				nvlist_free((nvlist_t *)vac->vac_lp);
-			free(vac);
-			continue;
-		}
+/*
+ * JavaScript function handles carry the number of the loop on which they
+ * were created in their upper bits.
+ */
+uint64_t
+v8plus_jsfunc_base(void)
+{
+	return (v8plus_loop_self()->vl_jsfunc_next);
+}
 
-		err = pthread_mutex_lock(&vac->vac_mtx);
-		if (err != 0) {
-			v8plus_panic("could not lock async call mutex: %s",
-			    strerror(err));
-		}
-		vac->vac_flags |= ACF_COMPLETED;
-		err = pthread_cond_broadcast(&vac->vac_cv);
-		if (err != 0) {
-			v8plus_panic("could not signal async call condvar: %s",
-			    strerror(err));
-		}
-		err = pthread_mutex_unlock(&vac->vac_mtx);
-		if (err != 0) {
-			v8plus_panic("could not unlock async call mutex: %s",
-			    strerror(err));
-		}
+/*
+ * Whether a function handle was created by an earlier occupant of its loop's
+ * slot, which has since exited.
+ */
+static boolean_t
+v8plus_jsfunc_stale(v8plus_loop_t *loop, v8plus_jsfunc_t f)
+{
+	return (f < loop->vl_jsfunc_first ? B_TRUE : B_FALSE);
+}
+
+static v8plus_loop_t *
+v8plus_jsfunc_loop(v8plus_jsfunc_t f)
+{
+	uint64_t id = f >> V8PLUS_JSFUNC_LOOP_SHIFT;
+
+	if (id >= _v8plus_nloops || _v8plus_loops[id] == NULL) {
+		v8plus_panic("callback hash tag %llu has no loop",
+		    (unsigned long long)f);
 	}
+
+	return (_v8plus_loops[id]);
 }
 
 /*
- * As we cannot manipulate v8plus/V8/Node structures directly from outside the
- * event loop thread, we push the call arguments onto a queue and post to the
- * event loop thread.  We then sleep on our condition variable until the event
- * loop thread makes the call for us and wakes us up.
- *
- * This routine implements the parts of this interaction common to all
- * variants.
+ * Objects must be mapped to a loop in the same way.  As they are identified by
+ * the consumer's own pointers, we keep a table of those created on any loop
+ * but the first; an object not found there belongs to the first loop, so
+ * that a process with only one loop need never consult the table.
  */
-static nvlist_t *
-v8plus_cross_thread_call(v8plus_async_call_t *vac)
+#define	V8PLUS_OBJREG_BUCKETS	64
+
+typedef struct v8plus_objreg_ent {
+	const void *voe_cop;
+	v8plus_loop_t *voe_loop;
+	LIST_ENTRY(v8plus_objreg_ent) voe_entry;
+} v8plus_objreg_ent_t;
+
+typedef struct v8plus_objreg_bucket {
+	pthread_mutex_t vob_mtx;
+	LIST_HEAD(, v8plus_objreg_ent) vob_ents;
+} v8plus_objreg_bucket_t;
+
+static v8plus_objreg_bucket_t _v8plus_objreg[V8PLUS_OBJREG_BUCKETS];
+
+static uint_t
+v8plus_key_hash(uint64_t h, uint_t nbuckets)
+{
+	h ^= h >> 17;
+	h *= 0x9e3779b97f4a7c15ULL;
+
+	return ((h >> 32) % nbuckets);
+}
+
+static v8plus_objreg_bucket_t *
+v8plus_objreg_bucket(const void *cop)
+{
+	return (&_v8plus_objreg[v8plus_key_hash(
+	    (uint64_t)(uintptr_t)cop >> 4, V8PLUS_OBJREG_BUCKETS)]);
+}
+
+static void
+v8plus_objreg_lock(v8plus_objreg_bucket_t *vobp)
 {
-	boolean_t noreply = (vac->vac_flags & ACF_NOREPLY);
 	int err;
 
-	/*
-	 * Common call structure initialisation:
-	 */
-	err = pthread_mutex_init(&vac->vac_mtx, &_v8plus_mutexattr);
-	if (err != 0) {
-		v8plus_panic("could not init async call mutex: %s",
-		    strerror(err));
-	}
-	err = pthread_cond_init(&vac->vac_cv, NULL);
-	if (err != 0) {
-		v8plus_panic("could not init async call condvar: %s",
+	if ((err = pthread_mutex_lock(&vobp->vob_mtx)) != 0) {
+		v8plus_panic("could not lock object registry mutex: %s",
 		    strerror(err));
 	}
-	vac->vac_flags &= ~(ACF_COMPLETED);
+}
 
-	/*
-	 * Post request to queue:
-	 */
-	err = pthread_mutex_lock(&_v8plus_callq_mtx);
-	if (err != 0) {
-		v8plus_panic("could not lock async queue mutex: %s",
-		    strerror(err));
-	}
-	STAILQ_INSERT_TAIL(&_v8plus_callq, vac, vac_callq_entry);
-	err = pthread_mutex_unlock(&_v8plus_callq_mtx);
-	if (err != 0) {
-		v8plus_panic("could not unlock async queue mutex: %s",
+static void
+v8plus_objreg_unlock(v8plus_objreg_bucket_t *vobp)
+{
+	int err;
+
+	if ((err = pthread_mutex_unlock(&vobp->vob_mtx)) != 0) {
+		v8plus_panic("could not unlock object registry mutex: %s",
 		    strerror(err));
 	}
-	uv_async_send(&_v8plus_uv_async);
+}
 
-	if (noreply) {
-		/*
-		 * The caller does not care about the reply, and has allocated
-		 * the v8plus_async_call_t structure from the heap.  The
-		 * async callback will free the storage when it completes.
-		 */
-		return (NULL);
-	}
+void
+v8plus_obj_register(const void *cop)
+{
+	v8plus_loop_t *loop = v8plus_loop_self();
+	v8plus_objreg_bucket_t *vobp;
+	v8plus_objreg_ent_t *voep;
 
-	/*
-	 * Wait for our request to be serviced on the event loop thread:
+	if (loop->vl_id == 0)
+		return;
+
+	if ((voep = malloc(sizeof (*voep))) == NULL)
+		v8plus_panic("could not allocate object registry entry");
+
+	voep->voe_cop = cop;
+	voep->voe_loop = loop;
+
+	vobp = v8plus_objreg_bucket(cop);
+	v8plus_objreg_lock(vobp);
+	LIST_INSERT_HEAD(&vobp->vob_ents, voep, voe_entry);
+	v8plus_objreg_unlock(vobp);
+}
+
+void
+v8plus_obj_unregister(const void *cop)
+{
+	v8plus_objreg_bucket_t *vobp;
+	v8plus_objreg_ent_t *voep;
+
+	if (v8plus_loop_self()->vl_id == 0)
+		return;
+
+	vobp = v8plus_objreg_bucket(cop);
+	v8plus_objreg_lock(vobp);
+	LIST_FOREACH(voep, &vobp->vob_ents, voe_entry) {
+		if (voep->voe_cop == cop) {
+			LIST_REMOVE(voep, voe_entry);
+			break;
+		}
+	}
+	v8plus_objreg_unlock(vobp);
+
+	free(voep);
+}
+
+static v8plus_loop_t *
+v8plus_obj_loop(const void *cop)
+{
+	v8plus_objreg_bucket_t *vobp;
+	v8plus_objreg_ent_t *voep;
+	v8plus_loop_t *loop = _v8plus_loops[0];
+
+	if (_v8plus_nloops == 1)
+		return (loop);
+
+	vobp = v8plus_objreg_bucket(cop);
+	v8plus_objreg_lock(vobp);
+	LIST_FOREACH(voep, &vobp->vob_ents, voe_entry) {
+		if (voep->voe_cop == cop) {
+			loop = voep->voe_loop;
+			break;
+		}
+	}
+	v8plus_objreg_unlock(vobp);
+
+	return (loop);
+}
+
+/*
+ * Holds on objects and functions may be placed and released on any thread.
+ * Each held object or function has an entry in this table counting its
+ * holds, and only the first hold and the last release involve V8: while any
+ * hold remains, an object carries a single reference and a function a single
+ * persistent handle, along with one hold on the event loop.  The first hold
+ * must therefore be placed on the event loop thread, but other threads may
+ * then add and drop holds without involving that thread at all.  A last
+ * release made on another thread is passed to the event loop thread through
+ * that thread's release buffer, so the V8 references themselves are dropped
+ * in batches.
+ */
+#define	V8PLUS_HOLD_BUCKETS	64
+
+typedef enum v8plus_hold_type {
+	VHT_OBJECT,
+	VHT_JSFUNC
+} v8plus_hold_type_t;
+
+typedef struct v8plus_hold_ent {
+	v8plus_hold_type_t vhe_type;
+	uint64_t vhe_key;
+	uint_t vhe_refs;
+	boolean_t vhe_persist;
+	boolean_t vhe_dead;
+	LIST_ENTRY(v8plus_hold_ent) vhe_entry;
+} v8plus_hold_ent_t;
+
+typedef struct v8plus_hold_bucket {
+	pthread_mutex_t vhb_mtx;
+	LIST_HEAD(, v8plus_hold_ent) vhb_ents;
+} v8plus_hold_bucket_t;
+
+static v8plus_hold_bucket_t _v8plus_holds[V8PLUS_HOLD_BUCKETS];
+
+/*
+ * Looks up the entry for the given object or function with its bucket
+ * locked, returning the bucket in *vhbpp for v8plus_hold_unlock().
+ */
+static v8plus_hold_ent_t *
+v8plus_hold_lock(v8plus_hold_type_t type, uint64_t key,
+    v8plus_hold_bucket_t **vhbpp)
+{
+	v8plus_hold_bucket_t *vhbp;
+	v8plus_hold_ent_t *vhep;
+	int err;
+
+	vhbp = &_v8plus_holds[v8plus_key_hash(key, V8PLUS_HOLD_BUCKETS)];
+	if ((err = pthread_mutex_lock(&vhbp->vhb_mtx)) != 0) {
+		v8plus_panic("could not lock hold table mutex: %s",
+		    strerror(err));
+	}
+
+	LIST_FOREACH(vhep, &vhbp->vhb_ents, vhe_entry) {
+		if (vhep->vhe_key == key && vhep->vhe_type == type)
+			break;
+	}
+
+	*vhbpp = vhbp;
+
+	return (vhep);
+}
+
+static void
+v8plus_hold_unlock(v8plus_hold_bucket_t *vhbp)
+{
+	int err;
+
+	if ((err = pthread_mutex_unlock(&vhbp->vhb_mtx)) != 0) {
+		v8plus_panic("could not unlock hold table mutex: %s",
+		    strerror(err));
+	}
+}
+
+static v8plus_hold_ent_t *
+v8plus_hold_create(v8plus_hold_bucket_t *vhbp, v8plus_hold_type_t type,
+    uint64_t key)
+{
+	v8plus_hold_ent_t *vhep;
+
+	if ((vhep = calloc(1, sizeof (*vhep))) == NULL)
+		v8plus_panic("could not allocate hold table entry");
+
+	vhep->vhe_type = type;
+	vhep->vhe_key = key;
+	LIST_INSERT_HEAD(&vhbp->vhb_ents, vhep, vhe_entry);
+
+	return (vhep);
+}
+
+/*
+ * Drops a hold, returning B_TRUE if it was the last and the object or
+ * function must now be released.  Holds on those belonging to a loop that
+ * has exited are simply counted down until the entry can be freed.
+ */
+static boolean_t
+v8plus_hold_drop(v8plus_hold_type_t type, uint64_t key)
+{
+	v8plus_hold_bucket_t *vhbp;
+	v8plus_hold_ent_t *vhep;
+	boolean_t last = B_FALSE;
+
+	vhep = v8plus_hold_lock(type, key, &vhbp);
+	if (vhep == NULL || vhep->vhe_refs == 0) {
+		v8plus_panic("releasing unheld %s %llx",
+		    type == VHT_OBJECT ? "object" : "callback hash tag",
+		    (unsigned long long)key);
+	}
+
+	if (--vhep->vhe_refs == 0) {
+		last = vhep->vhe_dead ? B_FALSE : B_TRUE;
+		LIST_REMOVE(vhep, vhe_entry);
+		free(vhep);
+	}
+	v8plus_hold_unlock(vhbp);
+
+	return (last);
+}
+
+static void
+v8plus_waiter_destroy(void *arg)
+{
+	v8plus_waiter_t *vwp = arg;
+	int err;
+
+	/*
+	 * The event loop thread may still be on its way out of the critical
+	 * section in which it woke us for our last call.
 	 */
-	err = pthread_mutex_lock(&vac->vac_mtx);
+	err = pthread_mutex_lock(&vwp->vw_mtx);
 	if (err != 0) {
-		v8plus_panic("could not lock async call mutex: %s",
+		v8plus_panic("could not lock waiter mutex: %s",
 		    strerror(err));
 	}
-	while (!(vac->vac_flags & ACF_COMPLETED)) {
-		err = pthread_cond_wait(&vac->vac_cv, &vac->vac_mtx);
+	err = pthread_mutex_unlock(&vwp->vw_mtx);
+	if (err != 0) {
+		v8plus_panic("could not unlock waiter mutex: %s",
+		    strerror(err));
+	}
+
+	err = pthread_cond_destroy(&vwp->vw_cv);
+	if (err != 0) {
+		v8plus_panic("could not destroy waiter condvar: %s",
+		    strerror(err));
+	}
+	err = pthread_mutex_destroy(&vwp->vw_mtx);
+	if (err != 0) {
+		v8plus_panic("could not destroy waiter mutex: %s",
+		    strerror(err));
+	}
+	free(vwp);
+}
+
+static void
+v8plus_waiter_key_init(void)
+{
+	int err;
+
+	err = pthread_key_create(&_v8plus_waiter_key, v8plus_waiter_destroy);
+	if (err != 0) {
+		v8plus_panic("could not create waiter key: %s",
+		    strerror(err));
+	}
+}
+
+static v8plus_waiter_t *
+v8plus_waiter(void)
+{
+	v8plus_waiter_t *vwp;
+	int err;
+
+	if ((vwp = _v8plus_waiter) != NULL)
+		return (vwp);
+
+	(void) pthread_once(&_v8plus_waiter_once, v8plus_waiter_key_init);
+
+	if ((vwp = calloc(1, sizeof (v8plus_waiter_t))) == NULL)
+		v8plus_panic("could not allocate waiter");
+
+	/*
+	 * This mutex is only ever held for a few instructions, always in
+	 * the same two places, so it does not need error checking.
+	 */
+	err = pthread_mutex_init(&vwp->vw_mtx, NULL);
+	if (err != 0) {
+		v8plus_panic("could not init waiter mutex: %s",
+		    strerror(err));
+	}
+	err = pthread_cond_init(&vwp->vw_cv, NULL);
+	if (err != 0) {
+		v8plus_panic("could not init waiter condvar: %s",
+		    strerror(err));
+	}
+	err = pthread_setspecific(_v8plus_waiter_key, vwp);
+	if (err != 0) {
+		v8plus_panic("could not set waiter key: %s",
+		    strerror(err));
+	}
+
+	_v8plus_waiter = vwp;
+
+	return (vwp);
+}
+
+/*
+ * Wait for the event loop thread to complete a synchronous call.
+ */
+static void
+v8plus_waiter_wait(v8plus_async_call_t *vac)
+{
+	v8plus_waiter_t *vwp = vac->vac_waiter;
+	uint_t spin;
+	int err;
+
+	for (spin = 0; spin < V8PLUS_WAITER_SPIN; spin++) {
+		if (vac->vac_done)
+			goto done;
+		V8PLUS_SPIN_PAUSE();
+	}
+
+	err = pthread_mutex_lock(&vwp->vw_mtx);
+	if (err != 0) {
+		v8plus_panic("could not lock waiter mutex: %s",
+		    strerror(err));
+	}
+	vwp->vw_parked = B_TRUE;
+	while (!vac->vac_done) {
+		err = pthread_cond_wait(&vwp->vw_cv, &vwp->vw_mtx);
 		if (err != 0) {
-			v8plus_panic("could not wait on async call condvar: %s",
+			v8plus_panic("could not wait on waiter condvar: %s",
 			    strerror(err));
 		}
 	}
-	err = pthread_mutex_unlock(&vac->vac_mtx);
+	vwp->vw_parked = B_FALSE;
+	err = pthread_mutex_unlock(&vwp->vw_mtx);
 	if (err != 0) {
-		v8plus_panic("could not unlock async call mutex: %s",
+		v8plus_panic("could not unlock waiter mutex: %s",
 		    strerror(err));
 	}
 
-	err = pthread_cond_destroy(&vac->vac_cv);
+done:
+	/*
+	 * Make sure we see the result stored before vac_done was set.
+	 */
+	membar_consumer();
+}
+
+/*
+ * Wake the thread waiting for a synchronous call.  We must not touch the call
+ * structure after setting vac_done, as the caller may already have returned.
+ */
+static void
+v8plus_waiter_wake(v8plus_async_call_t *vac)
+{
+	v8plus_waiter_t *vwp = vac->vac_waiter;
+	int err;
+
+	membar_producer();
+
+	err = pthread_mutex_lock(&vwp->vw_mtx);
 	if (err != 0) {
-		v8plus_panic("could not destroy async call condvar: %s",
+		v8plus_panic("could not lock waiter mutex: %s",
 		    strerror(err));
 	}
-	err = pthread_mutex_destroy(&vac->vac_mtx);
+	vac->vac_done = 1;
+	if (vwp->vw_parked) {
+		err = pthread_cond_signal(&vwp->vw_cv);
+		if (err != 0) {
+			v8plus_panic("could not signal waiter condvar: %s",
+			    strerror(err));
+		}
+	}
+	err = pthread_mutex_unlock(&vwp->vw_mtx);
 	if (err != 0) {
-		v8plus_panic("could not destroy async call mutex: %s",
+		v8plus_panic("could not unlock waiter mutex: %s",
+		    strerror(err));
+	}
+}
+
+static boolean_t
+v8plus_async_call_is_release(const v8plus_async_call_t *vac)
+{
+	switch (vac->vac_type) {
+	case ACT_OBJECT_RELEASE:
+	case ACT_JSFUNC_RELEASE:
+	case ACT_EVENTLOOP_RELEASE:
+		return (B_TRUE);
+	default:
+		return (B_FALSE);
+	}
+}
+
+/*
+ * Push a chain of calls onto a lane's lock-free queue from any thread.  The
+ * calls must all be for the same loop.  The chain is linked through vac_next
+ * from the newest call to the oldest, which is the order the queue itself is
+ * in, so it can be spliced in with a single compare-and-swap.  Releases go
+ * to the high lane; everything else goes to the lane chosen by the calling
+ * thread with v8plus_call_lane().  Only the
+ * producer that finds the lane empty needs to wake the event loop; any other
+ * producer is guaranteed that a wakeup is already pending for the entries
+ * ahead of its own, and uv_async_send() would coalesce the extra one anyway.
+ * Returns B_FALSE, having queued nothing, if the loop has exited.
+ */
+static boolean_t
+v8plus_callq_splice(v8plus_async_call_t *oldest, v8plus_async_call_t *newest)
+{
+	v8plus_callq_t *cqp;
+	v8plus_async_call_t *head;
+	v8plus_async_call_t *vac;
+	v8plus_lane_t lane;
+	uint64_t seq;
+	uint64_t now;
+
+	if (!v8plus_loop_pin(oldest->vac_loop))
+		return (B_FALSE);
+
+	lane = v8plus_async_call_is_release(oldest) ?
+	    V8PLUS_LANE_HIGH : _v8plus_call_lane;
+	cqp = &oldest->vac_loop->vl_callqs[lane];
+
+	seq = atomic_inc_64_nv(&_v8plus_callq_seq);
+	now = _v8plus_call_timing ? uv_hrtime() : 0;
+	for (vac = newest; ; vac = vac->vac_next) {
+		vac->vac_lane = lane;
+		vac->vac_seq = seq;
+		vac->vac_enqueued = now;
+		if (vac == oldest)
+			break;
+	}
+
+	/*
+	 * Make sure our initialisation of the call structures is visible
+	 * before the structures themselves are.
+	 */
+	membar_producer();
+
+	do {
+		head = cqp->vcq_head;
+		oldest->vac_next = head;
+	} while (atomic_cas_ptr(&cqp->vcq_head, head, newest) != head);
+
+	if (head == NULL)
+		uv_async_send(&oldest->vac_loop->vl_async);
+	v8plus_loop_unpin(oldest->vac_loop);
+
+	return (B_TRUE);
+}
+
+static void
+v8plus_callq_room_broadcast(void)
+{
+	int err;
+
+	if ((err = pthread_mutex_lock(&_v8plus_callq_room_mtx)) != 0)
+		v8plus_panic("could not lock queue mutex: %s", strerror(err));
+	if ((err = pthread_cond_broadcast(&_v8plus_callq_room_cv)) != 0) {
+		v8plus_panic("could not broadcast queue condvar: %s",
 		    strerror(err));
 	}
+	if ((err = pthread_mutex_unlock(&_v8plus_callq_room_mtx)) != 0)
+		v8plus_panic("could not unlock queue mutex: %s", strerror(err));
+}
+
+/*
+ * Try to reserve room on the queue for n calls, returning B_FALSE if that
+ * would take it above the limit.  A submission larger than the limit is
+ * admitted when the queue is empty, so that it cannot be refused forever.
+ */
+static boolean_t
+v8plus_callq_reserve(uint_t n, boolean_t force)
+{
+	uint_t depth, hiwat, max;
+
+	do {
+		depth = _v8plus_callq_depth;
+		hiwat = _v8plus_callq_hiwat;
+		if (!force && hiwat != 0 && depth != 0 && depth + n > hiwat)
+			return (B_FALSE);
+	} while (atomic_cas_uint(&_v8plus_callq_depth, depth, depth + n) !=
+	    depth);
+
+	while ((max = _v8plus_queue_stats.vqs_max_depth) < depth + n) {
+		if (atomic_cas_uint(&_v8plus_queue_stats.vqs_max_depth, max,
+		    depth + n) == max)
+			break;
+	}
+
+	return (B_TRUE);
+}
+
+/*
+ * Give back room taken by v8plus_callq_reserve(), either because the calls
+ * have been taken off the queue to be run or because they were never queued
+ * at all, and wake any producers waiting for room.
+ */
+static void
+v8plus_callq_unreserve(uint_t n)
+{
+	atomic_add_int(&_v8plus_callq_depth, -(int)n);
+	membar_enter();
+
+	if (_v8plus_callq_waiters != 0)
+		v8plus_callq_room_broadcast();
+}
+
+/*
+ * Admit n calls about to be queued.  If the queue is at its limit, the
+ * calling thread's policy determines what happens: we wait for room, fail
+ * with EAGAIN, or, if the caller does not want the results and so can
+ * afford to lose the calls, tell it to drop them.  Returns 0 if the calls
+ * may be queued, 1 if they are to be dropped, or -1 with an exception
+ * pending.  The event loop thread cannot wait for itself to make room, so
+ * it is always admitted.
+ */
+static int
+v8plus_callq_admit(uint_t n, boolean_t droppable)
+{
+	boolean_t force = v8plus_in_event_thread();
+	int err;
+
+	if (v8plus_callq_reserve(n, force))
+		return (0);
+
+	switch (_v8plus_queue_policy) {
+	case V8PLUS_QUEUE_DROP:
+		if (droppable) {
+			atomic_add_64(&_v8plus_queue_stats.vqs_dropped, n);
+			return (1);
+		}
+		/*FALLTHROUGH*/
+	case V8PLUS_QUEUE_FAIL:
+		atomic_inc_64(&_v8plus_queue_stats.vqs_rejected);
+		(void) v8plus_syserr(EAGAIN, "cross-thread call queue is full");
+		return (-1);
+	case V8PLUS_QUEUE_BLOCK:
+	default:
+		break;
+	}
+
+	atomic_inc_64(&_v8plus_queue_stats.vqs_blocked);
+
+	if ((err = pthread_mutex_lock(&_v8plus_callq_room_mtx)) != 0)
+		v8plus_panic("could not lock queue mutex: %s", strerror(err));
+
+	/*
+	 * We must announce ourselves before checking again for room, so
+	 * that a consumer making room after our check is sure to see us and
+	 * wake us; it cannot do so until we are waiting, as it needs the
+	 * mutex we hold.
+	 */
+	atomic_inc_uint(&_v8plus_callq_waiters);
+	membar_enter();
+
+	while (!v8plus_callq_reserve(n, B_FALSE)) {
+		err = pthread_cond_wait(&_v8plus_callq_room_cv,
+		    &_v8plus_callq_room_mtx);
+		if (err != 0) {
+			v8plus_panic("could not wait on queue condvar: %s",
+			    strerror(err));
+		}
+	}
+
+	atomic_dec_uint(&_v8plus_callq_waiters);
+
+	if ((err = pthread_mutex_unlock(&_v8plus_callq_room_mtx)) != 0)
+		v8plus_panic("could not unlock queue mutex: %s", strerror(err));
+
+	return (0);
+}
+
+void
+v8plus_queue_limit(uint_t hiwat)
+{
+	_v8plus_callq_hiwat = hiwat;
+	membar_enter();
+
+	/*
+	 * Raising or removing the limit may have made room for producers
+	 * already waiting.
+	 */
+	if (_v8plus_callq_waiters != 0)
+		v8plus_callq_room_broadcast();
+}
+
+v8plus_queue_policy_t
+v8plus_queue_policy(v8plus_queue_policy_t policy)
+{
+	v8plus_queue_policy_t old = _v8plus_queue_policy;
+
+	switch (policy) {
+	case V8PLUS_QUEUE_BLOCK:
+	case V8PLUS_QUEUE_FAIL:
+	case V8PLUS_QUEUE_DROP:
+		break;
+	default:
+		v8plus_panic("invalid queue policy %d", policy);
+	}
+
+	_v8plus_queue_policy = policy;
+
+	return (old);
+}
+
+void
+v8plus_queue_stats(v8plus_queue_stats_t *sp)
+{
+	membar_consumer();
+	sp->vqs_depth = _v8plus_callq_depth;
+	sp->vqs_max_depth = _v8plus_queue_stats.vqs_max_depth;
+	sp->vqs_limit = _v8plus_callq_hiwat;
+	sp->vqs_blocked = _v8plus_queue_stats.vqs_blocked;
+	sp->vqs_rejected = _v8plus_queue_stats.vqs_rejected;
+	sp->vqs_dropped = _v8plus_queue_stats.vqs_dropped;
+}
+
+/*
+ * Move everything posted to a lane by producers since the last call onto the
+ * tail of the lane's private run queue, restoring FIFO order.  Returns
+ * B_FALSE if there was nothing to take.
+ */
+static boolean_t
+v8plus_callq_take(v8plus_callq_t *cqp)
+{
+	struct v8plus_callq_head taken = STAILQ_HEAD_INITIALIZER(taken);
+	v8plus_async_call_t *vac;
+	v8plus_async_call_t *next;
+
+	if (cqp->vcq_head == NULL)
+		return (B_FALSE);
+
+	vac = atomic_swap_ptr(&cqp->vcq_head, NULL);
+	if (vac == NULL)
+		return (B_FALSE);
+
+	membar_consumer();
+
+	for (; vac != NULL; vac = next) {
+		next = vac->vac_next;
+		vac->vac_next = NULL;
+		STAILQ_INSERT_HEAD(&taken, vac, vac_callq_entry);
+	}
+	STAILQ_CONCAT(&cqp->vcq_runq, &taken);
+
+	return (B_TRUE);
+}
+
+static boolean_t
+v8plus_callq_idle(v8plus_loop_t *loop)
+{
+	uint_t i;
+
+	if (!STAILQ_EMPTY(&loop->vl_release_deferq))
+		return (B_FALSE);
+
+	for (i = 0; i < V8PLUS_LANE_COUNT; i++) {
+		if (!STAILQ_EMPTY(&loop->vl_callqs[i].vcq_runq) ||
+		    loop->vl_callqs[i].vcq_head != NULL)
+			return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+/*
+ * A release may run only once every call posted before it, in any lane, has
+ * run; otherwise a thread that posts a method call and then drops its hold
+ * on the object could find the object gone before the call is made.  Any
+ * such call was on its lane's queue before the release was made, so once
+ * we have taken each lane, it must be at or behind the head of a run queue,
+ * and it is enough to look at the heads.  This returns the lowest sequence
+ * number found there in any lane other than skip, or UINT64_MAX if there
+ * are no calls waiting in those lanes.
+ */
+static uint64_t
+v8plus_callq_oldest(v8plus_loop_t *loop, uint_t skip)
+{
+	v8plus_async_call_t *first;
+	uint64_t oldest = UINT64_MAX;
+	uint_t i;
+
+	for (i = 0; i < V8PLUS_LANE_COUNT; i++) {
+		if (i == skip)
+			continue;
+		(void) v8plus_callq_take(&loop->vl_callqs[i]);
+		first = STAILQ_FIRST(&loop->vl_callqs[i].vcq_runq);
+		if (first != NULL && first->vac_seq < oldest)
+			oldest = first->vac_seq;
+	}
+
+	return (oldest);
+}
+
+static boolean_t
+v8plus_release_ready(const v8plus_async_call_t *vac)
+{
+	return (v8plus_callq_oldest(vac->vac_loop, vac->vac_lane) >=
+	    vac->vac_seq ? B_TRUE : B_FALSE);
+}
+
+/*
+ * Choose the next call to run.  Lanes are drained by weighted round robin:
+ * each lane in turn may run up to its weight in calls before we move on, so a
+ * busy lower lane is slowed but never starved by a higher one.  Releases
+ * parked behind earlier calls are run as soon as those calls have been.
+ */
+static v8plus_async_call_t *
+v8plus_callq_next(v8plus_loop_t *loop)
+{
+	v8plus_callq_t *cqp;
+	v8plus_async_call_t *vac;
+	uint_t tries;
+
+	vac = STAILQ_FIRST(&loop->vl_release_deferq);
+	if (vac != NULL && v8plus_release_ready(vac)) {
+		STAILQ_REMOVE_HEAD(&loop->vl_release_deferq, vac_callq_entry);
+		return (vac);
+	}
+
+	for (tries = 0; tries <= 2 * V8PLUS_LANE_COUNT; ) {
+		cqp = &loop->vl_callqs[loop->vl_drain_lane];
+
+		if (loop->vl_drain_credit == 0 ||
+		    (STAILQ_EMPTY(&cqp->vcq_runq) && !v8plus_callq_take(cqp))) {
+			loop->vl_drain_lane =
+			    (loop->vl_drain_lane + 1) % V8PLUS_LANE_COUNT;
+			loop->vl_drain_credit =
+			    loop->vl_lane_weights[loop->vl_drain_lane];
+			tries++;
+			continue;
+		}
+
+		vac = STAILQ_FIRST(&cqp->vcq_runq);
+		STAILQ_REMOVE_HEAD(&cqp->vcq_runq, vac_callq_entry);
+		loop->vl_drain_credit--;
+
+		/*
+		 * Releases are not subject to the queue limit, as a producer
+		 * must always be able to give up its holds.
+		 */
+		if (!v8plus_async_call_is_release(vac)) {
+			v8plus_callq_unreserve(1);
+			return (vac);
+		}
+
+		if (!STAILQ_EMPTY(&loop->vl_release_deferq) ||
+		    !v8plus_release_ready(vac)) {
+			STAILQ_INSERT_TAIL(&loop->vl_release_deferq, vac,
+			    vac_callq_entry);
+			continue;
+		}
+
+		return (vac);
+	}
+
+	return (NULL);
+}
+
+boolean_t
+v8plus_dense_arrays(boolean_t dense)
+{
+	boolean_t old = _v8plus_dense_arrays;
+
+	_v8plus_dense_arrays = dense;
+
+	return (old);
+}
+
+boolean_t
+v8plus_dense_arrays_enabled(void)
+{
+	return (_v8plus_dense_arrays);
+}
+
+boolean_t
+v8plus_await_promises(boolean_t await)
+{
+	boolean_t old = _v8plus_await_promises;
+
+	_v8plus_await_promises = await;
+
+	return (old);
+}
+
+v8plus_lane_t
+v8plus_call_lane(v8plus_lane_t lane)
+{
+	v8plus_lane_t old = _v8plus_call_lane;
+
+	if (lane >= V8PLUS_LANE_COUNT)
+		v8plus_panic("invalid call lane %d", lane);
+
+	_v8plus_call_lane = lane;
+
+	return (old);
+}
+
+int
+v8plus_lane_weight(v8plus_lane_t lane, uint_t weight)
+{
+	v8plus_loop_t *loop = v8plus_loop_self();
+
+	if (lane >= V8PLUS_LANE_COUNT) {
+		(void) v8plus_error(V8PLUSERR_BADARG,
+		    "invalid call lane %d", lane);
+		return (-1);
+	}
+
+	if (weight == 0) {
+		(void) v8plus_error(V8PLUSERR_BADARG,
+		    "lane weights must be nonzero");
+		return (-1);
+	}
+
+	loop->vl_lane_weights[lane] = weight;
+
+	return (0);
+}
+
+static v8plus_post_error_f _v8plus_post_error_handler;
+static void *_v8plus_post_error_arg;
+
+void
+v8plus_post_error_handler(v8plus_post_error_f handler, void *arg)
+{
+	_v8plus_post_error_handler = handler;
+	_v8plus_post_error_arg = arg;
+}
+
+static void
+v8plus_post_error(const nvlist_t *excp)
+{
+	if (_v8plus_post_error_handler != NULL)
+		_v8plus_post_error_handler(excp, _v8plus_post_error_arg);
+}
+
+static v8plus_coalesce_bucket_t *
+v8plus_coalesce_bucket(const v8plus_async_call_t *vac)
+{
+	uint64_t h;
+
+	if (vac->vac_type == ACT_OBJECT_CALL)
+		h = (uint64_t)(uintptr_t)vac->vac_cop >> 4;
+	else
+		h = vac->vac_func * 31 + vac->vac_key;
+
+	return (&_v8plus_coalesce[v8plus_key_hash(h,
+	    V8PLUS_COALESCE_BUCKETS)]);
+}
+
+static boolean_t
+v8plus_coalesce_match(const v8plus_async_call_t *a,
+    const v8plus_async_call_t *b)
+{
+	if (a->vac_type != b->vac_type)
+		return (B_FALSE);
+
+	if (a->vac_type == ACT_OBJECT_CALL) {
+		return (a->vac_cop == b->vac_cop &&
+		    strcmp(a->vac_name, b->vac_name) == 0);
+	}
+
+	return (a->vac_func == b->vac_func && a->vac_key == b->vac_key);
+}
+
+static void
+v8plus_coalesce_lock(v8plus_coalesce_bucket_t *vcbp)
+{
+	int err;
+
+	if ((err = pthread_mutex_lock(&vcbp->vcb_mtx)) != 0) {
+		v8plus_panic("could not lock coalesce mutex: %s",
+		    strerror(err));
+	}
+}
+
+static void
+v8plus_coalesce_unlock(v8plus_coalesce_bucket_t *vcbp)
+{
+	int err;
+
+	if ((err = pthread_mutex_unlock(&vcbp->vcb_mtx)) != 0) {
+		v8plus_panic("could not unlock coalesce mutex: %s",
+		    strerror(err));
+	}
+}
+
+/*
+ * Called on the event loop thread just before a coalesced post is run.  Once
+ * the call is out of the table, no producer can replace its arguments, and
+ * any further update is queued afresh.
+ */
+static void
+v8plus_coalesce_claim(v8plus_async_call_t *vac)
+{
+	v8plus_coalesce_bucket_t *vcbp = v8plus_coalesce_bucket(vac);
+
+	v8plus_coalesce_lock(vcbp);
+	LIST_REMOVE(vac, vac_coalesce_entry);
+	v8plus_coalesce_unlock(vcbp);
+}
+
+static void
+v8plus_future_then_worker(uv_work_t *wp)
+{
+	v8plus_async_call_t *vac = wp->data;
+
+	vac->vac_then(vac, vac->vac_then_arg);
+	v8plus_future_free(vac);
+}
+
+static void
+#if NODE_VERSION_AT_LEAST(0, 9, 4)
+v8plus_future_then_completion(uv_work_t *wp, int ignored __UNUSED)
+#else
+v8plus_future_then_completion(uv_work_t *wp)
+#endif
+{
+	free(wp);
+}
+
+/*
+ * Run the continuation attached to a future on one of the threads in the
+ * libuv worker pool.  The future is freed when the continuation returns.
+ * A future abandoned by another thread after its loop has exited has no
+ * pool to go to, so its continuation is run there and then.
+ */
+static void
+v8plus_future_dispatch(v8plus_async_call_t *vac)
+{
+	uv_work_t *wp;
+
+	if (vac->vac_loop != _v8plus_loop) {
+		vac->vac_then(vac, vac->vac_then_arg);
+		v8plus_future_free(vac);
+		return;
+	}
+
+	if ((wp = calloc(1, sizeof (uv_work_t))) == NULL)
+		v8plus_panic("could not allocate future continuation");
+
+	wp->data = vac;
+	uv_queue_work(vac->vac_loop->vl_uv, wp, v8plus_future_then_worker,
+	    v8plus_future_then_completion);
+}
+
+static void
+v8plus_future_destroy(v8plus_async_call_t *vac)
+{
+	int err;
+
+	err = pthread_cond_destroy(&vac->vac_cv);
+	if (err != 0) {
+		v8plus_panic("could not destroy async call condvar: %s",
+		    strerror(err));
+	}
+	err = pthread_mutex_destroy(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not destroy async call mutex: %s",
+		    strerror(err));
+	}
+
+	if (vac->vac_flags & ACF_OWNARGS) {
+		nvlist_free((nvlist_t *)vac->vac_lp);
+		free((char *)vac->vac_name);
+	}
+	nvlist_free(vac->vac_return);
+	nvlist_free(vac->vac_exception);
+	free(vac);
+}
+
+/*
+ * Complete a call that has been run on the event loop thread, waking or
+ * otherwise notifying whoever is interested in the result.
+ */
+static void
+v8plus_async_call_complete(v8plus_async_call_t *vac)
+{
+	v8plus_async_batch_t *vab = vac->vac_batch;
+	v8plus_future_f then;
+	boolean_t detached;
+	int err;
+
+	if (vab != NULL) {
+		/*
+		 * Only the last call in a batch to complete needs to wake the
+		 * waiter, which collects all the results at once.
+		 */
+		err = pthread_mutex_lock(&vab->vab_mtx);
+		if (err != 0) {
+			v8plus_panic("could not lock async batch mutex: %s",
+			    strerror(err));
+		}
+		if (--vab->vab_pending == 0) {
+			err = pthread_cond_broadcast(&vab->vab_cv);
+			if (err != 0) {
+				v8plus_panic("could not signal async batch "
+				    "condvar: %s", strerror(err));
+			}
+		}
+		err = pthread_mutex_unlock(&vab->vab_mtx);
+		if (err != 0) {
+			v8plus_panic("could not unlock async batch mutex: %s",
+			    strerror(err));
+		}
+		return;
+	}
+
+	if (vac->vac_flags & ACF_NOREPLY) {
+		/*
+		 * The caller posted this event and is not sleeping
+		 * on a reply.  Just free the call structure and move
+		 * on.
+		 */
+		if (vac->vac_lp != NULL)
+			nvlist_free((nvlist_t *)vac->vac_lp);
+		nvlist_free(vac->vac_return);
+		free(vac);
+		return;
+	}
+
+	if (vac->vac_waiter != NULL) {
+		v8plus_waiter_wake(vac);
+		return;
+	}
+
+	err = pthread_mutex_lock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not lock async call mutex: %s",
+		    strerror(err));
+	}
+	vac->vac_flags |= ACF_COMPLETED;
+	then = vac->vac_then;
+	detached = (vac->vac_flags & ACF_DETACHED) ? B_TRUE : B_FALSE;
+	err = pthread_cond_broadcast(&vac->vac_cv);
+	if (err != 0) {
+		v8plus_panic("could not signal async call condvar: %s",
+		    strerror(err));
+	}
+	err = pthread_mutex_unlock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not unlock async call mutex: %s",
+		    strerror(err));
+	}
+
+	/*
+	 * Once we have dropped the lock, a synchronous caller or the owner of
+	 * a future without a continuation may free the call structure at any
+	 * time, so we must not touch it again.  Futures that have been
+	 * abandoned or handed to a continuation are ours to dispose of.
+	 */
+	if (detached)
+		v8plus_future_destroy(vac);
+	else if (then != NULL)
+		v8plus_future_dispatch(vac);
+}
+
+/*
+ * Mark a future as started, unless it has been cancelled, in which case it
+ * is not to be run at all.  Once started, it can no longer be cancelled.
+ */
+static boolean_t
+v8plus_future_start(v8plus_async_call_t *vac)
+{
+	boolean_t cancelled;
+	int err;
+
+	err = pthread_mutex_lock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not lock async call mutex: %s",
+		    strerror(err));
+	}
+	cancelled = (vac->vac_flags & ACF_CANCELLED) ? B_TRUE : B_FALSE;
+	if (!cancelled)
+		vac->vac_flags |= ACF_STARTED;
+	err = pthread_mutex_unlock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not unlock async call mutex: %s",
+		    strerror(err));
+	}
+
+	return (!cancelled);
+}
+
+/*
+ * Deal with any exception thrown by a call once it has finished.
+ */
+static void
+v8plus_async_call_finish(v8plus_async_call_t *vac)
+{
+	if (vac->vac_return != NULL || _v8plus_pending_exception == NULL)
+		return;
+
+	/*
+	 * An exception thrown by the call is pending in this (the event loop)
+	 * thread.  Whoever waits for the result, synchronously or through a
+	 * future, collects it from another thread, so it must be copied out
+	 * of our thread-specific storage; it must not be left there, where it
+	 * would appear to have been thrown by the next call we make.  Nobody
+	 * is waiting for the result of a posted call, so its exception goes
+	 * to the handler, if any.
+	 */
+	if (vac->vac_flags & ACF_NOREPLY) {
+		v8plus_post_error(_v8plus_pending_exception);
+	} else if (v8plus_args_dup(_v8plus_pending_exception,
+	    &vac->vac_exception) != 0) {
+		vac->vac_exception = NULL;
+	}
+	v8plus_clear_exception();
+}
+
+/*
+ * Make the exception thrown by a call on the event loop thread pending in
+ * the calling thread, just as if it had made the call itself.
+ */
+static void
+v8plus_async_call_rethrow(v8plus_async_call_t *vac)
+{
+	nvlist_t *lp;
+
+	if (vac->vac_exception == NULL)
+		return;
+
+	v8plus_clear_exception();
+	lp = _v8plus_alloc_exception();
+	if (nvlist_merge(lp, vac->vac_exception, 0) != 0) {
+		v8plus_panic("unable to copy exception from "
+		    "event loop thread");
+	}
+	nvlist_free(vac->vac_exception);
+	vac->vac_exception = NULL;
+}
+
+/*
+ * Called on the event loop thread when the Promise returned by an awaiting
+ * call settles, with the result or NULL and an exception pending.
+ */
+static void
+v8plus_async_call_settle(void *arg, nvlist_t *rp)
+{
+	v8plus_async_call_t *vac = arg;
+
+	vac->vac_return = rp;
+	v8plus_async_call_finish(vac);
+	v8plus_async_call_complete(vac);
+}
+
+/*
+ * Run a call on the event loop thread.  Returns B_FALSE if the call returned
+ * a Promise for which it is waiting, in which case it is completed when the
+ * Promise settles rather than by the caller.
+ */
+static boolean_t
+v8plus_async_call_run(v8plus_async_call_t *vac)
+{
+	v8plus_settle_f settle = NULL;
+	boolean_t pending = B_FALSE;
+
+	if (vac->vac_flags & ACF_COMPLETED)
+		v8plus_panic("async call already run");
+
+	if (vac->vac_flags & ACF_COALESCED)
+		v8plus_coalesce_claim(vac);
+
+	if ((vac->vac_flags & ACF_FUTURE) && !v8plus_future_start(vac))
+		return (B_TRUE);
+
+	if (vac->vac_flags & ACF_AWAIT)
+		settle = v8plus_async_call_settle;
+
+	switch (vac->vac_type) {
+	case ACT_OBJECT_CALL:
+		vac->vac_return = v8plus_method_call_direct_await(
+		    vac->vac_cop, vac->vac_name, vac->vac_lp,
+		    settle, vac, &pending);
+		break;
+	case ACT_OBJECT_RELEASE:
+		v8plus_obj_unref(vac->vac_cop);
+		break;
+	case ACT_JSFUNC_CALL:
+		/*
+		 * A call to a function that belonged to an earlier occupant of
+		 * this loop's slot may have been routed here after that loop
+		 * exited.
+		 */
+		if (v8plus_jsfunc_stale(vac->vac_loop, vac->vac_func)) {
+			(void) v8plus_syserr(ECANCELED,
+			    "function's event loop has exited");
+			break;
+		}
+		vac->vac_return = v8plus_call_direct_await(
+		    vac->vac_func, vac->vac_lp, settle, vac, &pending);
+		break;
+	case ACT_JSFUNC_RELEASE:
+		v8plus_jsfunc_unref(vac->vac_func);
+		break;
+	case ACT_EVENTLOOP_RELEASE:
+		v8plus_eventloop_unref(vac->vac_loop);
+		break;
+	}
+
+	if (pending)
+		return (B_FALSE);
+
+	v8plus_async_call_finish(vac);
+
+	return (B_TRUE);
+}
+
+/*
+ * Complete a call that its loop will never run, because the loop has exited,
+ * as if it had thrown ECANCELED.  This happens on the loop's own thread as it
+ * exits, or on the thread that tried to queue the call once it had.  Posted
+ * calls and releases are simply discarded, as nobody is waiting for them and
+ * the objects and functions they refer to are gone.
+ */
+static void
+v8plus_async_call_abandon(v8plus_async_call_t *vac)
+{
+	nvlist_t *saved;
+
+	if (!v8plus_async_call_is_release(vac))
+		v8plus_callq_unreserve(1);
+
+	if (vac->vac_flags & ACF_COALESCED)
+		v8plus_coalesce_claim(vac);
+
+	if ((vac->vac_flags & (ACF_NOREPLY | ACF_FUTURE)) == 0 ||
+	    ((vac->vac_flags & ACF_FUTURE) && v8plus_future_start(vac))) {
+		/*
+		 * The exception is built in this thread's own storage, so
+		 * anything already pending there must be kept aside.
+		 */
+		saved = _v8plus_pending_exception;
+		_v8plus_pending_exception = NULL;
+		(void) v8plus_syserr(ECANCELED,
+		    "event loop exited before the call was made");
+		v8plus_async_call_finish(vac);
+		_v8plus_pending_exception = saved;
+	}
+
+	v8plus_async_call_complete(vac);
+}
+
+/*
+ * Queue a chain of calls, linked as for v8plus_callq_splice(), or cancel them
+ * all if their loop has exited.
+ */
+static void
+v8plus_callq_submit(v8plus_async_call_t *oldest, v8plus_async_call_t *newest)
+{
+	v8plus_async_call_t *vac;
+	v8plus_async_call_t *next;
+	boolean_t last;
+
+	if (v8plus_callq_splice(oldest, newest))
+		return;
+
+	for (vac = newest; ; vac = next) {
+		next = vac->vac_next;
+		last = (vac == oldest) ? B_TRUE : B_FALSE;
+		vac->vac_next = NULL;
+		v8plus_async_call_abandon(vac);
+		if (last)
+			break;
+	}
+}
+
+static void
+v8plus_callq_enqueue(v8plus_async_call_t *vac)
+{
+	v8plus_callq_submit(vac, vac);
+}
+
+/*
+ * The drain policy determines how much of the queue we work through on each
+ * turn of the event loop before yielding to other event sources; see
+ * v8plus_drain_policy() in v8plus_glue.h.  Each loop has its own policy,
+ * touched only on that loop's thread.
+ */
+#define	V8PLUS_DRAIN_DEF_ITEMS	1000
+#define	V8PLUS_DRAIN_DEF_USEC	10000
+
+int
+v8plus_drain_policy(v8plus_drain_policy_t policy, uint_t max_items,
+    uint_t max_usec)
+{
+	v8plus_loop_t *loop = v8plus_loop_self();
+
+	switch (policy) {
+	case V8PLUS_DRAIN_ITEMS:
+	case V8PLUS_DRAIN_TIME:
+	case V8PLUS_DRAIN_ADAPTIVE:
+		break;
+	default:
+		(void) v8plus_error(V8PLUSERR_BADARG,
+		    "invalid drain policy %d", policy);
+		return (-1);
+	}
+
+	if (max_items == 0 || max_usec == 0) {
+		(void) v8plus_error(V8PLUSERR_BADARG,
+		    "drain budgets must be nonzero");
+		return (-1);
+	}
+
+	loop->vl_drain_policy = policy;
+	loop->vl_drain_max_items = max_items;
+	loop->vl_drain_max_ns = max_usec * 1000ULL;
+	loop->vl_drain_adaptive_items = max_items;
+	loop->vl_drain_item_ns = 0;
+
+	return (0);
+}
+
+void
+v8plus_drain_stats(v8plus_drain_stats_t *sp)
+{
+	bcopy(&v8plus_loop_self()->vl_drain_stats, sp,
+	    sizeof (v8plus_drain_stats_t));
+}
+
+/*
+ * Account for a turn of the drain loop.  In adaptive mode, this is where we
+ * learn how expensive calls have recently been, and size the next turn's
+ * item budget so that it should fit within the time budget without our
+ * having to consult the clock after every call.
+ */
+static void
+v8plus_drain_account(v8plus_loop_t *loop, uint_t processed, uint64_t elapsed)
+{
+	v8plus_drain_stats_t *sp = &loop->vl_drain_stats;
+	uint64_t budget;
+
+	sp->vds_turns++;
+	sp->vds_items += processed;
+	if (elapsed > sp->vds_max_turn_ns)
+		sp->vds_max_turn_ns = elapsed;
+
+	if (loop->vl_drain_policy != V8PLUS_DRAIN_ADAPTIVE || processed == 0)
+		return;
+
+	if (loop->vl_drain_item_ns == 0) {
+		loop->vl_drain_item_ns = elapsed / processed;
+	} else {
+		loop->vl_drain_item_ns =
+		    (7 * loop->vl_drain_item_ns + elapsed / processed) / 8;
+	}
+
+	if (loop->vl_drain_item_ns == 0)
+		budget = loop->vl_drain_max_items;
+	else
+		budget = loop->vl_drain_max_ns / loop->vl_drain_item_ns;
+
+	if (budget < 1)
+		budget = 1;
+	if (budget > loop->vl_drain_max_items)
+		budget = loop->vl_drain_max_items;
+
+	loop->vl_drain_adaptive_items = (uint_t)budget;
+}
+
+static uint_t
+v8plus_hist_bucket(uint64_t v)
+{
+	uint_t msb;
+
+	if (v < V8PLUS_HIST_SUB)
+		return ((uint_t)v);
+
+	msb = 63 - __builtin_clzll(v);
+
+	return (((msb - V8PLUS_HIST_SUBBITS + 1) << V8PLUS_HIST_SUBBITS) |
+	    ((v >> (msb - V8PLUS_HIST_SUBBITS)) & (V8PLUS_HIST_SUB - 1)));
+}
+
+/*
+ * The smallest value recorded in the given bucket.
+ */
+static uint64_t
+v8plus_hist_value(uint_t b)
+{
+	uint_t e = b >> V8PLUS_HIST_SUBBITS;
+
+	if (e == 0)
+		return (b);
+
+	return ((uint64_t)(V8PLUS_HIST_SUB | (b & (V8PLUS_HIST_SUB - 1))) <<
+	    (e - 1));
+}
+
+static void
+v8plus_hist_record(v8plus_hist_t *hp, uint64_t v)
+{
+	hp->vh_buckets[v8plus_hist_bucket(v)]++;
+	hp->vh_total += v;
+	if (v > hp->vh_max)
+		hp->vh_max = v;
+}
+
+/*
+ * Returns the value at or below which the given fraction, in thousandths, of
+ * all recorded values fall, reporting the top of the bucket in which it was
+ * found.
+ */
+static uint64_t
+v8plus_hist_quantile(const v8plus_hist_t *hp, uint64_t count, uint_t permille)
+{
+	uint64_t want, seen = 0;
+	uint64_t v;
+	uint_t b;
+
+	if (count == 0)
+		return (0);
+
+	want = (count * permille + 999) / 1000;
+
+	for (b = 0; b < V8PLUS_HIST_BUCKETS; b++) {
+		seen += hp->vh_buckets[b];
+		if (seen >= want)
+			break;
+	}
+
+	v = (b + 1 < V8PLUS_HIST_BUCKETS) ?
+	    v8plus_hist_value(b + 1) - 1 : hp->vh_max;
+
+	return (v < hp->vh_max ? v : hp->vh_max);
+}
+
+static void
+v8plus_hist_summarise(const v8plus_hist_t *hp, uint64_t count,
+    v8plus_latency_t *lp)
+{
+	lp->vl_total_ns = hp->vh_total;
+	lp->vl_max_ns = hp->vh_max;
+	lp->vl_p50_ns = v8plus_hist_quantile(hp, count, 500);
+	lp->vl_p90_ns = v8plus_hist_quantile(hp, count, 900);
+	lp->vl_p99_ns = v8plus_hist_quantile(hp, count, 990);
+	lp->vl_p999_ns = v8plus_hist_quantile(hp, count, 999);
+}
+
+void
+v8plus_call_timing(boolean_t enable)
+{
+	_v8plus_call_timing = enable;
+}
+
+int
+v8plus_call_stats(v8plus_call_kind_t kind, v8plus_call_stats_t *sp)
+{
+	const v8plus_call_kind_stats_t *ksp;
+
+	if (kind >= V8PLUS_CALL_KINDS) {
+		(void) v8plus_error(V8PLUSERR_BADARG,
+		    "invalid call kind %d", kind);
+		return (-1);
+	}
+
+	ksp = &v8plus_loop_self()->vl_call_kind_stats[kind];
+	sp->vcs_count = ksp->vcks_count;
+	v8plus_hist_summarise(&ksp->vcks_wait, ksp->vcks_count, &sp->vcs_wait);
+	v8plus_hist_summarise(&ksp->vcks_exec, ksp->vcks_count, &sp->vcs_exec);
+
+	return (0);
+}
+
+void
+v8plus_call_stats_reset(void)
+{
+	v8plus_loop_t *loop = v8plus_loop_self();
+
+	bzero(loop->vl_call_kind_stats, sizeof (loop->vl_call_kind_stats));
+}
+
+/*
+ * Releases made by threads other than the event loop thread are collected in
+ * per-thread buffers, one for each loop to which the thread has released
+ * holds, rather than each being allocated and queued as a call of its own.
+ * The first release into an empty buffer makes sure that the loop will wake,
+ * and the loop empties every buffer whenever it wakes.  Each release records
+ * the last sequence number handed out to a queued call when it was made, and
+ * it is held back by the event loop thread until every call up to that one
+ * has run; see v8plus_callq_oldest().  A thread whose buffer fills because
+ * the loop is falling behind queues its releases as calls instead.  A
+ * thread's buffers are freed by the loop after the thread exits.
+ */
+#define	V8PLUS_RELBUF_SIZE	256
+
+typedef struct v8plus_release {
+	v8plus_async_call_type_t vr_type;
+	uint64_t vr_seq;
+	uint64_t vr_enqueued;
+	const void *vr_cop;
+	v8plus_jsfunc_t vr_func;
+} v8plus_release_t;
+
+typedef struct v8plus_relbuf {
+	pthread_mutex_t vrb_mtx;
+	v8plus_loop_t *vrb_loop;
+	uint_t vrb_count;
+	boolean_t vrb_orphaned;
+	LIST_ENTRY(v8plus_relbuf) vrb_loop_entry;
+	struct v8plus_relbuf *vrb_thread_next;
+	v8plus_release_t vrb_rels[V8PLUS_RELBUF_SIZE];
+} v8plus_relbuf_t;
+
+static pthread_key_t _v8plus_relbuf_key;
+static pthread_once_t _v8plus_relbuf_once = PTHREAD_ONCE_INIT;
+static __thread v8plus_relbuf_t *_v8plus_relbufs;
+
+static void
+v8plus_release_lock(pthread_mutex_t *mtxp)
+{
+	int err;
+
+	if ((err = pthread_mutex_lock(mtxp)) != 0) {
+		v8plus_panic("could not lock release buffer mutex: %s",
+		    strerror(err));
+	}
+}
+
+static void
+v8plus_release_unlock(pthread_mutex_t *mtxp)
+{
+	int err;
+
+	if ((err = pthread_mutex_unlock(mtxp)) != 0) {
+		v8plus_panic("could not unlock release buffer mutex: %s",
+		    strerror(err));
+	}
+}
+
+/*
+ * Move the contents of every buffer into the loop's own list of releases,
+ * and free the buffers of threads that have gone away.
+ */
+static void
+v8plus_release_take(v8plus_loop_t *loop)
+{
+	v8plus_relbuf_t *vrbp, *next;
+	v8plus_release_t *rels;
+	boolean_t orphaned;
+	uint_t max;
+	int err;
+
+	if (loop->vl_relbuf_pending == 0 ||
+	    atomic_swap_uint(&loop->vl_relbuf_pending, 0) == 0)
+		return;
+
+	v8plus_release_lock(&loop->vl_relbuf_mtx);
+	for (vrbp = LIST_FIRST(&loop->vl_relbufs); vrbp != NULL; vrbp = next) {
+		next = LIST_NEXT(vrbp, vrb_loop_entry);
+
+		v8plus_release_lock(&vrbp->vrb_mtx);
+		if (vrbp->vrb_count > loop->vl_maxrels - loop->vl_nrels) {
+			max = loop->vl_nrels + vrbp->vrb_count;
+			if (max < 2 * loop->vl_maxrels)
+				max = 2 * loop->vl_maxrels;
+			rels = realloc(loop->vl_rels, max * sizeof (*rels));
+			if (rels == NULL)
+				v8plus_panic("could not grow release list");
+			loop->vl_rels = rels;
+			loop->vl_maxrels = max;
+		}
+		bcopy(vrbp->vrb_rels, &loop->vl_rels[loop->vl_nrels],
+		    vrbp->vrb_count * sizeof (v8plus_release_t));
+		loop->vl_nrels += vrbp->vrb_count;
+		vrbp->vrb_count = 0;
+		orphaned = vrbp->vrb_orphaned;
+		v8plus_release_unlock(&vrbp->vrb_mtx);
+
+		if (orphaned) {
+			LIST_REMOVE(vrbp, vrb_loop_entry);
+			err = pthread_mutex_destroy(&vrbp->vrb_mtx);
+			if (err != 0) {
+				v8plus_panic("could not destroy release "
+				    "buffer mutex: %s", strerror(err));
+			}
+			free(vrbp);
+		}
+	}
+	v8plus_release_unlock(&loop->vl_relbuf_mtx);
+}
+
+/*
+ * Run, on the event loop thread, every buffered release that no longer has
+ * to wait for an earlier call, keeping the rest in order for next time.
+ */
+static void
+v8plus_release_flush(v8plus_loop_t *loop)
+{
+	v8plus_call_kind_stats_t *ksp;
+	v8plus_release_t *vrp;
+	uint64_t oldest, t0;
+	uint_t i, j;
+
+	v8plus_release_take(loop);
+	if (loop->vl_nrels == 0)
+		return;
+
+	oldest = v8plus_callq_oldest(loop, V8PLUS_LANE_COUNT);
+	for (i = j = 0; i < loop->vl_nrels; i++) {
+		vrp = &loop->vl_rels[i];
+		if (vrp->vr_seq >= oldest) {
+			loop->vl_rels[j++] = *vrp;
+			continue;
+		}
+
+		t0 = vrp->vr_enqueued != 0 ? uv_hrtime() : 0;
+
+		switch (vrp->vr_type) {
+		case ACT_OBJECT_RELEASE:
+			v8plus_obj_unref(vrp->vr_cop);
+			break;
+		case ACT_JSFUNC_RELEASE:
+			v8plus_jsfunc_unref(vrp->vr_func);
+			break;
+		case ACT_EVENTLOOP_RELEASE:
+			v8plus_eventloop_unref(loop);
+			break;
+		default:
+			v8plus_panic("invalid buffered release type %d",
+			    vrp->vr_type);
+		}
+
+		if (t0 != 0) {
+			ksp = &loop->vl_call_kind_stats[vrp->vr_type -
+			    ACT_OBJECT_CALL];
+			ksp->vcks_count++;
+			v8plus_hist_record(&ksp->vcks_wait,
+			    t0 - vrp->vr_enqueued);
+			v8plus_hist_record(&ksp->vcks_exec, uv_hrtime() - t0);
+		}
+	}
+	loop->vl_nrels = j;
+}
+
+/*
+ * A record channel is a ring into which any number of writers reserve space
+ * by advancing the tail with compare-and-swap.  Each record is preceded by a
+ * header whose length word is written last, marking the record complete;
+ * the event loop thread consumes complete records in order from the head,
+ * stopping at the first that is still being written.  A record that will
+ * not fit before the end of the ring is preceded by a padding record
+ * filling the rest of it.  The consumer zeroes what it has consumed before
+ * giving the space back, so that a header not yet written always reads as
+ * incomplete.  Like the call queues, channels wake their loop through its
+ * async handle; a channel is marked pending by the first record written
+ * after the loop last looked at it.
+ */
+#define	V8PLUS_CHAN_MIN_SIZE	4096
+#define	V8PLUS_CHAN_MAX_SIZE	(1UL << 30)
+#define	V8PLUS_CHAN_ALIGN(_n)	(((_n) + 7) & ~(size_t)7)
+
+#define	V8PLUS_CHANREC_DONE	0x80000000U
+#define	V8PLUS_CHANREC_PAD	0x40000000U
+#define	V8PLUS_CHANREC_LEN	0x3fffffffU
+
+typedef struct v8plus_chanrec {
+	volatile uint32_t vcr_len;
+	uint32_t vcr_pad;
+} v8plus_chanrec_t;
+
+struct v8plus_channel {
+	uint64_t vch_id;
+	v8plus_loop_t *vch_loop;
+	v8plus_jsfunc_t vch_func;
+	uint8_t *vch_ring;
+	size_t vch_size;
+	size_t vch_hiwat;
+	volatile uint64_t vch_head;
+	volatile uint64_t vch_tail;
+	volatile uint_t vch_pending;
+	volatile boolean_t vch_paused;
+	volatile boolean_t vch_closed;
+	uint8_t *vch_batch;
+	uint32_t *vch_ends;
+	LIST_ENTRY(v8plus_channel) vch_entry;
+};
+
+static volatile uint64_t _v8plus_channel_id;
+
+static void
+v8plus_channel_wake(v8plus_channel_t *ch)
+{
+	v8plus_loop_t *loop = ch->vch_loop;
+
+	if (atomic_swap_uint(&ch->vch_pending, 1) != 0 ||
+	    !v8plus_loop_pin(loop))
+		return;
+	if (atomic_swap_uint(&loop->vl_chan_pending, 1) == 0)
+		uv_async_send(&loop->vl_async);
+	v8plus_loop_unpin(loop);
+}
+
+/*
+ * Consume every complete record and pass them to JavaScript as one batch.
+ */
+static void
+v8plus_channel_drain(v8plus_channel_t *ch)
+{
+	uint64_t head = ch->vch_head;
+	uint64_t tail = ch->vch_tail;
+	v8plus_chanrec_t *vcrp;
+	size_t len = 0;
+	size_t off, sz;
+	uint32_t word;
+	uint_t n = 0;
+
+	while (head != tail) {
+		off = head & (ch->vch_size - 1);
+		vcrp = (v8plus_chanrec_t *)&ch->vch_ring[off];
+		if (!((word = vcrp->vcr_len) & V8PLUS_CHANREC_DONE))
+			break;
+		membar_consumer();
+
+		if (word & V8PLUS_CHANREC_PAD) {
+			sz = ch->vch_size - off;
+		} else {
+			word &= V8PLUS_CHANREC_LEN;
+			bcopy(vcrp + 1, ch->vch_batch + len, word);
+			len += word;
+			ch->vch_ends[n++] = (uint32_t)len;
+			sz = sizeof (v8plus_chanrec_t) +
+			    V8PLUS_CHAN_ALIGN(word);
+		}
+		bzero(vcrp, sz);
+		head += sz;
+	}
+
+	if (head == ch->vch_head)
+		return;
+
+	membar_producer();
+	ch->vch_head = head;
+
+	if (n == 0)
+		return;
+
+	if (!v8plus_channel_call_direct(ch->vch_func, ch->vch_id,
+	    ch->vch_batch, len, ch->vch_ends, n))
+		ch->vch_paused = B_TRUE;
+
+	if (_v8plus_pending_exception != NULL) {
+		v8plus_post_error(_v8plus_pending_exception);
+		v8plus_clear_exception();
+	}
+}
+
+/*
+ * The channel must already be marked closed, so that JavaScript run by the
+ * final drain can neither resume it nor close it again.  Records left in a
+ * paused channel, or in one closed as its loop exits, are discarded rather
+ * than forced on its function.
+ */
+static void
+v8plus_channel_destroy(v8plus_channel_t *ch)
+{
+	if (!ch->vch_paused && !ch->vch_loop->vl_exited)
+		v8plus_channel_drain(ch);
+
+	LIST_REMOVE(ch, vch_entry);
+	v8plus_jsfunc_rele(ch->vch_func);
+	free(ch->vch_ring);
+	free(ch->vch_batch);
+	free(ch->vch_ends);
+	free(ch);
+}
+
+/*
+ * Deliver whatever has been written to each of the loop's channels since the
+ * last turn.  Channels closed by JavaScript code run from here are freed only
+ * once we are done with the list.
+ */
+static void
+v8plus_channel_flush(v8plus_loop_t *loop)
+{
+	v8plus_channel_t *ch;
+	boolean_t found;
+
+	if (loop->vl_chan_pending == 0 ||
+	    atomic_swap_uint(&loop->vl_chan_pending, 0) == 0)
+		return;
+
+	loop->vl_chan_flushing = B_TRUE;
+	LIST_FOREACH(ch, &loop->vl_channels, vch_entry) {
+		if (ch->vch_pending == 0 || ch->vch_paused || ch->vch_closed)
+			continue;
+		if (atomic_swap_uint(&ch->vch_pending, 0) != 0)
+			v8plus_channel_drain(ch);
+	}
+
+	do {
+		found = B_FALSE;
+		LIST_FOREACH(ch, &loop->vl_channels, vch_entry) {
+			if (ch->vch_closed) {
+				v8plus_channel_destroy(ch);
+				found = B_TRUE;
+				break;
+			}
+		}
+	} while (found);
+	loop->vl_chan_flushing = B_FALSE;
+}
+
+v8plus_channel_t *
+v8plus_channel_create(v8plus_jsfunc_t f, size_t capacity, size_t hiwat)
+{
+	v8plus_loop_t *loop = v8plus_loop_self();
+	v8plus_channel_t *ch;
+	size_t size;
+
+	if (v8plus_jsfunc_loop(f) != loop)
+		v8plus_panic("channel created outside its function's loop");
+
+	if (capacity > V8PLUS_CHAN_MAX_SIZE) {
+		(void) v8plus_error(V8PLUSERR_BADARG,
+		    "channel capacity %lu is too large",
+		    (unsigned long)capacity);
+		return (NULL);
+	}
+	for (size = V8PLUS_CHAN_MIN_SIZE; size < capacity; size <<= 1)
+		;
+
+	if ((ch = calloc(1, sizeof (*ch))) == NULL ||
+	    (ch->vch_ring = calloc(1, size)) == NULL ||
+	    (ch->vch_batch = malloc(size)) == NULL ||
+	    (ch->vch_ends = malloc(size / sizeof (v8plus_chanrec_t) *
+	    sizeof (uint32_t))) == NULL) {
+		if (ch != NULL) {
+			free(ch->vch_ring);
+			free(ch->vch_batch);
+			free(ch);
+		}
+		(void) v8plus_error(V8PLUSERR_NOMEM,
+		    "could not allocate channel");
+		return (NULL);
+	}
+
+	ch->vch_id = atomic_inc_64_nv(&_v8plus_channel_id);
+	ch->vch_loop = loop;
+	ch->vch_func = f;
+	ch->vch_size = size;
+	ch->vch_hiwat = (hiwat == 0 || hiwat > size) ? size / 2 : hiwat;
+
+	v8plus_jsfunc_hold(f);
+	LIST_INSERT_HEAD(&loop->vl_channels, ch, vch_entry);
+
+	return (ch);
+}
+
+int
+v8plus_channel_write(v8plus_channel_t *ch, const void *buf, size_t len)
+{
+	size_t need = sizeof (v8plus_chanrec_t) + V8PLUS_CHAN_ALIGN(len);
+	v8plus_chanrec_t *vcrp;
+	uint64_t head, tail;
+	size_t off, skip;
+
+	if (ch->vch_closed) {
+		(void) v8plus_syserr(EPIPE, "channel is closed");
+		return (-1);
+	}
+
+	if (len > ch->vch_size / 2 - sizeof (v8plus_chanrec_t)) {
+		(void) v8plus_syserr(EMSGSIZE,
+		    "record of %lu bytes is too large for channel",
+		    (unsigned long)len);
+		return (-1);
+	}
+
+	/*
+	 * The head must be read first, so that it cannot be ahead of the
+	 * tail we compare it with.
+	 */
+	do {
+		head = ch->vch_head;
+		membar_consumer();
+		tail = ch->vch_tail;
+		off = tail & (ch->vch_size - 1);
+		skip = (off + need > ch->vch_size) ? ch->vch_size - off : 0;
+		if (tail + skip + need - head > ch->vch_size) {
+			(void) v8plus_syserr(EAGAIN, "channel is full");
+			return (-1);
+		}
+	} while (atomic_cas_64(&ch->vch_tail, tail, tail + skip + need) !=
+	    tail);
+
+	if (skip != 0) {
+		vcrp = (v8plus_chanrec_t *)&ch->vch_ring[off];
+		vcrp->vcr_len = V8PLUS_CHANREC_DONE | V8PLUS_CHANREC_PAD;
+		off = 0;
+	}
+
+	vcrp = (v8plus_chanrec_t *)&ch->vch_ring[off];
+	bcopy(buf, vcrp + 1, len);
+	membar_producer();
+	vcrp->vcr_len = V8PLUS_CHANREC_DONE | (uint32_t)len;
+
+	v8plus_channel_wake(ch);
+
+	return (0);
+}
+
+boolean_t
+v8plus_channel_writable(v8plus_channel_t *ch)
+{
+	if (ch->vch_paused)
+		return (B_FALSE);
+
+	return (ch->vch_tail - ch->vch_head < ch->vch_hiwat ?
+	    B_TRUE : B_FALSE);
+}
+
+void
+v8plus_channel_close(v8plus_channel_t *ch)
+{
+	if (ch->vch_loop != _v8plus_loop)
+		v8plus_panic("channel closed outside its event loop");
+	if (ch->vch_closed)
+		v8plus_panic("channel %llu closed twice",
+		    (unsigned long long)ch->vch_id);
+
+	ch->vch_closed = B_TRUE;
+	if (!ch->vch_loop->vl_chan_flushing)
+		v8plus_channel_destroy(ch);
+}
+
+/*
+ * JavaScript interface to resume delivery on a channel whose function has
+ * asked for no more; the batch is delivered on the next turn.
+ */
+static nvlist_t *
+v8plus_builtin_channel_resume(const nvlist_t *ap)
+{
+	v8plus_channel_t *ch;
+	double id;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_NUMBER, &id,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	LIST_FOREACH(ch, &v8plus_loop_self()->vl_channels, vch_entry) {
+		if ((double)ch->vch_id == id && !ch->vch_closed)
+			break;
+	}
+	if (ch == NULL) {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "no such channel %.0f", id));
+	}
+
+	if (ch->vch_paused) {
+		ch->vch_paused = B_FALSE;
+		(void) atomic_swap_uint(&ch->vch_pending, 0);
+		v8plus_channel_wake(ch);
+	}
+
+	return (v8plus_void());
+}
+
+static void
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+v8plus_async_callback(uv_async_t *async)
+#else
+v8plus_async_callback(uv_async_t *async, int status __UNUSED)
+#endif
+{
+	v8plus_loop_t *loop = async->data;
+	boolean_t timed = (loop->vl_drain_policy == V8PLUS_DRAIN_TIME);
+	uint64_t start = uv_hrtime();
+	uint64_t now = start;
+	uint_t processed = 0;
+	boolean_t awaiting = B_FALSE;
+	uint_t budget;
+
+	if (loop != _v8plus_loop)
+		v8plus_panic("async callback called outside of event loop");
+
+	v8plus_release_flush(loop);
+	v8plus_channel_flush(loop);
+
+	switch (loop->vl_drain_policy) {
+	case V8PLUS_DRAIN_TIME:
+		budget = UINT_MAX;
+		break;
+	case V8PLUS_DRAIN_ADAPTIVE:
+		budget = loop->vl_drain_adaptive_items;
+		break;
+	case V8PLUS_DRAIN_ITEMS:
+	default:
+		budget = loop->vl_drain_max_items;
+		break;
+	}
+
+	for (;;) {
+		v8plus_async_call_t *vac = NULL;
+		boolean_t done;
+
+		/*
+		 * If a high rate of work arrives from other threads, it's
+		 * possible that we'll remain in this loop forever.  To
+		 * prevent that from happening, we stop when we have used
+		 * up this turn's budget, and take up where we left off on
+		 * the next turn.
+		 */
+		if (processed >= budget || (timed && processed > 0 &&
+		    now - start >= loop->vl_drain_max_ns)) {
+			if (v8plus_callq_idle(loop))
+				break;
+
+			if (timed || budget < loop->vl_drain_max_items)
+				loop->vl_drain_stats.vds_time_limited++;
+			else
+				loop->vl_drain_stats.vds_item_limited++;
+
+			/*
+			 * Make sure this callback is called again on the
+			 * next turn.  Anything left on our private queue
+			 * would otherwise be stranded until some other
+			 * thread happened to post more work.
+			 */
+			uv_async_send(&loop->vl_async);
+			break;
+		}
+
+		/*
+		 * Fetch the next queued method, taking more from the
+		 * producers as each lane runs out:
+		 */
+		if ((vac = v8plus_callq_next(loop)) == NULL)
+			break;
+
+		/*
+		 * Run the queued method, recording how long it waited and
+		 * how long it took if it was timestamped when queued.  The
+		 * call may be freed on completion, so we must do this first.
+		 */
+		processed++;
+		if (vac->vac_enqueued != 0) {
+			v8plus_call_kind_stats_t *ksp =
+			    &loop->vl_call_kind_stats[vac->vac_type -
+			    ACT_OBJECT_CALL];
+			uint64_t t0 = uv_hrtime();
+			uint64_t enqueued = vac->vac_enqueued;
+
+			done = v8plus_async_call_run(vac);
+			now = uv_hrtime();
+
+			ksp->vcks_count++;
+			v8plus_hist_record(&ksp->vcks_wait, t0 - enqueued);
+			v8plus_hist_record(&ksp->vcks_exec, now - t0);
+		} else {
+			done = v8plus_async_call_run(vac);
+			if (timed)
+				now = uv_hrtime();
+		}
+		if (done)
+			v8plus_async_call_complete(vac);
+		else
+			awaiting = B_TRUE;
+	}
+
+	/*
+	 * Nothing else will run the microtasks queued by Promises that were
+	 * already settled when we started waiting for them until some other
+	 * event comes along, so we do so now that we are done with JavaScript.
+	 */
+	if (awaiting)
+		v8plus_run_microtasks();
+
+	/*
+	 * Releases held back behind calls we have now run can go too.
+	 */
+	v8plus_release_flush(loop);
+
+	v8plus_drain_account(loop, processed, uv_hrtime() - start);
+}
+
+/*
+ * JavaScript interface to the drain policy, available on every module.
+ * With an options object, sets the policy; in any case, returns the current
+ * policy and statistics.
+ */
+static const char *_v8plus_drain_policy_names[] = {
+	NULL,
+	"items",		/* V8PLUS_DRAIN_ITEMS */
+	"time",			/* V8PLUS_DRAIN_TIME */
+	"adaptive"		/* V8PLUS_DRAIN_ADAPTIVE */
+};
+
+static nvlist_t *
+v8plus_builtin_drain_policy(const nvlist_t *ap)
+{
+	v8plus_loop_t *loop = v8plus_loop_self();
+	v8plus_drain_policy_t policy = loop->vl_drain_policy;
+	double items = (double)loop->vl_drain_max_items;
+	double usec = (double)(loop->vl_drain_max_ns / 1000);
+	v8plus_drain_stats_t *sp = &loop->vl_drain_stats;
+	nvlist_t *op;
+	nvpair_t *pp;
+	char *name;
+	uint_t i;
+
+	if (nvlist_lookup_nvpair((nvlist_t *)ap, "0", &pp) == 0) {
+		if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+		    V8PLUS_TYPE_OBJECT, &op,
+		    V8PLUS_TYPE_NONE) != 0)
+			return (NULL);
+
+		if (nvlist_lookup_string(op, "policy", &name) == 0) {
+			for (i = 1; i < sizeof (_v8plus_drain_policy_names) /
+			    sizeof (_v8plus_drain_policy_names[0]); i++) {
+				if (strcmp(name,
+				    _v8plus_drain_policy_names[i]) == 0)
+					break;
+			}
+			policy = (v8plus_drain_policy_t)i;
+		}
+		(void) nvlist_lookup_double(op, "items", &items);
+		(void) nvlist_lookup_double(op, "usec", &usec);
+
+		if (items < 1 || items > UINT_MAX ||
+		    usec < 1 || usec > UINT_MAX) {
+			return (v8plus_throw_exception("RangeError",
+			    "drain budgets must be positive integers",
+			    V8PLUS_TYPE_NONE));
+		}
+
+		if (v8plus_drain_policy(policy, (uint_t)items,
+		    (uint_t)usec) != 0)
+			return (NULL);
+	}
+
+	return (v8plus_obj(
+	    V8PLUS_TYPE_INL_OBJECT, "res",
+		V8PLUS_TYPE_STRING, "policy",
+		    _v8plus_drain_policy_names[loop->vl_drain_policy],
+		V8PLUS_TYPE_NUMBER, "items", (double)loop->vl_drain_max_items,
+		V8PLUS_TYPE_NUMBER, "usec",
+		    (double)(loop->vl_drain_max_ns / 1000),
+		V8PLUS_TYPE_INL_OBJECT, "stats",
+		    V8PLUS_TYPE_NUMBER, "turns", (double)sp->vds_turns,
+		    V8PLUS_TYPE_NUMBER, "items", (double)sp->vds_items,
+		    V8PLUS_TYPE_NUMBER, "item_limited",
+			(double)sp->vds_item_limited,
+		    V8PLUS_TYPE_NUMBER, "time_limited",
+			(double)sp->vds_time_limited,
+		    V8PLUS_TYPE_NUMBER, "max_turn_usec",
+			(double)(sp->vds_max_turn_ns / 1000),
+		    V8PLUS_TYPE_NONE,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE));
+}
+
+/*
+ * JavaScript interface to the queue limit: with an options object, sets the
+ * limit; in any case, returns the limit and the queue statistics.
+ */
+static nvlist_t *
+v8plus_builtin_queue_limit(const nvlist_t *ap)
+{
+	v8plus_queue_stats_t qs;
+	double limit;
+	nvlist_t *op;
+	nvpair_t *pp;
+
+	if (nvlist_lookup_nvpair((nvlist_t *)ap, "0", &pp) == 0) {
+		if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+		    V8PLUS_TYPE_OBJECT, &op,
+		    V8PLUS_TYPE_NONE) != 0)
+			return (NULL);
+
+		if (nvlist_lookup_double(op, "limit", &limit) == 0) {
+			if (limit < 0 || limit > UINT_MAX) {
+				return (v8plus_throw_exception("RangeError",
+				    "queue limit must be a non-negative "
+				    "integer", V8PLUS_TYPE_NONE));
+			}
+			v8plus_queue_limit((uint_t)limit);
+		}
+	}
+
+	v8plus_queue_stats(&qs);
+
+	return (v8plus_obj(
+	    V8PLUS_TYPE_INL_OBJECT, "res",
+		V8PLUS_TYPE_NUMBER, "limit", (double)qs.vqs_limit,
+		V8PLUS_TYPE_NUMBER, "depth", (double)qs.vqs_depth,
+		V8PLUS_TYPE_NUMBER, "max_depth", (double)qs.vqs_max_depth,
+		V8PLUS_TYPE_NUMBER, "blocked", (double)qs.vqs_blocked,
+		V8PLUS_TYPE_NUMBER, "rejected", (double)qs.vqs_rejected,
+		V8PLUS_TYPE_NUMBER, "dropped", (double)qs.vqs_dropped,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE));
+}
+
+/*
+ * JavaScript interface to the call statistics.  Returns the statistics for
+ * each kind of call, having first applied the "timing" and "reset" options
+ * if an options object is given.
+ */
+static const char *_v8plus_call_kind_names[V8PLUS_CALL_KINDS] = {
+	"method",		/* V8PLUS_CALL_METHOD */
+	"object_release",	/* V8PLUS_CALL_OBJECT_RELEASE */
+	"function",		/* V8PLUS_CALL_FUNCTION */
+	"function_release",	/* V8PLUS_CALL_FUNCTION_RELEASE */
+	"eventloop_release"	/* V8PLUS_CALL_EVENTLOOP_RELEASE */
+};
+
+static nvlist_t *
+v8plus_latency_obj(const v8plus_latency_t *lp)
+{
+	return (v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "total_ns", (double)lp->vl_total_ns,
+	    V8PLUS_TYPE_NUMBER, "max_ns", (double)lp->vl_max_ns,
+	    V8PLUS_TYPE_NUMBER, "p50_ns", (double)lp->vl_p50_ns,
+	    V8PLUS_TYPE_NUMBER, "p90_ns", (double)lp->vl_p90_ns,
+	    V8PLUS_TYPE_NUMBER, "p99_ns", (double)lp->vl_p99_ns,
+	    V8PLUS_TYPE_NUMBER, "p999_ns", (double)lp->vl_p999_ns,
+	    V8PLUS_TYPE_NONE));
+}
+
+static nvlist_t *
+v8plus_builtin_call_stats(const nvlist_t *ap)
+{
+	v8plus_call_stats_t cs;
+	boolean_t b;
+	nvlist_t *op, *rp, *wp, *ep;
+	nvpair_t *pp;
+	uint_t i;
+	int err;
+
+	if (nvlist_lookup_nvpair((nvlist_t *)ap, "0", &pp) == 0) {
+		if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+		    V8PLUS_TYPE_OBJECT, &op,
+		    V8PLUS_TYPE_NONE) != 0)
+			return (NULL);
+
+		if (nvlist_lookup_boolean_value(op, "timing", &b) == 0)
+			v8plus_call_timing(b);
+		if (nvlist_lookup_boolean_value(op, "reset", &b) == 0 && b)
+			v8plus_call_stats_reset();
+	}
+
+	if ((rp = v8plus_obj(
+	    V8PLUS_TYPE_BOOLEAN, "timing", _v8plus_call_timing,
+	    V8PLUS_TYPE_NONE)) == NULL)
+		return (NULL);
+
+	for (i = 0; i < V8PLUS_CALL_KINDS; i++) {
+		(void) v8plus_call_stats((v8plus_call_kind_t)i, &cs);
+
+		wp = v8plus_latency_obj(&cs.vcs_wait);
+		ep = v8plus_latency_obj(&cs.vcs_exec);
+		if (wp == NULL || ep == NULL) {
+			nvlist_free(wp);
+			nvlist_free(ep);
+			nvlist_free(rp);
+			return (NULL);
+		}
+
+		err = v8plus_obj_setprops(rp,
+		    V8PLUS_TYPE_INL_OBJECT, _v8plus_call_kind_names[i],
+			V8PLUS_TYPE_NUMBER, "count", (double)cs.vcs_count,
+			V8PLUS_TYPE_OBJECT, "wait", wp,
+			V8PLUS_TYPE_OBJECT, "exec", ep,
+			V8PLUS_TYPE_NONE,
+		    V8PLUS_TYPE_NONE);
+		nvlist_free(wp);
+		nvlist_free(ep);
+		if (err != 0) {
+			nvlist_free(rp);
+			return (NULL);
+		}
+	}
+
+	op = v8plus_obj(V8PLUS_TYPE_OBJECT, "res", rp, V8PLUS_TYPE_NONE);
+	nvlist_free(rp);
+
+	return (op);
+}
+
+/*
+ * Static functions provided by v8plus itself and attached to every module
+ * alongside the consumer's own.
+ */
+static const v8plus_static_descr_t _v8plus_builtin_statics[] = {
+	{
+		.sd_name = "v8plus_drain_policy",
+		.sd_c_func = v8plus_builtin_drain_policy
+	},
+	{
+		.sd_name = "v8plus_queue_limit",
+		.sd_c_func = v8plus_builtin_queue_limit
+	},
+	{
+		.sd_name = "v8plus_call_stats",
+		.sd_c_func = v8plus_builtin_call_stats
+	},
+	{
+		.sd_name = "v8plus_channel_resume",
+		.sd_c_func = v8plus_builtin_channel_resume
+	}
+};
+const v8plus_static_descr_t *const v8plus_builtin_statics =
+    _v8plus_builtin_statics;
+const uint_t v8plus_builtin_static_count =
+    sizeof (_v8plus_builtin_statics) / sizeof (_v8plus_builtin_statics[0]);
+
+/*
+ * As we cannot manipulate v8plus/V8/Node structures directly from outside the
+ * event loop thread, we push the call arguments onto a queue and post to the
+ * event loop thread.  We then wait, using this thread's waiter, until the
+ * event loop thread makes the call for us and wakes us up.
+ *
+ * This routine implements the parts of this interaction common to all
+ * variants.
+ */
+static nvlist_t *
+v8plus_cross_thread_call(v8plus_async_call_t *vac)
+{
+	if (vac->vac_flags & ACF_NOREPLY) {
+		/*
+		 * The caller does not care about the reply, and has allocated
+		 * the v8plus_async_call_t structure from the heap.  The
+		 * async callback will free the storage when it completes.
+		 */
+		v8plus_callq_enqueue(vac);
+		return (NULL);
+	}
+
+	if (v8plus_callq_admit(1, B_FALSE) != 0)
+		return (NULL);
+
+	if (_v8plus_await_promises)
+		vac->vac_flags |= ACF_AWAIT;
+	vac->vac_waiter = v8plus_waiter();
+	vac->vac_done = 0;
+
+	/*
+	 * Post request to queue:
+	 */
+	v8plus_callq_enqueue(vac);
+
+	/*
+	 * Wait for our request to be serviced on the event loop thread:
+	 */
+	v8plus_waiter_wait(vac);
+	v8plus_async_call_rethrow(vac);
+
+	return (vac->vac_return);
+}
+
+nvlist_t *
+v8plus_method_call(void *cop, const char *name, const nvlist_t *lp)
+{
+	v8plus_loop_t *loop = v8plus_obj_loop(cop);
+	v8plus_async_call_t vac;
+
+	if (loop == _v8plus_loop) {
+		/*
+		 * We're running in the object's event loop thread, so we can
+		 * make the call directly.
+		 */
+		return (v8plus_method_call_direct(cop, name, lp));
+	}
+
+	bzero(&vac, sizeof (vac));
+	vac.vac_loop = loop;
+	vac.vac_type = ACT_OBJECT_CALL;
+	vac.vac_cop = cop;
+	vac.vac_name = name;
+	vac.vac_lp = lp;
+
+	return (v8plus_cross_thread_call(&vac));
+}
+
+nvlist_t *
+v8plus_call(v8plus_jsfunc_t func, const nvlist_t *lp)
+{
+	v8plus_loop_t *loop = v8plus_jsfunc_loop(func);
+	v8plus_async_call_t vac;
+
+	if (loop == _v8plus_loop) {
+		/*
+		 * We're running in the function's event loop thread, so we
+		 * can make the call directly.
+		 */
+		return (v8plus_call_direct(func, lp));
+	}
+
+	bzero(&vac, sizeof (vac));
+	vac.vac_loop = loop;
+	vac.vac_type = ACT_JSFUNC_CALL;
+	vac.vac_func = func;
+	vac.vac_lp = lp;
+
+	return (v8plus_cross_thread_call(&vac));
+}
+
+/*
+ * Post a call for which the caller does not want the result.  We own the
+ * argument list, which is freed, along with the result, once the call has
+ * been made.  Any exception is passed to the post error handler.
+ */
+static int
+v8plus_cross_thread_post(v8plus_async_call_t *vac)
+{
+	vac->vac_flags = ACF_NOREPLY;
+
+	if (vac->vac_loop == _v8plus_loop) {
+		(void) v8plus_async_call_run(vac);
+		v8plus_async_call_complete(vac);
+		return (0);
+	}
+
+	switch (v8plus_callq_admit(1, B_TRUE)) {
+	case 0:
+		(void) v8plus_cross_thread_call(vac);
+		return (0);
+	case 1:
+		nvlist_free((nvlist_t *)vac->vac_lp);
+		free(vac);
+		return (0);
+	default:
+		nvlist_free((nvlist_t *)vac->vac_lp);
+		free(vac);
+		return (-1);
+	}
+}
+
+int
+v8plus_method_post(void *cop, const char *name, nvlist_t *lp)
+{
+	v8plus_async_call_t *vac;
+
+	if ((vac = calloc(1, sizeof (*vac))) == NULL) {
+		nvlist_free(lp);
+		(void) v8plus_error(V8PLUSERR_NOMEM,
+		    "could not allocate async call structure");
+		return (-1);
+	}
+
+	vac->vac_loop = v8plus_obj_loop(cop);
+	vac->vac_type = ACT_OBJECT_CALL;
+	vac->vac_cop = cop;
+	vac->vac_name = name;
+	vac->vac_lp = lp;
+
+	return (v8plus_cross_thread_post(vac));
+}
+
+int
+v8plus_call_post(v8plus_jsfunc_t func, nvlist_t *lp)
+{
+	v8plus_async_call_t *vac;
+
+	if ((vac = calloc(1, sizeof (*vac))) == NULL) {
+		nvlist_free(lp);
+		(void) v8plus_error(V8PLUSERR_NOMEM,
+		    "could not allocate async call structure");
+		return (-1);
+	}
+
+	vac->vac_loop = v8plus_jsfunc_loop(func);
+	vac->vac_type = ACT_JSFUNC_CALL;
+	vac->vac_func = func;
+	vac->vac_lp = lp;
+
+	return (v8plus_cross_thread_post(vac));
+}
+
+/*
+ * Post an update for which only the latest value matters.  If an update with
+ * the same target and key is still waiting to be run, we simply replace its
+ * arguments with ours; otherwise ours is posted as any other.  The template
+ * call describes the target and key; a heap copy is made only if needed.
+ */
+static int
+v8plus_coalesce_post(const v8plus_async_call_t *tmpl, nvlist_t *lp)
+{
+	v8plus_coalesce_bucket_t *vcbp = v8plus_coalesce_bucket(tmpl);
+	v8plus_async_call_t *nvac = NULL;
+	v8plus_async_call_t *vac;
+	nvlist_t *olp;
+
+	for (;;) {
+		v8plus_coalesce_lock(vcbp);
+
+		LIST_FOREACH(vac, &vcbp->vcb_calls, vac_coalesce_entry) {
+			if (v8plus_coalesce_match(vac, tmpl))
+				break;
+		}
+
+		if (vac != NULL) {
+			olp = (nvlist_t *)vac->vac_lp;
+			vac->vac_lp = lp;
+			v8plus_coalesce_unlock(vcbp);
+
+			/*
+			 * The arguments we have replaced will never be
+			 * delivered, and any entry we made is not needed.
+			 */
+			nvlist_free(olp);
+			if (nvac != NULL) {
+				free(nvac);
+				v8plus_callq_unreserve(1);
+			}
+			return (0);
+		}
+
+		if (nvac != NULL) {
+			LIST_INSERT_HEAD(&vcbp->vcb_calls, nvac,
+			    vac_coalesce_entry);
+			v8plus_coalesce_unlock(vcbp);
+
+			/*
+			 * Even on the event loop thread, we cannot run the
+			 * new entry immediately, as that would let it
+			 * overtake an earlier update that is queued.
+			 */
+			v8plus_callq_enqueue(nvac);
+			return (0);
+		}
+
+		v8plus_coalesce_unlock(vcbp);
+
+		/*
+		 * We need a new entry, for which there must be room on the
+		 * queue.  We cannot wait for room while holding the bucket
+		 * lock, which the event loop thread needs in order to make
+		 * any, so we look again once we have it in case another
+		 * update has been queued in the meantime.
+		 */
+		switch (v8plus_callq_admit(1, B_TRUE)) {
+		case 0:
+			break;
+		case 1:
+			nvlist_free(lp);
+			return (0);
+		default:
+			nvlist_free(lp);
+			return (-1);
+		}
+
+		if ((nvac = malloc(sizeof (*nvac))) == NULL) {
+			v8plus_callq_unreserve(1);
+			nvlist_free(lp);
+			(void) v8plus_error(V8PLUSERR_NOMEM,
+			    "could not allocate async call structure");
+			return (-1);
+		}
+
+		bcopy(tmpl, nvac, sizeof (*nvac));
+		nvac->vac_flags = ACF_NOREPLY | ACF_COALESCED;
+		nvac->vac_lp = lp;
+	}
+}
+
+int
+v8plus_method_post_latest(void *cop, const char *name, nvlist_t *lp)
+{
+	v8plus_async_call_t tmpl;
+
+	bzero(&tmpl, sizeof (tmpl));
+	tmpl.vac_loop = v8plus_obj_loop(cop);
+	tmpl.vac_type = ACT_OBJECT_CALL;
+	tmpl.vac_cop = cop;
+	tmpl.vac_name = name;
+
+	return (v8plus_coalesce_post(&tmpl, lp));
+}
+
+int
+v8plus_call_post_latest(v8plus_jsfunc_t func, uint64_t key, nvlist_t *lp)
+{
+	v8plus_async_call_t tmpl;
+
+	bzero(&tmpl, sizeof (tmpl));
+	tmpl.vac_loop = v8plus_jsfunc_loop(func);
+	tmpl.vac_type = ACT_JSFUNC_CALL;
+	tmpl.vac_func = func;
+	tmpl.vac_key = key;
+
+	return (v8plus_coalesce_post(&tmpl, lp));
+}
+
+static v8plus_loop_t *
+v8plus_batch_call_loop(const v8plus_batch_call_t *bcp)
+{
+	if (bcp->vbc_obj != NULL)
+		return (v8plus_obj_loop(bcp->vbc_obj));
+
+	return (v8plus_jsfunc_loop(bcp->vbc_func));
+}
+
+/*
+ * Returns the loop on which all of the calls in a batch are to be made, or
+ * NULL if they are not all for the same loop.
+ */
+static v8plus_loop_t *
+v8plus_batch_loop(const v8plus_batch_call_t *calls, uint_t ncalls)
+{
+	v8plus_loop_t *loop = v8plus_batch_call_loop(&calls[0]);
+	uint_t i;
+
+	if (_v8plus_nloops == 1)
+		return (loop);
+
+	for (i = 1; i < ncalls; i++) {
+		if (v8plus_batch_call_loop(&calls[i]) != loop)
+			return (NULL);
+	}
+
+	return (loop);
+}
+
+static void
+v8plus_batch_call_init(v8plus_async_call_t *vac, const v8plus_batch_call_t *bcp,
+    v8plus_loop_t *loop)
+{
+	vac->vac_loop = loop;
+	if (bcp->vbc_obj != NULL) {
+		vac->vac_type = ACT_OBJECT_CALL;
+		vac->vac_cop = bcp->vbc_obj;
+		vac->vac_name = bcp->vbc_name;
+	} else {
+		vac->vac_type = ACT_JSFUNC_CALL;
+		vac->vac_func = bcp->vbc_func;
+	}
+	vac->vac_lp = bcp->vbc_args;
+}
+
+/*
+ * Submit a number of calls to the event loop thread at once.  Instead of a
+ * queue insertion, a wakeup, and a wait for each call, the whole batch is
+ * spliced into the queue at once, with one wakeup, and we wait only once for
+ * all of the calls to complete.
+ */
+int
+v8plus_call_batch(const v8plus_batch_call_t *calls, uint_t ncalls,
+    nvlist_t **results)
+{
+	v8plus_async_batch_t vab;
+	v8plus_async_call_t *vacs;
+	v8plus_loop_t *loop;
+	boolean_t raised = B_FALSE;
+	uint_t i;
+	int err;
+
+	if (ncalls == 0)
+		return (0);
+
+	/*
+	 * If we are running the loop on which the calls are to be made, we
+	 * can make them directly.  A batch spanning several loops is rare
+	 * enough that we simply make each call in the usual way.
+	 */
+	if ((loop = v8plus_batch_loop(calls, ncalls)) == NULL ||
+	    loop == _v8plus_loop) {
+		for (i = 0; i < ncalls; i++) {
+			const v8plus_batch_call_t *bcp = &calls[i];
+
+			if (bcp->vbc_obj != NULL) {
+				results[i] = v8plus_method_call(
+				    bcp->vbc_obj, bcp->vbc_name,
+				    bcp->vbc_args);
+			} else {
+				results[i] = v8plus_call(
+				    bcp->vbc_func, bcp->vbc_args);
+			}
+			if (results[i] == NULL)
+				raised = B_TRUE;
+		}
+		return (raised ? -1 : 0);
+	}
+
+	for (i = 0; i < ncalls; i++)
+		results[i] = NULL;
+
+	if (v8plus_callq_admit(ncalls, B_FALSE) != 0)
+		return (-1);
+
+	if ((vacs = calloc(ncalls, sizeof (v8plus_async_call_t))) == NULL) {
+		v8plus_callq_unreserve(ncalls);
+		(void) v8plus_error(V8PLUSERR_NOMEM,
+		    "could not allocate async call structures");
+		return (-1);
+	}
+
+	err = pthread_mutex_init(&vab.vab_mtx, &_v8plus_mutexattr);
+	if (err != 0) {
+		v8plus_panic("could not init async batch mutex: %s",
+		    strerror(err));
+	}
+	err = pthread_cond_init(&vab.vab_cv, NULL);
+	if (err != 0) {
+		v8plus_panic("could not init async batch condvar: %s",
+		    strerror(err));
+	}
+	vab.vab_pending = ncalls;
+
+	for (i = 0; i < ncalls; i++) {
+		v8plus_batch_call_init(&vacs[i], &calls[i], loop);
+		vacs[i].vac_batch = &vab;
+		if (i > 0)
+			vacs[i].vac_next = &vacs[i - 1];
+	}
+
+	v8plus_callq_submit(&vacs[0], &vacs[ncalls - 1]);
+
+	err = pthread_mutex_lock(&vab.vab_mtx);
+	if (err != 0) {
+		v8plus_panic("could not lock async batch mutex: %s",
+		    strerror(err));
+	}
+	while (vab.vab_pending != 0) {
+		err = pthread_cond_wait(&vab.vab_cv, &vab.vab_mtx);
+		if (err != 0) {
+			v8plus_panic("could not wait on async batch condvar: "
+			    "%s", strerror(err));
+		}
+	}
+	err = pthread_mutex_unlock(&vab.vab_mtx);
+	if (err != 0) {
+		v8plus_panic("could not unlock async batch mutex: %s",
+		    strerror(err));
+	}
+
+	err = pthread_cond_destroy(&vab.vab_cv);
+	if (err != 0) {
+		v8plus_panic("could not destroy async batch condvar: %s",
+		    strerror(err));
+	}
+	err = pthread_mutex_destroy(&vab.vab_mtx);
+	if (err != 0) {
+		v8plus_panic("could not destroy async batch mutex: %s",
+		    strerror(err));
+	}
+
+	/*
+	 * Only one exception can be pending, so that of the first call to
+	 * fail is raised and the rest are discarded.
+	 */
+	for (i = 0; i < ncalls; i++) {
+		results[i] = vacs[i].vac_return;
+		if (!raised && vacs[i].vac_exception != NULL) {
+			v8plus_async_call_rethrow(&vacs[i]);
+			raised = B_TRUE;
+		}
+		nvlist_free(vacs[i].vac_exception);
+	}
+	free(vacs);
+
+	return (raised ? -1 : 0);
+}
+
+/*
+ * As v8plus_call_batch(), but without waiting for or collecting results.
+ * Ownership of each argument list passes to us, just as for
+ * v8plus_call_post().
+ */
+int
+v8plus_post_batch(const v8plus_batch_call_t *calls, uint_t ncalls)
+{
+	v8plus_async_call_t *oldest = NULL;
+	v8plus_async_call_t *newest = NULL;
+	v8plus_async_call_t *vac;
+	v8plus_loop_t *loop;
+	uint_t i;
+	int err;
+
+	if (ncalls == 0)
+		return (0);
+
+	if ((loop = v8plus_batch_loop(calls, ncalls)) == NULL ||
+	    loop == _v8plus_loop) {
+		err = 0;
+		for (i = 0; i < ncalls; i++) {
+			const v8plus_batch_call_t *bcp = &calls[i];
+
+			if (bcp->vbc_obj != NULL) {
+				if (v8plus_method_post(bcp->vbc_obj,
+				    bcp->vbc_name,
+				    (nvlist_t *)bcp->vbc_args) != 0)
+					err = -1;
+			} else {
+				if (v8plus_call_post(bcp->vbc_func,
+				    (nvlist_t *)bcp->vbc_args) != 0)
+					err = -1;
+			}
+		}
+		return (err);
+	}
+
+	if ((err = v8plus_callq_admit(ncalls, B_TRUE)) != 0) {
+		for (i = 0; i < ncalls; i++)
+			nvlist_free((nvlist_t *)calls[i].vbc_args);
+		return (err > 0 ? 0 : -1);
+	}
+
+	for (i = 0; i < ncalls; i++) {
+		if ((vac = calloc(1, sizeof (*vac))) == NULL) {
+			/*
+			 * Nothing has been queued yet, so we can simply
+			 * discard everything we were given.
+			 */
+			while ((vac = newest) != NULL) {
+				newest = vac->vac_next;
+				free(vac);
+			}
+			for (i = 0; i < ncalls; i++)
+				nvlist_free((nvlist_t *)calls[i].vbc_args);
+			v8plus_callq_unreserve(ncalls);
+			(void) v8plus_error(V8PLUSERR_NOMEM,
+			    "could not allocate async call structure");
+			return (-1);
+		}
+
+		v8plus_batch_call_init(vac, &calls[i], loop);
+		vac->vac_flags = ACF_NOREPLY;
+		vac->vac_next = newest;
+		newest = vac;
+		if (oldest == NULL)
+			oldest = vac;
+	}
+
+	if (newest != NULL)
+		v8plus_callq_submit(oldest, newest);
+
+	return (0);
+}
+
+/*
+ * Set up and post a call whose result is to be collected later, by any
+ * thread, through the v8plus_future_*() interfaces.  If we are already on
+ * the event loop thread, the call is made immediately and the future
+ * returned is already complete.  Otherwise the future may be freed long
+ * before the call is made, so it takes copies of the arguments and the
+ * method name, which it owns from then on.
+ */
+static v8plus_future_t *
+v8plus_cross_thread_call_async(v8plus_async_call_t *vac)
+{
+	const nvlist_t *lp = vac->vac_lp;
+	const char *name = vac->vac_name;
+	int err;
+
+	vac->vac_flags |= ACF_FUTURE;
+	if (_v8plus_await_promises)
+		vac->vac_flags |= ACF_AWAIT;
+
+	err = pthread_mutex_init(&vac->vac_mtx, &_v8plus_mutexattr);
+	if (err != 0) {
+		v8plus_panic("could not init async call mutex: %s",
+		    strerror(err));
+	}
+	err = pthread_cond_init(&vac->vac_cv, NULL);
+	if (err != 0) {
+		v8plus_panic("could not init async call condvar: %s",
+		    strerror(err));
+	}
+
+	if (vac->vac_loop == _v8plus_loop) {
+		if (v8plus_async_call_run(vac))
+			vac->vac_flags |= ACF_COMPLETED;
+		return (vac);
+	}
+
+	vac->vac_lp = NULL;
+	vac->vac_name = NULL;
+	vac->vac_flags |= ACF_OWNARGS;
+	if (lp != NULL &&
+	    (err = v8plus_args_dup(lp, (nvlist_t **)&vac->vac_lp)) != 0) {
+		v8plus_future_destroy(vac);
+		(void) v8plus_nverr(err, NULL);
+		return (NULL);
+	}
+	if (name != NULL && (vac->vac_name = strdup(name)) == NULL) {
+		v8plus_future_destroy(vac);
+		(void) v8plus_error(V8PLUSERR_NOMEM,
+		    "could not copy method name");
+		return (NULL);
+	}
+
+	if (v8plus_callq_admit(1, B_FALSE) != 0) {
+		v8plus_future_destroy(vac);
+		return (NULL);
+	}
+
+	v8plus_callq_enqueue(vac);
+
+	return (vac);
+}
+
+v8plus_future_t *
+v8plus_method_call_async(void *cop, const char *name, const nvlist_t *lp)
+{
+	v8plus_async_call_t *vac;
+
+	if ((vac = calloc(1, sizeof (*vac))) == NULL) {
+		(void) v8plus_error(V8PLUSERR_NOMEM,
+		    "could not allocate async call structure");
+		return (NULL);
+	}
+
+	vac->vac_loop = v8plus_obj_loop(cop);
+	vac->vac_type = ACT_OBJECT_CALL;
+	vac->vac_cop = cop;
+	vac->vac_name = name;
+	vac->vac_lp = lp;
+
+	return (v8plus_cross_thread_call_async(vac));
+}
+
+v8plus_future_t *
+v8plus_call_async(v8plus_jsfunc_t func, const nvlist_t *lp)
+{
+	v8plus_async_call_t *vac;
+
+	if ((vac = calloc(1, sizeof (*vac))) == NULL) {
+		(void) v8plus_error(V8PLUSERR_NOMEM,
+		    "could not allocate async call structure");
+		return (NULL);
+	}
+
+	vac->vac_loop = v8plus_jsfunc_loop(func);
+	vac->vac_type = ACT_JSFUNC_CALL;
+	vac->vac_func = func;
+	vac->vac_lp = lp;
+
+	return (v8plus_cross_thread_call_async(vac));
+}
+
+boolean_t
+v8plus_future_done(v8plus_future_t *vac)
+{
+	boolean_t done;
+	int err;
+
+	err = pthread_mutex_lock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not lock async call mutex: %s",
+		    strerror(err));
+	}
+	done = (vac->vac_flags & ACF_COMPLETED) ? B_TRUE : B_FALSE;
+	err = pthread_mutex_unlock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not unlock async call mutex: %s",
+		    strerror(err));
+	}
+
+	return (done);
+}
+
+/*
+ * Wait for a future until the given absolute CLOCK_REALTIME deadline, or
+ * forever if it is NULL.
+ */
+static int
+v8plus_future_wait_until(v8plus_future_t *vac,
+    const struct timespec *deadline)
+{
+	int rv = 0;
+	int err;
+
+	err = pthread_mutex_lock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not lock async call mutex: %s",
+		    strerror(err));
+	}
+	while (!(vac->vac_flags & ACF_COMPLETED)) {
+		/*
+		 * The call can only be completed by its event loop thread,
+		 * so if that is us, we would wait forever.
+		 */
+		if (vac->vac_loop == _v8plus_loop)
+			v8plus_panic("waiting on future in event loop thread");
+
+		if (deadline == NULL) {
+			err = pthread_cond_wait(&vac->vac_cv, &vac->vac_mtx);
+		} else {
+			err = pthread_cond_timedwait(&vac->vac_cv,
+			    &vac->vac_mtx, deadline);
+		}
+		if (err == ETIMEDOUT) {
+			rv = ETIMEDOUT;
+			break;
+		}
+		if (err != 0) {
+			v8plus_panic("could not wait on async call condvar: %s",
+			    strerror(err));
+		}
+	}
+	err = pthread_mutex_unlock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not unlock async call mutex: %s",
+		    strerror(err));
+	}
+
+	return (rv);
+}
+
+int
+v8plus_future_wait(v8plus_future_t *vac, int timeout_ms)
+{
+	struct timespec deadline;
+
+	if (timeout_ms < 0)
+		return (v8plus_future_wait_until(vac, NULL));
+
+	(void) clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	return (v8plus_future_wait_until(vac, &deadline));
+}
+
+nvlist_t *
+v8plus_future_result(v8plus_future_t *vac)
+{
+	nvlist_t *rp;
+
+	if (v8plus_future_wait(vac, -1) != 0)
+		v8plus_panic("untimed wait on future timed out");
+
+	if (vac->vac_flags & ACF_CANCELLED) {
+		return (v8plus_syserr(ECANCELED,
+		    "call was cancelled before it was made"));
+	}
+
+	v8plus_async_call_rethrow(vac);
+
+	rp = vac->vac_return;
+	vac->vac_return = NULL;
+
+	return (rp);
+}
+
+void
+v8plus_future_then(v8plus_future_t *vac, v8plus_future_f then, void *arg)
+{
+	boolean_t done;
+	int err;
+
+	err = pthread_mutex_lock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not lock async call mutex: %s",
+		    strerror(err));
+	}
+	if (vac->vac_then != NULL)
+		v8plus_panic("future already has a continuation");
+	vac->vac_then = then;
+	vac->vac_then_arg = arg;
+	done = (vac->vac_flags & ACF_COMPLETED) ? B_TRUE : B_FALSE;
+	err = pthread_mutex_unlock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not unlock async call mutex: %s",
+		    strerror(err));
+	}
+
+	/*
+	 * If the result has already arrived, nobody else will run the
+	 * continuation, so we do it here in the caller's context.
+	 */
+	if (done) {
+		then(vac, arg);
+		v8plus_future_free(vac);
+	}
+}
+
+void
+v8plus_future_free(v8plus_future_t *vac)
+{
+	boolean_t done;
+	int err;
+
+	if (vac == NULL)
+		return;
+
+	err = pthread_mutex_lock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not lock async call mutex: %s",
+		    strerror(err));
+	}
+	done = (vac->vac_flags & ACF_COMPLETED) ? B_TRUE : B_FALSE;
+	if (!done)
+		vac->vac_flags |= ACF_DETACHED;
+	err = pthread_mutex_unlock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not unlock async call mutex: %s",
+		    strerror(err));
+	}
+
+	/*
+	 * If the call is still outstanding, the event loop thread will free
+	 * the future along with its result when it has been run.
+	 */
+	if (done)
+		v8plus_future_destroy(vac);
+}
+
+boolean_t
+v8plus_future_cancel(v8plus_future_t *vac)
+{
+	boolean_t cancelled = B_FALSE;
+	int err;
+
+	err = pthread_mutex_lock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not lock async call mutex: %s",
+		    strerror(err));
+	}
+	if (!(vac->vac_flags & (ACF_STARTED | ACF_COMPLETED))) {
+		vac->vac_flags |= ACF_CANCELLED;
+		cancelled = B_TRUE;
+	}
+	err = pthread_mutex_unlock(&vac->vac_mtx);
+	if (err != 0) {
+		v8plus_panic("could not unlock async call mutex: %s",
+		    strerror(err));
+	}
+
+	return (cancelled);
+}
+
+/*
+ * Make a call through a future, giving up on it at the deadline.  The future
+ * has its own copy of the arguments, as the call may be made after we have
+ * returned; if the call has not yet started when we give up, it never will,
+ * and otherwise its result is thrown away when it completes.
+ */
+static nvlist_t *
+v8plus_cross_thread_call_timed(v8plus_async_call_t *vac,
+    const struct timespec *deadline)
+{
+	v8plus_future_t *fp;
+	nvlist_t *rp;
+	boolean_t cancelled;
+
+	if ((fp = v8plus_cross_thread_call_async(vac)) == NULL)
+		return (NULL);
+
+	if (v8plus_future_wait_until(fp, deadline) != 0) {
+		cancelled = v8plus_future_cancel(fp);
+		v8plus_future_free(fp);
+		return (v8plus_syserr(ETIMEDOUT, cancelled ?
+		    "call timed out before it was made" :
+		    "call timed out while in progress"));
+	}
+
+	rp = v8plus_future_result(fp);
+	v8plus_future_free(fp);
+
+	return (rp);
+}
+
+nvlist_t *
+v8plus_method_call_timed(void *cop, const char *name, const nvlist_t *lp,
+    const struct timespec *deadline)
+{
+	v8plus_loop_t *loop = v8plus_obj_loop(cop);
+	v8plus_async_call_t *vac;
+
+	if (loop == _v8plus_loop)
+		return (v8plus_method_call_direct(cop, name, lp));
+
+	if ((vac = calloc(1, sizeof (*vac))) == NULL) {
+		return (v8plus_error(V8PLUSERR_NOMEM,
+		    "could not allocate async call structure"));
+	}
+
+	vac->vac_loop = loop;
+	vac->vac_type = ACT_OBJECT_CALL;
+	vac->vac_cop = cop;
+	vac->vac_name = name;
+	vac->vac_lp = lp;
+
+	return (v8plus_cross_thread_call_timed(vac, deadline));
+}
+
+nvlist_t *
+v8plus_call_timed(v8plus_jsfunc_t func, const nvlist_t *lp,
+    const struct timespec *deadline)
+{
+	v8plus_loop_t *loop = v8plus_jsfunc_loop(func);
+	v8plus_async_call_t *vac;
+
+	if (loop == _v8plus_loop)
+		return (v8plus_call_direct(func, lp));
+
+	if ((vac = calloc(1, sizeof (*vac))) == NULL) {
+		return (v8plus_error(V8PLUSERR_NOMEM,
+		    "could not allocate async call structure"));
+	}
+
+	vac->vac_loop = loop;
+	vac->vac_type = ACT_JSFUNC_CALL;
+	vac->vac_func = func;
+	vac->vac_lp = lp;
+
+	return (v8plus_cross_thread_call_timed(vac, deadline));
+}
+
+/*
+ * When a thread exits, hand its release buffers over to their loops, which
+ * will run anything left in them and then free them.
+ */
+static void
+v8plus_relbuf_orphan(void *arg)
+{
+	v8plus_relbuf_t *vrbp, *next;
+	v8plus_loop_t *loop;
+
+	for (vrbp = arg; vrbp != NULL; vrbp = next) {
+		next = vrbp->vrb_thread_next;
+		loop = vrbp->vrb_loop;
+
+		v8plus_release_lock(&vrbp->vrb_mtx);
+		vrbp->vrb_orphaned = B_TRUE;
+		v8plus_release_unlock(&vrbp->vrb_mtx);
+
+		/*
+		 * If the loop has exited, the buffer is freed when its slot
+		 * is next used.
+		 */
+		if (!v8plus_loop_pin(loop))
+			continue;
+		if (atomic_swap_uint(&loop->vl_relbuf_pending, 1) == 0)
+			uv_async_send(&loop->vl_async);
+		v8plus_loop_unpin(loop);
+	}
+}
+
+static void
+v8plus_relbuf_key_init(void)
+{
+	int err;
+
+	err = pthread_key_create(&_v8plus_relbuf_key, v8plus_relbuf_orphan);
+	if (err != 0) {
+		v8plus_panic("could not create release buffer key: %s",
+		    strerror(err));
+	}
+}
+
+static v8plus_relbuf_t *
+v8plus_relbuf(v8plus_loop_t *loop)
+{
+	v8plus_relbuf_t *vrbp;
+	int err;
+
+	for (vrbp = _v8plus_relbufs; vrbp != NULL;
+	    vrbp = vrbp->vrb_thread_next) {
+		if (vrbp->vrb_loop == loop)
+			return (vrbp);
+	}
+
+	(void) pthread_once(&_v8plus_relbuf_once, v8plus_relbuf_key_init);
+
+	if ((vrbp = calloc(1, sizeof (v8plus_relbuf_t))) == NULL)
+		v8plus_panic("could not allocate release buffer");
+
+	/*
+	 * As with the waiter mutex, this is only ever held for a few
+	 * instructions and does not need error checking.
+	 */
+	if ((err = pthread_mutex_init(&vrbp->vrb_mtx, NULL)) != 0) {
+		v8plus_panic("could not init release buffer mutex: %s",
+		    strerror(err));
+	}
+	vrbp->vrb_loop = loop;
+	vrbp->vrb_thread_next = _v8plus_relbufs;
+
+	v8plus_release_lock(&loop->vl_relbuf_mtx);
+	LIST_INSERT_HEAD(&loop->vl_relbufs, vrbp, vrb_loop_entry);
+	v8plus_release_unlock(&loop->vl_relbuf_mtx);
+
+	_v8plus_relbufs = vrbp;
+	if ((err = pthread_setspecific(_v8plus_relbuf_key, vrbp)) != 0) {
+		v8plus_panic("could not set release buffer key: %s",
+		    strerror(err));
+	}
+
+	return (vrbp);
+}
+
+/*
+ * Add a release to this thread's buffer for the loop, returning B_FALSE if
+ * the buffer is full and the release must be queued as a call instead.  A
+ * release for a loop that has exited is discarded.
+ */
+static boolean_t
+v8plus_release_buffer(v8plus_loop_t *loop, v8plus_async_call_type_t type,
+    const void *cop, v8plus_jsfunc_t f)
+{
+	v8plus_relbuf_t *vrbp = v8plus_relbuf(loop);
+	v8plus_release_t *vrp;
+	uint_t count;
+
+	if (!v8plus_loop_pin(loop))
+		return (B_TRUE);
+
+	v8plus_release_lock(&vrbp->vrb_mtx);
+	if ((count = vrbp->vrb_count) == V8PLUS_RELBUF_SIZE) {
+		v8plus_release_unlock(&vrbp->vrb_mtx);
+		v8plus_loop_unpin(loop);
+		return (B_FALSE);
+	}
+	vrp = &vrbp->vrb_rels[count];
+	vrp->vr_type = type;
+	vrp->vr_seq = _v8plus_callq_seq;
+	vrp->vr_enqueued = _v8plus_call_timing ? uv_hrtime() : 0;
+	vrp->vr_cop = cop;
+	vrp->vr_func = f;
+	vrbp->vrb_count = count + 1;
+	v8plus_release_unlock(&vrbp->vrb_mtx);
+
+	/*
+	 * If the buffer was not empty, the loop has yet to take the release
+	 * that made it so, and that release made sure the loop would wake.
+	 */
+	if (count == 0 && atomic_swap_uint(&loop->vl_relbuf_pending, 1) == 0)
+		uv_async_send(&loop->vl_async);
+	v8plus_loop_unpin(loop);
+
+	return (B_TRUE);
+}
+
+void
+v8plus_obj_hold(const void *cop)
+{
+	v8plus_loop_t *loop = v8plus_obj_loop(cop);
+	v8plus_hold_bucket_t *vhbp;
+	v8plus_hold_ent_t *vhep;
+	boolean_t first;
+
+	vhep = v8plus_hold_lock(VHT_OBJECT, (uint64_t)(uintptr_t)cop, &vhbp);
+	if (vhep == NULL) {
+		if (loop != _v8plus_loop) {
+			v8plus_panic("object %p must be held on its event "
+			    "loop thread before other threads may hold it",
+			    cop);
+		}
+		vhep = v8plus_hold_create(vhbp, VHT_OBJECT,
+		    (uint64_t)(uintptr_t)cop);
+	}
+	first = (vhep->vhe_refs++ == 0 && !vhep->vhe_dead) ? B_TRUE : B_FALSE;
+	v8plus_hold_unlock(vhbp);
+
+	if (first)
+		v8plus_obj_ref(cop);
+}
+
+void
+v8plus_obj_rele(const void *cop)
+{
+	v8plus_loop_t *loop = v8plus_obj_loop(cop);
+	v8plus_async_call_t *vac;
+
+	if (!v8plus_hold_drop(VHT_OBJECT, (uint64_t)(uintptr_t)cop))
+		return;
+
+	if (loop == _v8plus_loop) {
+		return (v8plus_obj_unref(cop));
+	}
+
+	if (v8plus_release_buffer(loop, ACT_OBJECT_RELEASE, cop, 0))
+		return;
+
+	vac = calloc(1, sizeof (*vac));
+	if (vac == NULL)
+		v8plus_panic("could not allocate async call structure");
+
+	vac->vac_loop = loop;
+	vac->vac_type = ACT_OBJECT_RELEASE;
+	vac->vac_flags = ACF_NOREPLY;
+	vac->vac_cop = (void *)cop;
+
+	(void) v8plus_cross_thread_call(vac);
+}
+
+void
+v8plus_obj_rele_direct(const void *cop)
+{
+	if (v8plus_obj_loop(cop) != v8plus_loop_self())
+		v8plus_panic("object %p released off its event loop", cop);
+
+	v8plus_obj_rele(cop);
+}
+
+/*
+ * A function passed in from JavaScript is created with a single hold, which
+ * is dropped when the argument list containing it is freed.
+ */
+void
+v8plus_jsfunc_register(uint64_t f)
+{
+	v8plus_hold_bucket_t *vhbp;
+	v8plus_hold_ent_t *vhep;
+
+	if (v8plus_hold_lock(VHT_JSFUNC, f, &vhbp) != NULL) {
+		v8plus_panic("callback hash tag %llu registered twice",
+		    (unsigned long long)f);
+	}
+	vhep = v8plus_hold_create(vhbp, VHT_JSFUNC, f);
+	vhep->vhe_refs = 1;
+	v8plus_hold_unlock(vhbp);
+
+	if (f >= v8plus_loop_self()->vl_jsfunc_next)
+		v8plus_loop_self()->vl_jsfunc_next = f + 1;
+}
+
+/*
+ * The hold a function is created with lasts only as long as the call in
+ * which it was passed, so its handle must be made persistent by a hold
+ * placed on the event loop thread before other threads can hold it.
+ */
+void
+v8plus_jsfunc_hold(v8plus_jsfunc_t f)
+{
+	v8plus_loop_t *loop = v8plus_jsfunc_loop(f);
+	v8plus_hold_bucket_t *vhbp;
+	v8plus_hold_ent_t *vhep;
+	boolean_t persist = B_FALSE;
+
+	vhep = v8plus_hold_lock(VHT_JSFUNC, f, &vhbp);
+	if (vhep == NULL) {
+		v8plus_panic("callback hash tag %llu not found",
+		    (unsigned long long)f);
+	}
+	if (!vhep->vhe_persist && !vhep->vhe_dead) {
+		if (loop != _v8plus_loop) {
+			v8plus_panic("callback hash tag %llu must be held on "
+			    "its event loop thread before other threads may "
+			    "hold it", (unsigned long long)f);
+		}
+		vhep->vhe_persist = persist = B_TRUE;
+	}
+	++vhep->vhe_refs;
+	v8plus_hold_unlock(vhbp);
+
+	if (persist)
+		v8plus_jsfunc_persist(f);
+}
+
+void
+v8plus_jsfunc_rele(v8plus_jsfunc_t f)
+{
+	v8plus_loop_t *loop = v8plus_jsfunc_loop(f);
+	v8plus_async_call_t *vac;
+
+	if (!v8plus_hold_drop(VHT_JSFUNC, f))
+		return;
+
+	if (loop == _v8plus_loop) {
+		return (v8plus_jsfunc_unref(f));
+	}
+
+	if (v8plus_release_buffer(loop, ACT_JSFUNC_RELEASE, NULL, f))
+		return;
+
+	vac = calloc(1, sizeof (*vac));
+	if (vac == NULL)
+		v8plus_panic("could not allocate async call structure");
+
+	vac->vac_loop = loop;
+	vac->vac_type = ACT_JSFUNC_RELEASE;
+	vac->vac_flags = ACF_NOREPLY;
+	vac->vac_func = f;
+
+	(void) v8plus_cross_thread_call(vac);
+}
+
+void
+v8plus_jsfunc_rele_direct(v8plus_jsfunc_t f)
+{
+	if (v8plus_jsfunc_loop(f) != v8plus_loop_self()) {
+		v8plus_panic("callback hash tag %llu released off its event "
+		    "loop", (unsigned long long)f);
+	}
+
+	v8plus_jsfunc_rele(f);
+}
+
+/*
+ * A Buffer's handle is held and released exactly as a function's is.
+ */
+void
+v8plus_buffer_hold(const v8plus_buffer_t *bp)
+{
+	v8plus_jsfunc_hold(bp->vb_hdl);
+}
+
+void
+v8plus_buffer_rele(const v8plus_buffer_t *bp)
+{
+	v8plus_jsfunc_rele(bp->vb_hdl);
+}
+
+/*
+ * Process-wide initialisation, done the first time any loop is set up.
+ */
+static void
+v8plus_crossthread_init_once(void)
+{
+	uint_t i;
+	int err;
+
+	/*
+	 * We want error checking mutexes that do not allow recursive entry,
+	 * and which report failures due to inconsistent entry and exit.
+	 */
+	err = pthread_mutexattr_init(&_v8plus_mutexattr);
+	if (err != 0) {
+		v8plus_panic("unable to initialise mutex attributes: %s",
+		    strerror(err));
+	}
+	err = pthread_mutexattr_settype(&_v8plus_mutexattr,
+	    PTHREAD_MUTEX_ERRORCHECK);
+	if (err != 0) {
+		v8plus_panic("unable to set mutex attributes: %s",
+		    strerror(err));
+	}
+
+	for (i = 0; i < V8PLUS_COALESCE_BUCKETS; i++) {
+		err = pthread_mutex_init(&_v8plus_coalesce[i].vcb_mtx,
+		    &_v8plus_mutexattr);
+		if (err != 0) {
+			v8plus_panic("unable to initialise coalesce mutex: %s",
+			    strerror(err));
+		}
+		LIST_INIT(&_v8plus_coalesce[i].vcb_calls);
+	}
+
+	for (i = 0; i < V8PLUS_OBJREG_BUCKETS; i++) {
+		err = pthread_mutex_init(&_v8plus_objreg[i].vob_mtx,
+		    &_v8plus_mutexattr);
+		if (err != 0) {
+			v8plus_panic("unable to initialise object registry "
+			    "mutex: %s", strerror(err));
+		}
+		LIST_INIT(&_v8plus_objreg[i].vob_ents);
+	}
+
+	for (i = 0; i < V8PLUS_HOLD_BUCKETS; i++) {
+		err = pthread_mutex_init(&_v8plus_holds[i].vhb_mtx,
+		    &_v8plus_mutexattr);
+		if (err != 0) {
+			v8plus_panic("unable to initialise hold table "
+			    "mutex: %s", strerror(err));
+		}
+		LIST_INIT(&_v8plus_holds[i].vhb_ents);
+	}
+}
+
+/*
+ * Counter blocks are named arrays of counters and gauges in memory shared
+ * between C, which updates them atomically from any thread, and JavaScript,
+ * which reads them through a Float64Array over the same memory obtained
+ * from the v8plus_counters() function attached to every module.  Values are
+ * therefore stored as doubles, and additions are made by compare-and-swap
+ * on their bit patterns.  Each block begins on a cache line boundary and
+ * fills whole cache lines.  As JavaScript may hold a view of a block at any
+ * time, blocks are never freed.
+ */
+#define	V8PLUS_CACHE_LINE	64
+
+struct v8plus_counters {
+	char *vcn_name;
+	uint_t vcn_count;
+	volatile uint64_t *vcn_words;
+	struct v8plus_counters *vcn_next;
+};
+
+typedef union v8plus_counter_value {
+	double vcv_double;
+	uint64_t vcv_word;
+} v8plus_counter_value_t;
+
+static pthread_mutex_t _v8plus_counters_mtx = PTHREAD_MUTEX_INITIALIZER;
+static v8plus_counters_t *_v8plus_counters;
+
+static v8plus_counters_t *
+v8plus_counters_find(const char *name)
+{
+	v8plus_counters_t *vcnp;
+
+	for (vcnp = _v8plus_counters; vcnp != NULL; vcnp = vcnp->vcn_next) {
+		if (strcmp(vcnp->vcn_name, name) == 0)
+			break;
+	}
+
+	return (vcnp);
+}
+
+v8plus_counters_t *
+v8plus_counters_create(const char *name, uint_t count)
+{
+	v8plus_counters_t *vcnp;
+	size_t size;
+	void *words;
+	int err;
+
+	if (count == 0 ||
+	    count > (UINT_MAX - V8PLUS_CACHE_LINE) / sizeof (uint64_t)) {
+		(void) v8plus_error(V8PLUSERR_BADARG,
+		    "invalid counter count %u", count);
+		return (NULL);
+	}
+	size = (count * sizeof (uint64_t) + V8PLUS_CACHE_LINE - 1) &
+	    ~(size_t)(V8PLUS_CACHE_LINE - 1);
+
+	if ((err = pthread_mutex_lock(&_v8plus_counters_mtx)) != 0) {
+		v8plus_panic("could not lock counters mutex: %s",
+		    strerror(err));
+	}
+
+	if ((vcnp = v8plus_counters_find(name)) != NULL) {
+		if (vcnp->vcn_count != count) {
+			(void) v8plus_error(V8PLUSERR_BADARG,
+			    "counter block %s exists with %u counters",
+			    name, vcnp->vcn_count);
+			vcnp = NULL;
+		}
+	} else if ((vcnp = calloc(1, sizeof (*vcnp))) == NULL ||
+	    (vcnp->vcn_name = strdup(name)) == NULL ||
+	    posix_memalign(&words, V8PLUS_CACHE_LINE, size) != 0) {
+		if (vcnp != NULL) {
+			free(vcnp->vcn_name);
+			free(vcnp);
+			vcnp = NULL;
+		}
+		(void) v8plus_error(V8PLUSERR_NOMEM,
+		    "could not allocate counter block %s", name);
+	} else {
+		bzero(words, size);
+		vcnp->vcn_count = count;
+		vcnp->vcn_words = words;
+		vcnp->vcn_next = _v8plus_counters;
+		_v8plus_counters = vcnp;
+	}
+
+	if ((err = pthread_mutex_unlock(&_v8plus_counters_mtx)) != 0) {
+		v8plus_panic("could not unlock counters mutex: %s",
+		    strerror(err));
+	}
+
+	return (vcnp);
+}
+
+void *
+v8plus_counters_lookup(const char *name, uint_t *countp)
+{
+	v8plus_counters_t *vcnp;
+	int err;
+
+	if ((err = pthread_mutex_lock(&_v8plus_counters_mtx)) != 0) {
+		v8plus_panic("could not lock counters mutex: %s",
+		    strerror(err));
+	}
+	vcnp = v8plus_counters_find(name);
+	if ((err = pthread_mutex_unlock(&_v8plus_counters_mtx)) != 0) {
+		v8plus_panic("could not unlock counters mutex: %s",
+		    strerror(err));
+	}
+
+	if (vcnp == NULL)
+		return (NULL);
+
+	*countp = vcnp->vcn_count;
+
+	return ((void *)vcnp->vcn_words);
+}
+
+static volatile uint64_t *
+v8plus_counter_word(v8plus_counters_t *vcnp, uint_t i)
+{
+	if (i >= vcnp->vcn_count) {
+		v8plus_panic("counter %u out of range for block %s", i,
+		    vcnp->vcn_name);
+	}
+
+	return (&vcnp->vcn_words[i]);
+}
+
+void
+v8plus_counter_add(v8plus_counters_t *vcnp, uint_t i, double delta)
+{
+	volatile uint64_t *wp = v8plus_counter_word(vcnp, i);
+	v8plus_counter_value_t old, new;
+
+	do {
+		old.vcv_word = *wp;
+		new.vcv_double = old.vcv_double + delta;
+	} while (atomic_cas_64(wp, old.vcv_word, new.vcv_word) !=
+	    old.vcv_word);
+}
+
+void
+v8plus_counter_set(v8plus_counters_t *vcnp, uint_t i, double value)
+{
+	v8plus_counter_value_t v;
+
+	v.vcv_double = value;
+	(void) atomic_swap_64(v8plus_counter_word(vcnp, i), v.vcv_word);
+}
+
+double
+v8plus_counter_get(v8plus_counters_t *vcnp, uint_t i)
+{
+	v8plus_counter_value_t v;
+
+	v.vcv_word = *v8plus_counter_word(vcnp, i);
+
+	return (v.vcv_double);
+}
+
+/*
+ * Native timers run C callbacks on the event loop thread without involving
+ * JavaScript.  Rather than giving each timer its own libuv handle, each loop
+ * keeps its timers in a list ordered by due time and arms a single libuv
+ * timer for the first of them; when it fires, every timer then due is moved
+ * to a batch and run in order.  Timers started by those callbacks are never
+ * added to the batch being run, even if already due, so a callback that
+ * restarts itself cannot starve the loop.  Each timer holds the event loop
+ * from the time it is started until it is stopped or, for a one-shot timer,
+ * until its callback has returned.
+ */
+#define	VTF_PENDING	0x01	/* on vl_timers */
+#define	VTF_BATCHED	0x02	/* on vl_timer_batch */
+#define	VTF_RUNNING	0x04
+#define	VTF_STOPPED	0x08
+#define	VTF_HELD	0x10
+
+struct v8plus_timer {
+	v8plus_loop_t *vt_loop;
+	v8plus_timer_f vt_func;
+	void *vt_arg;
+	uint64_t vt_due;
+	uint64_t vt_repeat;
+	uint_t vt_flags;
+	TAILQ_ENTRY(v8plus_timer) vt_link;
+};
+
+/*
+ * Timers due at the same time run in the order in which they were started.
+ */
+static void
+v8plus_timer_insert(v8plus_loop_t *loop, v8plus_timer_t *tp)
+{
+	v8plus_timer_t *np;
+
+	TAILQ_FOREACH_REVERSE(np, &loop->vl_timers, v8plus_timerq, vt_link) {
+		if (np->vt_due <= tp->vt_due)
+			break;
+	}
+
+	if (np == NULL)
+		TAILQ_INSERT_HEAD(&loop->vl_timers, tp, vt_link);
+	else
+		TAILQ_INSERT_AFTER(&loop->vl_timers, np, tp, vt_link);
+
+	tp->vt_flags |= VTF_PENDING;
+}
+
+static void
+v8plus_timer_unhold(v8plus_timer_t *tp)
+{
+	if (tp->vt_flags & VTF_HELD) {
+		tp->vt_flags &= ~VTF_HELD;
+		v8plus_eventloop_rele_direct();
+	}
+}
+
+static void
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+v8plus_timer_callback(uv_timer_t *ut)
+#else
+v8plus_timer_callback(uv_timer_t *ut, int status __UNUSED)
+#endif
+{
+	v8plus_loop_t *loop = ut->data;
+	uint64_t now = uv_now(loop->vl_uv);
+	v8plus_timer_t *tp;
+
+	while ((tp = TAILQ_FIRST(&loop->vl_timers)) != NULL &&
+	    tp->vt_due <= now) {
+		TAILQ_REMOVE(&loop->vl_timers, tp, vt_link);
+		TAILQ_INSERT_TAIL(&loop->vl_timer_batch, tp, vt_link);
+		tp->vt_flags = (tp->vt_flags & ~VTF_PENDING) | VTF_BATCHED;
+	}
+
+	while ((tp = TAILQ_FIRST(&loop->vl_timer_batch)) != NULL) {
+		TAILQ_REMOVE(&loop->vl_timer_batch, tp, vt_link);
+		tp->vt_flags = (tp->vt_flags & ~VTF_BATCHED) | VTF_RUNNING;
+
+		tp->vt_func(tp, tp->vt_arg);
+
+		tp->vt_flags &= ~VTF_RUNNING;
+		if (tp->vt_flags & VTF_STOPPED) {
+			free(tp);
+		} else if (tp->vt_repeat == 0) {
+			v8plus_timer_unhold(tp);
+		} else {
+			/*
+			 * Repeating timers keep to their original schedule
+			 * unless they have fallen a whole period behind.
+			 */
+			tp->vt_due += tp->vt_repeat;
+			if (tp->vt_due <= now)
+				tp->vt_due = now + tp->vt_repeat;
+			v8plus_timer_insert(loop, tp);
+		}
+	}
+
+	if ((tp = TAILQ_FIRST(&loop->vl_timers)) != NULL) {
+		(void) uv_timer_start(ut, v8plus_timer_callback,
+		    tp->vt_due > now ? tp->vt_due - now : 0, 0);
+	}
+}
+
+static void
+v8plus_timer_arm(v8plus_loop_t *loop)
+{
+	v8plus_timer_t *tp = TAILQ_FIRST(&loop->vl_timers);
+	uint64_t now;
+
+	if (tp == NULL) {
+		(void) uv_timer_stop(&loop->vl_timer);
+		return;
+	}
+
+	now = uv_now(loop->vl_uv);
+	(void) uv_timer_start(&loop->vl_timer, v8plus_timer_callback,
+	    tp->vt_due > now ? tp->vt_due - now : 0, 0);
+}
+
+v8plus_timer_t *
+v8plus_timer_start(v8plus_timer_f func, void *arg, uint64_t timeout,
+    uint64_t repeat)
+{
+	v8plus_loop_t *loop = v8plus_loop_self();
+	v8plus_timer_t *tp;
+
+	if (func == NULL)
+		v8plus_panic("timer started without a callback");
+
+	if ((tp = calloc(1, sizeof (*tp))) == NULL) {
+		(void) v8plus_error(V8PLUSERR_NOMEM,
+		    "could not allocate timer");
+		return (NULL);
+	}
+
+	tp->vt_loop = loop;
+	tp->vt_func = func;
+	tp->vt_arg = arg;
+	tp->vt_due = uv_now(loop->vl_uv) + timeout;
+	tp->vt_repeat = repeat;
+	tp->vt_flags = VTF_HELD;
+	v8plus_eventloop_hold();
+
+	v8plus_timer_insert(loop, tp);
+	v8plus_timer_arm(loop);
+
+	return (tp);
+}
+
+void
+v8plus_timer_stop(v8plus_timer_t *tp)
+{
+	v8plus_loop_t *loop = tp->vt_loop;
+
+	if (loop != _v8plus_loop)
+		v8plus_panic("timer stopped off its event loop thread");
+	if (tp->vt_flags & VTF_STOPPED)
+		v8plus_panic("timer %p stopped twice", (void *)tp);
+
+	v8plus_timer_unhold(tp);
+
+	if (tp->vt_flags & VTF_RUNNING) {
+		/*
+		 * Stopped by its own callback; freed once that returns.
+		 */
+		tp->vt_flags |= VTF_STOPPED;
+		return;
+	}
+
+	if (tp->vt_flags & VTF_PENDING) {
+		TAILQ_REMOVE(&loop->vl_timers, tp, vt_link);
+		v8plus_timer_arm(loop);
+	} else if (tp->vt_flags & VTF_BATCHED) {
+		TAILQ_REMOVE(&loop->vl_timer_batch, tp, vt_link);
+	}
+
+	free(tp);
+}
+
+/*
+ * File descriptor watches run C callbacks on the event loop thread when a
+ * descriptor becomes readable or writable, by way of a libuv poll handle.
+ * As with any socket owned by the loop, an active watch keeps the loop
+ * running.  Closing a libuv handle completes asynchronously, so watches are
+ * freed only once that has happened.
+ */
+struct v8plus_fd_watch {
+	v8plus_loop_t *vfw_loop;
+	uv_poll_t vfw_poll;
+	int vfw_fd;
+	int vfw_events;
+	v8plus_fd_f vfw_func;
+	void *vfw_arg;
+	LIST_ENTRY(v8plus_fd_watch) vfw_entry;
+};
+
+static void
+v8plus_fd_poll_callback(uv_poll_t *up, int status, int events)
+{
+	v8plus_fd_watch_t *wp = up->data;
+	int vevents = 0;
+
+	if (status < 0) {
+		vevents = V8PLUS_FD_ERROR;
+	} else {
+		if (events & UV_READABLE)
+			vevents |= V8PLUS_FD_READABLE;
+		if (events & UV_WRITABLE)
+			vevents |= V8PLUS_FD_WRITABLE;
+	}
+
+	wp->vfw_func(wp, wp->vfw_fd, vevents, wp->vfw_arg);
+}
+
+static void
+v8plus_fd_close_callback(uv_handle_t *uh)
+{
+	free(uh->data);
+}
+
+static int
+v8plus_fd_poll(v8plus_fd_watch_t *wp, int events)
+{
+	int uevents = 0;
+	int err;
+
+	if (events & ~(V8PLUS_FD_READABLE | V8PLUS_FD_WRITABLE)) {
+		(void) v8plus_error(V8PLUSERR_BADARG,
+		    "invalid events 0x%x for fd %d", events, wp->vfw_fd);
+		return (-1);
+	}
+
+	if (events == 0) {
+		(void) uv_poll_stop(&wp->vfw_poll);
+		wp->vfw_events = 0;
+		return (0);
+	}
+
+	if (events & V8PLUS_FD_READABLE)
+		uevents |= UV_READABLE;
+	if (events & V8PLUS_FD_WRITABLE)
+		uevents |= UV_WRITABLE;
+
+	err = uv_poll_start(&wp->vfw_poll, uevents, v8plus_fd_poll_callback);
+	if (err != 0) {
+		(void) v8plus_error(V8PLUSERR_UNKNOWN,
+		    "unable to poll fd %d (code %d)", wp->vfw_fd, err);
+		return (-1);
+	}
+	wp->vfw_events = events;
+
+	return (0);
+}
+
+v8plus_fd_watch_t *
+v8plus_fd_watch(int fd, int events, v8plus_fd_f func, void *arg)
+{
+	v8plus_loop_t *loop = v8plus_loop_self();
+	v8plus_fd_watch_t *wp;
+	int err;
+
+	if (func == NULL)
+		v8plus_panic("fd %d watched without a callback", fd);
+
+	if ((wp = calloc(1, sizeof (*wp))) == NULL) {
+		(void) v8plus_error(V8PLUSERR_NOMEM,
+		    "could not allocate watch for fd %d", fd);
+		return (NULL);
+	}
+
+	wp->vfw_loop = loop;
+	wp->vfw_fd = fd;
+	wp->vfw_func = func;
+	wp->vfw_arg = arg;
+
+	if ((err = uv_poll_init(loop->vl_uv, &wp->vfw_poll, fd)) != 0) {
+		free(wp);
+		(void) v8plus_error(V8PLUSERR_UNKNOWN,
+		    "unable to watch fd %d (code %d)", fd, err);
+		return (NULL);
+	}
+	wp->vfw_poll.data = wp;
+
+	if (v8plus_fd_poll(wp, events) != 0) {
+		uv_close((uv_handle_t *)&wp->vfw_poll,
+		    v8plus_fd_close_callback);
+		return (NULL);
+	}
+	LIST_INSERT_HEAD(&loop->vl_fd_watches, wp, vfw_entry);
+
+	return (wp);
+}
+
+int
+v8plus_fd_watch_events(v8plus_fd_watch_t *wp, int events)
+{
+	if (wp->vfw_loop != _v8plus_loop)
+		v8plus_panic("fd %d watch changed off its event loop thread",
+		    wp->vfw_fd);
+
+	if (events == wp->vfw_events)
+		return (0);
+
+	return (v8plus_fd_poll(wp, events));
+}
+
+void
+v8plus_fd_unwatch(v8plus_fd_watch_t *wp)
+{
+	if (wp->vfw_loop != _v8plus_loop)
+		v8plus_panic("fd %d unwatched off its event loop thread",
+		    wp->vfw_fd);
+
+	LIST_REMOVE(wp, vfw_entry);
+	(void) uv_poll_stop(&wp->vfw_poll);
+	uv_close((uv_handle_t *)&wp->vfw_poll, v8plus_fd_close_callback);
+}
+
+/*
+ * Incremental jobs break work that must run on the event loop thread into
+ * steps, running each job's steps for at most its time slice on every turn
+ * of the loop so that I/O and other callbacks are handled in between.  The
+ * steps are run from a check handle, just after the loop has polled for
+ * I/O; while there are jobs, an idle handle, which does nothing itself,
+ * keeps the loop from blocking in that poll and keeps it running.
+ */
+#define	V8PLUS_INCREMENTAL_SLICE_USEC	1000
+
+struct v8plus_incremental {
+	void *vi_obj;
+	void *vi_ctx;
+	v8plus_step_f vi_step;
+	v8plus_step_done_f vi_done;
+	uint64_t vi_slice_ns;
+	TAILQ_ENTRY(v8plus_incremental) vi_link;
+};
+
+static void
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+v8plus_incremental_idle(uv_idle_t *ui __UNUSED)
+#else
+v8plus_incremental_idle(uv_idle_t *ui __UNUSED, int status __UNUSED)
+#endif
+{
+}
+
+static void
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+v8plus_incremental_check(uv_check_t *uc)
+#else
+v8plus_incremental_check(uv_check_t *uc, int status __UNUSED)
+#endif
+{
+	v8plus_loop_t *loop = uc->data;
+	v8plus_incremental_t *vip, *next, *last;
+	boolean_t done;
+	uint64_t t0;
+
+	/*
+	 * Jobs started by these steps or completions are appended to the
+	 * list and wait for the next turn; only the job being run is ever
+	 * removed, so the next one remains valid.
+	 */
+	last = TAILQ_LAST(&loop->vl_incrs, v8plus_incrq);
+	for (vip = TAILQ_FIRST(&loop->vl_incrs); vip != NULL; vip = next) {
+		next = (vip == last) ? NULL : TAILQ_NEXT(vip, vi_link);
+
+		t0 = uv_hrtime();
+		do {
+			done = vip->vi_step(vip->vi_obj, vip->vi_ctx);
+		} while (!done && uv_hrtime() - t0 < vip->vi_slice_ns);
+
+		if (!done)
+			continue;
+
+		TAILQ_REMOVE(&loop->vl_incrs, vip, vi_link);
+		if (vip->vi_done != NULL)
+			vip->vi_done(vip->vi_obj, vip->vi_ctx);
+		if (vip->vi_obj != NULL)
+			v8plus_obj_rele(vip->vi_obj);
+		free(vip);
+	}
+
+	if (TAILQ_EMPTY(&loop->vl_incrs)) {
+		(void) uv_idle_stop(&loop->vl_incr_idle);
+		(void) uv_check_stop(&loop->vl_incr_check);
+	}
+}
+
+void
+v8plus_incremental(void *cop, void *ctxp, v8plus_step_f step,
+    v8plus_step_done_f done, uint_t slice_usec)
+{
+	v8plus_loop_t *loop = v8plus_loop_self();
+	v8plus_incremental_t *vip;
+
+	if (step == NULL)
+		v8plus_panic("incremental job started without a step function");
+
+	if ((vip = calloc(1, sizeof (*vip))) == NULL)
+		v8plus_panic("could not allocate incremental job");
+
+	if (cop != NULL) {
+		v8plus_obj_hold(cop);
+		vip->vi_obj = cop;
+	}
+	vip->vi_ctx = ctxp;
+	vip->vi_step = step;
+	vip->vi_done = done;
+	vip->vi_slice_ns = (uint64_t)(slice_usec != 0 ? slice_usec :
+	    V8PLUS_INCREMENTAL_SLICE_USEC) * 1000;
+
+	if (TAILQ_EMPTY(&loop->vl_incrs)) {
+		(void) uv_idle_start(&loop->vl_incr_idle,
+		    v8plus_incremental_idle);
+		(void) uv_check_start(&loop->vl_incr_check,
+		    v8plus_incremental_check);
+	}
+	TAILQ_INSERT_TAIL(&loop->vl_incrs, vip, vi_link);
+}
+
+/*
+ * Find a slot for a new loop, taking over the structure left in the first
+ * free one by a loop that has exited, or else allocating one.  The loop is
+ * published already marked as exited, so that nobody can queue work for it
+ * until it has been set up.
+ */
+static v8plus_loop_t *
+v8plus_loop_alloc(void)
+{
+	v8plus_loop_t *loop = NULL;
+	uint_t i;
+	int err;
+
+	if ((err = pthread_mutex_lock(&_v8plus_loops_mtx)) != 0)
+		v8plus_panic("could not lock loop table: %s", strerror(err));
 
-	return (vac->vac_return);
-}
+	for (i = 0; i < _v8plus_nloops; i++) {
+		if (_v8plus_loops[i]->vl_free) {
+			loop = _v8plus_loops[i];
+			loop->vl_free = B_FALSE;
+			break;
+		}
+	}
 
-nvlist_t *
-v8plus_method_call(void *cop, const char *name, const nvlist_t *lp)
-{
-	v8plus_async_call_t vac;
+	if (loop == NULL) {
+		if (_v8plus_nloops == V8PLUS_MAX_LOOPS)
+			v8plus_panic("too many event loops");
+		if ((loop = calloc(1, sizeof (*loop))) == NULL)
+			v8plus_panic("unable to allocate event loop state");
+
+		loop->vl_id = _v8plus_nloops;
+		loop->vl_exited = B_TRUE;
+		loop->vl_jsfunc_next = (uint64_t)loop->vl_id <<
+		    V8PLUS_JSFUNC_LOOP_SHIFT;
+		LIST_INIT(&loop->vl_relbufs);
+		err = pthread_mutex_init(&loop->vl_relbuf_mtx,
+		    &_v8plus_mutexattr);
+		if (err != 0) {
+			v8plus_panic("unable to initialise release buffer "
+			    "mutex: %s", strerror(err));
+		}
+		err = pthread_mutex_init(&loop->vl_deferred_mtx,
+		    &_v8plus_mutexattr);
+		if (err != 0) {
+			v8plus_panic("unable to initialise deferred work "
+			    "mutex: %s", strerror(err));
+		}
+		if ((err = pthread_cond_init(&loop->vl_deferred_cv,
+		    NULL)) != 0) {
+			v8plus_panic("unable to initialise deferred work "
+			    "condvar: %s", strerror(err));
+		}
 
-	if (v8plus_in_event_thread() == B_TRUE) {
-		/*
-		 * We're running in the event loop thread, so we can make the
-		 * call directly.
-		 */
-		return (v8plus_method_call_direct(cop, name, lp));
+		_v8plus_loops[loop->vl_id] = loop;
+		membar_producer();
+		_v8plus_nloops++;
 	}
 
-	bzero(&vac, sizeof (vac));
-	vac.vac_type = ACT_OBJECT_CALL;
-	vac.vac_cop = cop;
-	vac.vac_name = name;
-	vac.vac_lp = lp;
+	if ((err = pthread_mutex_unlock(&_v8plus_loops_mtx)) != 0)
+		v8plus_panic("could not unlock loop table: %s", strerror(err));
 
-	return (v8plus_cross_thread_call(&vac));
+	return (loop);
 }
 
-nvlist_t *
-v8plus_call(v8plus_jsfunc_t func, const nvlist_t *lp)
+/*
+ * Initialise structures for off-event-loop method calls to the given loop,
+ * which is run by the calling thread.  This is done for each module loaded
+ * into each loop (that is, into the main thread and into each worker
+ * thread), but only the first sets the loop up.
+ *
+ * Note that uv_async_init() must be called inside the libuv event loop, so we
+ * do it here.  We also record that this thread runs the loop so as to
+ * determine what kind of method calls to make later.
+ */
+void
+v8plus_crossthread_init(uv_loop_t *uv)
 {
-	v8plus_async_call_t vac;
+	v8plus_loop_t *loop;
+	uint_t i;
+	int err;
 
-	if (v8plus_in_event_thread() == B_TRUE) {
-		/*
-		 * We're running in the event loop thread, so we can make the
-		 * call directly.
-		 */
-		return (v8plus_call_direct(func, lp));
+	if ((err = pthread_once(&_v8plus_init_once,
+	    v8plus_crossthread_init_once)) != 0)
+		v8plus_panic("unable to initialise v8plus: %s", strerror(err));
+
+	v8plus_nva_init();
+
+	if (_v8plus_loop != NULL) {
+		if (_v8plus_loop->vl_uv != uv)
+			v8plus_panic("thread is running a second event loop");
+		_v8plus_loop->vl_modules++;
+		return;
 	}
 
-	bzero(&vac, sizeof (vac));
-	vac.vac_type = ACT_JSFUNC_CALL;
-	vac.vac_func = func;
-	vac.vac_lp = lp;
+	loop = v8plus_loop_alloc();
 
-	return (v8plus_cross_thread_call(&vac));
-}
+	/*
+	 * Everything but the release buffers, which may still belong to
+	 * other threads, starts afresh, even in a structure that has been
+	 * used before.
+	 */
+	loop->vl_uv = uv;
+	loop->vl_thread = pthread_self();
+	loop->vl_modules = 1;
+	loop->vl_jsfunc_first = loop->vl_jsfunc_next;
+	loop->vl_eventloop_refcount = 0;
+	for (i = 0; i < V8PLUS_LANE_COUNT; i++)
+		STAILQ_INIT(&loop->vl_callqs[i].vcq_runq);
+	STAILQ_INIT(&loop->vl_release_deferq);
+	LIST_INIT(&loop->vl_channels);
+	TAILQ_INIT(&loop->vl_timers);
+	TAILQ_INIT(&loop->vl_timer_batch);
+	TAILQ_INIT(&loop->vl_incrs);
+	LIST_INIT(&loop->vl_fd_watches);
+	loop->vl_relbuf_pending = 1;
+	loop->vl_chan_pending = 0;
+	loop->vl_chan_flushing = B_FALSE;
+	loop->vl_drain_lane = V8PLUS_LANE_COUNT - 1;
+	loop->vl_drain_credit = 0;
+	bcopy(_v8plus_lane_weights, loop->vl_lane_weights,
+	    sizeof (loop->vl_lane_weights));
+	loop->vl_drain_policy = V8PLUS_DRAIN_ITEMS;
+	loop->vl_drain_max_items = V8PLUS_DRAIN_DEF_ITEMS;
+	loop->vl_drain_max_ns = V8PLUS_DRAIN_DEF_USEC * 1000ULL;
+	loop->vl_drain_adaptive_items = loop->vl_drain_max_items;
+	loop->vl_drain_item_ns = 0;
+	bzero(&loop->vl_drain_stats, sizeof (loop->vl_drain_stats));
+	bzero(loop->vl_call_kind_stats, sizeof (loop->vl_call_kind_stats));
+
+	err = uv_async_init(uv, &loop->vl_async, v8plus_async_callback);
+	if (err != 0) {
+		v8plus_panic("unable to initialise uv_async_t (code %d)", err);
+	}
+	loop->vl_async.data = loop;
 
-void
-v8plus_obj_rele(const void *cop)
-{
-	v8plus_async_call_t *vac;
+	/*
+	 * If we do not unreference the async handle, then its mere
+	 * existence will keep the event loop open forever.  If the consumer
+	 * _wants_ this behaviour, they may call v8plus_eventloop_hold()
+	 * from the event loop thread.
+	 */
+	uv_unref((uv_handle_t *)&loop->vl_async);
 
-	if (v8plus_in_event_thread() == B_TRUE) {
-		return (v8plus_obj_rele_direct(cop));
+	/*
+	 * Likewise the timer handle; each native timer instead holds the
+	 * event loop while it is active.
+	 */
+	err = uv_timer_init(uv, &loop->vl_timer);
+	if (err != 0) {
+		v8plus_panic("unable to initialise uv_timer_t (code %d)", err);
 	}
+	loop->vl_timer.data = loop;
+	uv_unref((uv_handle_t *)&loop->vl_timer);
 
-	vac = calloc(1, sizeof (*vac));
-	if (vac == NULL)
-		v8plus_panic("could not allocate async call structure");
+	/*
+	 * The idle handle runs only while there are incremental jobs, which
+	 * it keeps the event loop running to complete.
+	 */
+	err = uv_idle_init(uv, &loop->vl_incr_idle);
+	if (err != 0) {
+		v8plus_panic("unable to initialise uv_idle_t (code %d)", err);
+	}
+	loop->vl_incr_idle.data = loop;
+	err = uv_check_init(uv, &loop->vl_incr_check);
+	if (err != 0) {
+		v8plus_panic("unable to initialise uv_check_t (code %d)", err);
+	}
+	loop->vl_incr_check.data = loop;
+	uv_unref((uv_handle_t *)&loop->vl_incr_check);
 
-	vac->vac_type = ACT_OBJECT_RELEASE;
-	vac->vac_flags = ACF_NOREPLY;
-	vac->vac_cop = (void *)cop;
+	/*
+	 * The loop must be fully set up before other threads can use it.
+	 */
+	membar_producer();
+	loop->vl_exited = B_FALSE;
 
-	(void) v8plus_cross_thread_call(vac);
+	_v8plus_loop = loop;
 }
 
-void
-v8plus_jsfunc_rele(v8plus_jsfunc_t f)
+/*
+ * Mark the holds on a loop's objects and functions as dead, so that whoever
+ * drops them later does not try to send releases to the loop.
+ */
+static void
+v8plus_hold_exit(v8plus_loop_t *loop)
 {
-	v8plus_async_call_t *vac;
+	v8plus_hold_bucket_t *vhbp;
+	v8plus_hold_ent_t *vhep;
+	v8plus_loop_t *owner;
+	uint_t i;
+	int err;
 
-	if (v8plus_in_event_thread() == B_TRUE) {
-		return (v8plus_jsfunc_rele_direct(f));
+	for (i = 0; i < V8PLUS_HOLD_BUCKETS; i++) {
+		vhbp = &_v8plus_holds[i];
+		if ((err = pthread_mutex_lock(&vhbp->vhb_mtx)) != 0) {
+			v8plus_panic("could not lock hold table mutex: %s",
+			    strerror(err));
+		}
+		LIST_FOREACH(vhep, &vhbp->vhb_ents, vhe_entry) {
+			if (vhep->vhe_type == VHT_JSFUNC) {
+				owner = _v8plus_loops[vhep->vhe_key >>
+				    V8PLUS_JSFUNC_LOOP_SHIFT];
+			} else {
+				owner = v8plus_obj_loop(
+				    (const void *)(uintptr_t)vhep->vhe_key);
+			}
+			if (owner == loop)
+				vhep->vhe_dead = B_TRUE;
+		}
+		v8plus_hold_unlock(vhbp);
 	}
+}
 
-	vac = calloc(1, sizeof (*vac));
-	if (vac == NULL)
-		v8plus_panic("could not allocate async call structure");
+/*
+ * Once all four of a loop's own handles have closed, its slot may be reused.
+ */
+static void
+v8plus_loop_close_callback(uv_handle_t *uh)
+{
+	v8plus_loop_t *loop = uh->data;
+	int err;
 
-	vac->vac_type = ACT_JSFUNC_RELEASE;
-	vac->vac_flags = ACF_NOREPLY;
-	vac->vac_func = f;
+	if (--loop->vl_closing > 0)
+		return;
 
-	(void) v8plus_cross_thread_call(vac);
+	if ((err = pthread_mutex_lock(&_v8plus_loops_mtx)) != 0)
+		v8plus_panic("could not lock loop table: %s", strerror(err));
+	loop->vl_free = B_TRUE;
+	if ((err = pthread_mutex_unlock(&_v8plus_loops_mtx)) != 0)
+		v8plus_panic("could not unlock loop table: %s", strerror(err));
 }
 
 /*
- * Initialise structures for off-event-loop method calls.
- *
- * Note that uv_async_init() must be called inside the libuv event loop, so we
- * do it here.  We also want to record the thread ID of the Event Loop thread
- * so as to determine what kind of method calls to make later.
+ * Undo v8plus_crossthread_init() for one of the modules loaded into this
+ * thread's loop; this is called as the environment running the loop is torn
+ * down.  When the last module goes, the loop exits.  Other threads can no
+ * longer queue work for it, and anything they have already queued is
+ * cancelled.  Deferred work still running is waited for, but its completion
+ * is never called.  The consumer's destructor is run for each object still
+ * alive, after which whatever timers, watches, jobs and channels remain are
+ * closed without their callbacks being called.  Finally the loop's handles
+ * are closed, and its slot is freed once they have.
  */
 void
-v8plus_crossthread_init(void)
+v8plus_crossthread_fini(void)
 {
+	v8plus_loop_t *loop = v8plus_loop_self();
+	v8plus_async_call_t *vac;
+	v8plus_incremental_t *vip;
+	v8plus_fd_watch_t *wp;
+	v8plus_channel_t *ch;
+	v8plus_timer_t *tp;
+	uint_t i;
 	int err;
 
-	if (atomic_swap_uint(&init_done, 1) != 0)
+	if (--loop->vl_modules > 0)
 		return;
 
-	(void) nv_alloc_init(&_v8plus_nva, nv_fixed_ops,
-	    _v8plus_exception_buf, sizeof (_v8plus_exception_buf));
+	loop->vl_exited = B_TRUE;
+	membar_enter();
+	while (loop->vl_users != 0)
+		(void) sched_yield();
 
 	/*
-	 * We want error checking mutexes that do not allow recursive entry,
-	 * and which report failures due to inconsistent entry and exit.
+	 * Cancelling queued calls first releases any deferred workers
+	 * waiting for them, so that we can then wait for the workers.
 	 */
-	err = pthread_mutexattr_init(&_v8plus_mutexattr);
-	if (err != 0) {
-		v8plus_panic("unable to initialise mutex attributes: %s",
+	for (i = 0; i < V8PLUS_LANE_COUNT; i++) {
+		(void) v8plus_callq_take(&loop->vl_callqs[i]);
+		while ((vac = STAILQ_FIRST(&loop->vl_callqs[i].vcq_runq)) !=
+		    NULL) {
+			STAILQ_REMOVE_HEAD(&loop->vl_callqs[i].vcq_runq,
+			    vac_callq_entry);
+			v8plus_async_call_abandon(vac);
+		}
+	}
+	while ((vac = STAILQ_FIRST(&loop->vl_release_deferq)) != NULL) {
+		STAILQ_REMOVE_HEAD(&loop->vl_release_deferq, vac_callq_entry);
+		v8plus_async_call_abandon(vac);
+	}
+
+	if ((err = pthread_mutex_lock(&loop->vl_deferred_mtx)) != 0) {
+		v8plus_panic("could not lock deferred work mutex: %s",
 		    strerror(err));
 	}
-	err = pthread_mutexattr_settype(&_v8plus_mutexattr,
-	    PTHREAD_MUTEX_ERRORCHECK);
-	if (err != 0) {
-		v8plus_panic("unable to set mutex attributes: %s",
+	while (loop->vl_deferred != 0) {
+		err = pthread_cond_wait(&loop->vl_deferred_cv,
+		    &loop->vl_deferred_mtx);
+		if (err != 0) {
+			v8plus_panic("could not wait for deferred work: %s",
+			    strerror(err));
+		}
+	}
+	if ((err = pthread_mutex_unlock(&loop->vl_deferred_mtx)) != 0) {
+		v8plus_panic("could not unlock deferred work mutex: %s",
 		    strerror(err));
 	}
 
-	_v8plus_uv_event_thread = pthread_self();
-	err = uv_async_init(uv_default_loop(), &_v8plus_uv_async,
-	    v8plus_async_callback);
-	if (err != 0) {
-		v8plus_panic("unable to initialise uv_async_t (code %d)", err);
+	/*
+	 * Buffered releases are discarded along with the objects and
+	 * functions they refer to.
+	 */
+	loop->vl_relbuf_pending = 1;
+	v8plus_release_take(loop);
+	free(loop->vl_rels);
+	loop->vl_rels = NULL;
+	loop->vl_nrels = 0;
+	loop->vl_maxrels = 0;
+
+	v8plus_hold_exit(loop);
+	v8plus_obj_fini();
+
+	while ((tp = TAILQ_FIRST(&loop->vl_timers)) != NULL) {
+		TAILQ_REMOVE(&loop->vl_timers, tp, vt_link);
+		free(tp);
 	}
-	err = pthread_mutex_init(&_v8plus_callq_mtx, &_v8plus_mutexattr);
-	if (err != 0) {
-		v8plus_panic("unable to initialise mutex: %s", strerror(err));
+	while ((tp = TAILQ_FIRST(&loop->vl_timer_batch)) != NULL) {
+		TAILQ_REMOVE(&loop->vl_timer_batch, tp, vt_link);
+		free(tp);
+	}
+
+	while ((vip = TAILQ_FIRST(&loop->vl_incrs)) != NULL) {
+		TAILQ_REMOVE(&loop->vl_incrs, vip, vi_link);
+		if (vip->vi_obj != NULL)
+			v8plus_obj_rele(vip->vi_obj);
+		free(vip);
+	}
+
+	while ((wp = LIST_FIRST(&loop->vl_fd_watches)) != NULL) {
+		LIST_REMOVE(wp, vfw_entry);
+		(void) uv_poll_stop(&wp->vfw_poll);
+		uv_close((uv_handle_t *)&wp->vfw_poll,
+		    v8plus_fd_close_callback);
 	}
 
 	/*
-	 * If we do not unreference the async handle, then its mere
-	 * existence will keep the event loop open forever.  If the consumer
-	 * _wants_ this behaviour, they may call v8plus_eventloop_hold()
-	 * from the event loop thread.
+	 * Writers may still have open channels, so these are closed to
+	 * them but not freed.
 	 */
-	uv_unref((uv_handle_t *)&_v8plus_uv_async);
+	while ((ch = LIST_FIRST(&loop->vl_channels)) != NULL) {
+		LIST_REMOVE(ch, vch_entry);
+		ch->vch_closed = B_TRUE;
+		v8plus_jsfunc_rele(ch->vch_func);
+	}
+
+	v8plus_jsfunc_fini();
+
+	loop->vl_closing = 4;
+	uv_close((uv_handle_t *)&loop->vl_async, v8plus_loop_close_callback);
+	uv_close((uv_handle_t *)&loop->vl_timer, v8plus_loop_close_callback);
+	uv_close((uv_handle_t *)&loop->vl_incr_idle,
+	    v8plus_loop_close_callback);
+	uv_close((uv_handle_t *)&loop->vl_incr_check,
+	    v8plus_loop_close_callback);
+
+	_v8plus_loop = NULL;
 }
 
+/*
+ * An event loop thread always holds its own loop, just as
+ * v8plus_eventloop_rele_direct() always releases it.  As with objects and
+ * functions, another thread may add to a loop's holds only while it is
+ * already held; such a thread holds the loop on whose behalf it is working,
+ * or failing that the first.
+ */
 void
 v8plus_eventloop_hold(void)
 {
-	++_v8plus_eventloop_refcount;
-	uv_ref((uv_handle_t *)&_v8plus_uv_async);
+	v8plus_loop_t *loop;
+	uint_t old;
+
+	if (v8plus_in_event_thread()) {
+		loop = v8plus_loop_self();
+		if (atomic_inc_uint_nv(&loop->vl_eventloop_refcount) == 1)
+			uv_ref((uv_handle_t *)&loop->vl_async);
+		return;
+	}
+
+	loop = v8plus_loop_default();
+	do {
+		if ((old = loop->vl_eventloop_refcount) == 0) {
+			v8plus_panic("event loop must be held on its own "
+			    "thread before other threads may hold it");
+		}
+	} while (atomic_cas_uint(&loop->vl_eventloop_refcount, old,
+	    old + 1) != old);
+}
+
+/*
+ * Drops a hold on the event loop, returning the number of holds there were.
+ * Unbalanced releases are ignored.
+ */
+static uint_t
+v8plus_eventloop_drop(v8plus_loop_t *loop)
+{
+	uint_t old;
+
+	do {
+		if ((old = loop->vl_eventloop_refcount) == 0)
+			break;
+	} while (atomic_cas_uint(&loop->vl_eventloop_refcount, old,
+	    old - 1) != old);
+
+	return (old);
 }
 
 void
 v8plus_eventloop_rele_direct(void)
 {
-	if (--_v8plus_eventloop_refcount < 1) {
-		_v8plus_eventloop_refcount = 0;
-		uv_unref((uv_handle_t *)&_v8plus_uv_async);
-	}
+	v8plus_loop_t *loop = v8plus_loop_self();
+
+	if (v8plus_eventloop_drop(loop) <= 1)
+		uv_unref((uv_handle_t *)&loop->vl_async);
 }
 
 void
 v8plus_eventloop_rele(void)
 {
+	v8plus_loop_t *loop;
 	v8plus_async_call_t *vac;
 
 	if (v8plus_in_event_thread() == B_TRUE) {
 		return (v8plus_eventloop_rele_direct());
 	}
 
+	loop = v8plus_loop_default();
+	if (v8plus_eventloop_drop(loop) != 1)
+		return;
+
+	if (v8plus_release_buffer(loop, ACT_EVENTLOOP_RELEASE, NULL, 0))
+		return;
+
 	vac = calloc(1, sizeof (*vac));
 	if (vac == NULL)
 		v8plus_panic("could not allocate async call structure");
 
+	vac->vac_loop = loop;
 	vac->vac_type = ACT_EVENTLOOP_RELEASE;
 	vac->vac_flags = ACF_NOREPLY;
 
@@ -610,19 +5322,78 @@ v8plus_typeof(const nvpair_t *pp)
 	{
 		uint64_t *vp;
 		uint_t nv;
-		if (nvpair_value_uint64_array((nvpair_t *)pp, &vp, &nv) != 0 ||
-		    nv != 1) {
+		if (nvpair_value_uint64_array((nvpair_t *)pp, &vp, &nv) != 0)
+			return (V8PLUS_TYPE_INVALID);
+		if (nv == V8PLUS_BUFFER_NVALS)
+			return (V8PLUS_TYPE_BUFFER);
+		if (nv != 1)
 			return (V8PLUS_TYPE_INVALID);
-		}
 		return (V8PLUS_TYPE_JSFUNC);
 	}
+	case DATA_TYPE_INT64_ARRAY:
+		return (V8PLUS_TYPE_NUMBER_ARRAY);
+	case DATA_TYPE_BOOLEAN_ARRAY:
+		return (V8PLUS_TYPE_BOOLEAN_ARRAY);
+	case DATA_TYPE_STRING_ARRAY:
+		return (V8PLUS_TYPE_STRING_ARRAY);
+	case DATA_TYPE_INT8_ARRAY:
+		return (V8PLUS_TYPE_INT8_ARRAY);
+	case DATA_TYPE_UINT8_ARRAY:
+		return (V8PLUS_TYPE_UINT8_ARRAY);
+	case DATA_TYPE_INT16_ARRAY:
+		return (V8PLUS_TYPE_INT16_ARRAY);
+	case DATA_TYPE_UINT16_ARRAY:
+		return (V8PLUS_TYPE_UINT16_ARRAY);
+	case DATA_TYPE_INT32_ARRAY:
+		return (V8PLUS_TYPE_INT32_ARRAY);
+	case DATA_TYPE_UINT32_ARRAY:
+		return (V8PLUS_TYPE_UINT32_ARRAY);
 	default:
 		return (V8PLUS_TYPE_INVALID);
 	}
 }
 
+/*
+ * Array types are passed as a pointer to the elements and a count, and so
+ * take two arguments to v8plus_args() and v8plus_obj() where others take one.
+ */
+static boolean_t
+v8plus_type_is_array(v8plus_type_t t)
+{
+	switch (t) {
+	case V8PLUS_TYPE_NUMBER_ARRAY:
+	case V8PLUS_TYPE_BOOLEAN_ARRAY:
+	case V8PLUS_TYPE_STRING_ARRAY:
+	case V8PLUS_TYPE_INT8_ARRAY:
+	case V8PLUS_TYPE_UINT8_ARRAY:
+	case V8PLUS_TYPE_INT16_ARRAY:
+	case V8PLUS_TYPE_UINT16_ARRAY:
+	case V8PLUS_TYPE_INT32_ARRAY:
+	case V8PLUS_TYPE_UINT32_ARRAY:
+		return (B_TRUE);
+	default:
+		return (B_FALSE);
+	}
+}
+
+#define	ARG_ARRAY_VALUE(_pp, _dt, _at, _ct, _nt, _vp, _np)		\
+	do {								\
+		if ((_dt) != DATA_TYPE_##_at##_ARRAY)			\
+			return (-1);					\
+		if ((_vp) != NULL) {					\
+			(void) nvpair_value_##_nt##_array((nvpair_t *)(_pp), \
+			    (_ct **)(_vp), (_np));			\
+		}							\
+		return (0);						\
+	} while (0)
+
+/*
+ * Number arrays are stored as int64 arrays holding the numbers' bit
+ * patterns, as libnvpair has no array of doubles; the elements are returned
+ * in place.
+ */
 static int
-v8plus_arg_value(v8plus_type_t t, const nvpair_t *pp, void *vp)
+v8plus_arg_value(v8plus_type_t t, const nvpair_t *pp, void *vp, uint_t *np)
 {
 	data_type_t dt = nvpair_type((nvpair_t *)pp);
 
@@ -712,17 +5483,49 @@ v8plus_arg_value(v8plus_type_t t, const nvpair_t *pp, void *vp)
 			return (0);
 		}
 		return (-1);
+	case V8PLUS_TYPE_BUFFER:
+		if (dt == DATA_TYPE_UINT64_ARRAY) {
+			v8plus_buffer_t vb;
+
+			if (nvpair_value_v8plus_buffer(pp, &vb) == 0) {
+				if (vp != NULL)
+					*(v8plus_buffer_t *)vp = vb;
+				return (0);
+			}
+		}
+		return (-1);
+	case V8PLUS_TYPE_NUMBER_ARRAY:
+		ARG_ARRAY_VALUE(pp, dt, INT64, int64_t, int64, vp, np);
+	case V8PLUS_TYPE_BOOLEAN_ARRAY:
+		ARG_ARRAY_VALUE(pp, dt, BOOLEAN, boolean_t, boolean, vp, np);
+	case V8PLUS_TYPE_STRING_ARRAY:
+		ARG_ARRAY_VALUE(pp, dt, STRING, char *, string, vp, np);
+	case V8PLUS_TYPE_INT8_ARRAY:
+		ARG_ARRAY_VALUE(pp, dt, INT8, int8_t, int8, vp, np);
+	case V8PLUS_TYPE_UINT8_ARRAY:
+		ARG_ARRAY_VALUE(pp, dt, UINT8, uint8_t, uint8, vp, np);
+	case V8PLUS_TYPE_INT16_ARRAY:
+		ARG_ARRAY_VALUE(pp, dt, INT16, int16_t, int16, vp, np);
+	case V8PLUS_TYPE_UINT16_ARRAY:
+		ARG_ARRAY_VALUE(pp, dt, UINT16, uint16_t, uint16, vp, np);
+	case V8PLUS_TYPE_INT32_ARRAY:
+		ARG_ARRAY_VALUE(pp, dt, INT32, int32_t, int32, vp, np);
+	case V8PLUS_TYPE_UINT32_ARRAY:
+		ARG_ARRAY_VALUE(pp, dt, UINT32, uint32_t, uint32, vp, np);
 	default:
 		return (-1);
 	}
 }
 
+#undef	ARG_ARRAY_VALUE
+
 int
 v8plus_args(const nvlist_t *lp, uint_t flags, v8plus_type_t t, ...)
 {
 	v8plus_type_t nt;
 	nvpair_t *pp;
 	void *vp;
+	uint_t *np;
 	va_list ap;
 	uint_t i;
 	char buf[32];
@@ -736,6 +5539,8 @@ v8plus_args(const nvlist_t *lp, uint_t flags, v8plus_type_t t, ...)
 			break;
 		default:
 			(void) va_arg(ap, void *);
+			if (v8plus_type_is_array(nt))
+				(void) va_arg(ap, uint_t *);
 		}
 
 		(void) snprintf(buf, sizeof (buf), "%u", i);
@@ -745,7 +5550,7 @@ v8plus_args(const nvlist_t *lp, uint_t flags, v8plus_type_t t, ...)
 			return (-1);
 		}
 
-		if (v8plus_arg_value(nt, pp, NULL) != 0) {
+		if (v8plus_arg_value(nt, pp, NULL, NULL) != 0) {
 			(void) v8plus_error(V8PLUSERR_BADARG,
 			    "argument %u is of incorrect type", i);
 			return (-1);
@@ -772,14 +5577,17 @@ v8plus_args(const nvlist_t *lp, uint_t flags, v8plus_type_t t, ...)
 		case V8PLUS_TYPE_UNDEFINED:
 		case V8PLUS_TYPE_NULL:
 			vp = NULL;
+			np = NULL;
 			break;
 		default:
 			vp = va_arg(ap, void *);
+			np = v8plus_type_is_array(nt) ?
+			    va_arg(ap, uint_t *) : NULL;
 		}
 
 		(void) snprintf(buf, sizeof (buf), "%u", i);
 		VERIFY(nvlist_lookup_nvpair((nvlist_t *)lp, buf, &pp) == 0);
-		VERIFY(v8plus_arg_value(nt, pp, vp) == 0);
+		VERIFY(v8plus_arg_value(nt, pp, vp, np) == 0);
 
 		nt = va_arg(ap, v8plus_type_t);
 	}
@@ -789,6 +5597,70 @@ v8plus_args(const nvlist_t *lp, uint_t flags, v8plus_type_t t, ...)
 	return (0);
 }
 
+/*
+ * Adds an array property from a pointer to its elements, of the given C
+ * type, and a count; the elements are passed to libnvpair as the nvpair
+ * array type given.
+ */
+int
+v8plus_number_array_mark(nvlist_t *lp, const char *name)
+{
+	char **names = NULL;
+	char **nnames;
+	uint_t i, n = 0;
+	int err;
+
+	if (nvlist_lookup_string_array(lp, V8PLUS_NUM_COOKIE,
+	    &names, &n) == 0) {
+		for (i = 0; i < n; i++) {
+			if (strcmp(names[i], name) == 0)
+				return (0);
+		}
+	}
+
+	if ((nnames = malloc((n + 1) * sizeof (char *))) == NULL)
+		return (ENOMEM);
+	for (i = 0; i < n; i++)
+		nnames[i] = names[i];
+	nnames[n] = (char *)name;
+
+	err = nvlist_add_string_array(lp, V8PLUS_NUM_COOKIE, nnames, n + 1);
+	free(nnames);
+
+	return (err);
+}
+
+boolean_t
+v8plus_number_array_marked(const nvlist_t *lp, const char *name)
+{
+	char **names;
+	uint_t i, n;
+
+	if (nvlist_lookup_string_array((nvlist_t *)lp, V8PLUS_NUM_COOKIE,
+	    &names, &n) != 0)
+		return (B_FALSE);
+
+	for (i = 0; i < n; i++) {
+		if (strcmp(names[i], name) == 0)
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+#define	SETPROP_ARRAY(_lp, _name, _ct, _at, _nt, _ap)			\
+	{								\
+		_ct *_v = va_arg(*(_ap), _ct *);			\
+		uint_t _n = va_arg(*(_ap), uint_t);			\
+									\
+		if ((err = nvlist_add_##_nt##_array((_lp), (_name),	\
+		    (_at *)_v, _n)) != 0) {				\
+			(void) v8plus_nverr(err, (_name));		\
+			return (-1);					\
+		}							\
+		break;							\
+	}
+
 static int
 v8plus_obj_vsetprops(nvlist_t *lp, v8plus_type_t t, va_list *ap)
 {
@@ -850,6 +5722,28 @@ v8plus_obj_vsetprops(nvlist_t *lp, v8plus_type_t t, va_list *ap)
 			v8plus_jsfunc_hold(j);
 			break;
 		}
+		case V8PLUS_TYPE_BUFFER:
+		{
+			const v8plus_buffer_t *bp =
+			    va_arg(*ap, const v8plus_buffer_t *);
+			uint64_t bv[V8PLUS_BUFFER_NVALS];
+
+			bv[0] = bp->vb_hdl;
+			bv[1] = (uint64_t)(uintptr_t)bp->vb_data;
+			bv[2] = (uint64_t)bp->vb_len;
+			if ((err = nvlist_add_uint64_array(lp,
+			    name, bv, V8PLUS_BUFFER_NVALS)) != 0) {
+				(void) v8plus_nverr(err, name);
+				return (-1);
+			}
+			if ((err = nvlist_add_string_array(lp,
+			    V8PLUS_JSF_COOKIE, NULL, 0)) != 0) {
+				(void) v8plus_nverr(err, V8PLUS_JSF_COOKIE);
+				return (-1);
+			}
+			v8plus_buffer_hold(bp);
+			break;
+		}
 		case V8PLUS_TYPE_OBJECT:
 		{
 			const nvlist_t *op = va_arg(*ap, const nvlist_t *);
@@ -913,6 +5807,37 @@ v8plus_obj_vsetprops(nvlist_t *lp, v8plus_type_t t, va_list *ap)
 			}
 			break;
 		}
+		case V8PLUS_TYPE_NUMBER_ARRAY:
+		{
+			double *dp = va_arg(*ap, double *);
+			uint_t n = va_arg(*ap, uint_t);
+
+			if ((err = nvlist_add_int64_array(lp, name,
+			    (int64_t *)dp, n)) != 0 ||
+			    (err = v8plus_number_array_mark(lp, name)) != 0) {
+				(void) v8plus_nverr(err, name);
+				return (-1);
+			}
+			break;
+		}
+		case V8PLUS_TYPE_BOOLEAN_ARRAY:
+			SETPROP_ARRAY(lp, name, boolean_t, boolean_t, boolean,
+			    ap);
+		case V8PLUS_TYPE_STRING_ARRAY:
+			SETPROP_ARRAY(lp, name, char *, char *const, string,
+			    ap);
+		case V8PLUS_TYPE_INT8_ARRAY:
+			SETPROP_ARRAY(lp, name, int8_t, int8_t, int8, ap);
+		case V8PLUS_TYPE_UINT8_ARRAY:
+			SETPROP_ARRAY(lp, name, uint8_t, uint8_t, uint8, ap);
+		case V8PLUS_TYPE_INT16_ARRAY:
+			SETPROP_ARRAY(lp, name, int16_t, int16_t, int16, ap);
+		case V8PLUS_TYPE_UINT16_ARRAY:
+			SETPROP_ARRAY(lp, name, uint16_t, uint16_t, uint16, ap);
+		case V8PLUS_TYPE_INT32_ARRAY:
+			SETPROP_ARRAY(lp, name, int32_t, int32_t, int32, ap);
+		case V8PLUS_TYPE_UINT32_ARRAY:
+			SETPROP_ARRAY(lp, name, uint32_t, uint32_t, uint32, ap);
 		case V8PLUS_TYPE_INVALID:
 		default:
 			(void) v8plus_error(V8PLUSERR_YOUSUCK,
@@ -926,6 +5851,8 @@ v8plus_obj_vsetprops(nvlist_t *lp, v8plus_type_t t, va_list *ap)
 	return (0);
 }
 
+#undef	SETPROP_ARRAY
+
 nvlist_t *
 v8plus_obj(v8plus_type_t t, ...)
 {
@@ -989,6 +5916,7 @@ _v8plus_alloc_exception(void)
 	if (_v8plus_pending_exception != NULL)
 		return (NULL);
 
+	v8plus_nva_init();
 	if ((err = nvlist_xalloc(&lp, NV_UNIQUE_NAME, &_v8plus_nva)) != 0) {
 		v8plus_panic("unable to allocate nvlist for exception: %s",
 		    strerror(err));
@@ -1013,6 +5941,7 @@ _v8plus_throw_exception(const char *type, const char *msg, const char *file,
 	if (_v8plus_pending_exception != NULL)
 		return (NULL);
 
+	v8plus_nva_init();
 	if ((err = nvlist_xalloc(&lp, NV_UNIQUE_NAME, &_v8plus_nva)) != 0) {
 		v8plus_panic("unable to allocate nvlist for exception: %s",
 		    strerror(err));
@@ -1308,6 +6237,7 @@ _v8plus_throw_errno_exception(int errorno, const char *syscall, const char *msg,
 	va_list ap;
 	int err;
 
+	v8plus_nva_init();
 	if ((err = nvlist_xalloc(&lp, NV_UNIQUE_NAME, &_v8plus_nva)) != 0) {
 		v8plus_panic("unable to allocate nvlist for exception: %s",
 		    strerror(err));
@@ -1375,8 +6305,34 @@ static void
 v8plus_uv_worker(uv_work_t *wp)
 {
 	v8plus_uv_ctx_t *cp = wp->data;
+	v8plus_loop_t *loop = cp->vuc_loop;
+	int err;
 
+	/*
+	 * Requests made by the worker that are not bound to any particular
+	 * object or function go to the loop that deferred the work.
+	 */
+	_v8plus_caller_loop = loop;
 	cp->vuc_result = cp->vuc_worker(cp->vuc_obj, cp->vuc_ctx);
+	_v8plus_caller_loop = NULL;
+
+	/*
+	 * A loop that is exiting waits for its deferred work to get this far;
+	 * see v8plus_crossthread_fini().
+	 */
+	if ((err = pthread_mutex_lock(&loop->vl_deferred_mtx)) != 0) {
+		v8plus_panic("could not lock deferred work mutex: %s",
+		    strerror(err));
+	}
+	if (--loop->vl_deferred == 0 &&
+	    (err = pthread_cond_broadcast(&loop->vl_deferred_cv)) != 0) {
+		v8plus_panic("could not signal deferred work condvar: %s",
+		    strerror(err));
+	}
+	if ((err = pthread_mutex_unlock(&loop->vl_deferred_mtx)) != 0) {
+		v8plus_panic("could not unlock deferred work mutex: %s",
+		    strerror(err));
+	}
 }
 
 static void
@@ -1388,7 +6344,12 @@ v8plus_uv_completion(uv_work_t *wp)
 {
 	v8plus_uv_ctx_t *cp = wp->data;
 
-	cp->vuc_completion(cp->vuc_obj, cp->vuc_ctx, cp->vuc_result);
+	/*
+	 * If the loop has exited since the work was deferred, JavaScript can
+	 * no longer be called, and the completion is skipped.
+	 */
+	if (cp->vuc_loop == _v8plus_loop)
+		cp->vuc_completion(cp->vuc_obj, cp->vuc_ctx, cp->vuc_result);
 	if (cp->vuc_obj != NULL)
 		v8plus_obj_rele(cp->vuc_obj);
 	free(cp);
@@ -1401,6 +6362,7 @@ v8plus_defer(void *cop, void *ctxp, v8plus_worker_f worker,
 {
 	uv_work_t *wp = malloc(sizeof (uv_work_t));
 	v8plus_uv_ctx_t *cp = malloc(sizeof (v8plus_uv_ctx_t));
+	int err;
 
 	bzero(wp, sizeof (uv_work_t));
 	bzero(cp, sizeof (v8plus_uv_ctx_t));
@@ -1412,9 +6374,20 @@ v8plus_defer(void *cop, void *ctxp, v8plus_worker_f worker,
 	cp->vuc_ctx = ctxp;
 	cp->vuc_worker = worker;
 	cp->vuc_completion = completion;
+	cp->vuc_loop = v8plus_loop_self();
 	wp->data = cp;
 
-	uv_queue_work(uv_default_loop(), wp, v8plus_uv_worker,
+	if ((err = pthread_mutex_lock(&cp->vuc_loop->vl_deferred_mtx)) != 0) {
+		v8plus_panic("could not lock deferred work mutex: %s",
+		    strerror(err));
+	}
+	cp->vuc_loop->vl_deferred++;
+	if ((err = pthread_mutex_unlock(&cp->vuc_loop->vl_deferred_mtx)) != 0) {
+		v8plus_panic("could not unlock deferred work mutex: %s",
+		    strerror(err));
+	}
+
+	uv_queue_work(cp->vuc_loop->vl_uv, wp, v8plus_uv_worker,
 	    v8plus_uv_completion);
 }
 
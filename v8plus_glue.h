@@ -6,6 +6,7 @@
 #define	_V8PLUS_GLUE_H
 
 #include <stdarg.h>
+#include <time.h>
 #include <libnvpair.h>
 #include "v8plus_errno.h"
 
@@ -31,11 +32,32 @@ typedef enum v8plus_type {
 	V8PLUS_TYPE_INVALID,		/* data_type_t */
 	V8PLUS_TYPE_ANY,		/* nvpair_t * */
 	V8PLUS_TYPE_STRNUMBER64,	/* uint64_t */
-	V8PLUS_TYPE_INL_OBJECT		/* ... */
+	V8PLUS_TYPE_INL_OBJECT,		/* ... */
+	V8PLUS_TYPE_NUMBER_ARRAY,	/* double *, uint_t */
+	V8PLUS_TYPE_BOOLEAN_ARRAY,	/* boolean_t *, uint_t */
+	V8PLUS_TYPE_STRING_ARRAY,	/* char **, uint_t */
+	V8PLUS_TYPE_INT8_ARRAY,		/* int8_t *, uint_t */
+	V8PLUS_TYPE_UINT8_ARRAY,	/* uint8_t *, uint_t */
+	V8PLUS_TYPE_INT16_ARRAY,	/* int16_t *, uint_t */
+	V8PLUS_TYPE_UINT16_ARRAY,	/* uint16_t *, uint_t */
+	V8PLUS_TYPE_INT32_ARRAY,	/* int32_t *, uint_t */
+	V8PLUS_TYPE_UINT32_ARRAY,	/* uint32_t *, uint_t */
+	V8PLUS_TYPE_BUFFER		/* v8plus_buffer_t * */
 } v8plus_type_t;
 
 typedef uint64_t v8plus_jsfunc_t;
 
+/*
+ * A Buffer passed from JavaScript in place: vb_data and vb_len describe its
+ * contents, which are not copied.  The contents remain valid for as long as
+ * the argument list containing the Buffer, or while the Buffer is held.
+ */
+typedef struct v8plus_buffer {
+	void *vb_data;
+	size_t vb_len;
+	uint64_t vb_hdl;
+} v8plus_buffer_t;
+
 /*
  * C constructor, destructor, and method prototypes.  See README.md.
  */
@@ -138,7 +160,8 @@ extern void v8plus_panic(const char *, ...) __PRINTFLIKE(1) __NORETURN;
  * mechanism for creating a JS function from C.  It can however be used to
  * return a function (or object containing one, etc.) from a deferred
  * completion routine in which a JS function has been invoked that returned
- * such a thing to us.
+ * such a thing to us.  Holds and releases may be made on any thread, but a
+ * function must first be held on its event loop thread.
  */
 extern int nvlist_lookup_v8plus_jsfunc(const nvlist_t *, const char *,
     v8plus_jsfunc_t *);
@@ -147,6 +170,19 @@ extern void v8plus_jsfunc_hold(v8plus_jsfunc_t);
 extern void v8plus_jsfunc_rele(v8plus_jsfunc_t);
 extern void v8plus_jsfunc_rele_direct(v8plus_jsfunc_t);
 
+/*
+ * Find the named Buffer in the nvlist, without placing a hold on it.  A hold
+ * keeps the Buffer, and thus its contents, alive after the argument list
+ * containing it has been freed, e.g. for work deferred with v8plus_defer().
+ * As with functions, holds and releases may be made on any thread, but a
+ * Buffer must first be held on its event loop thread.
+ */
+extern int nvlist_lookup_v8plus_buffer(const nvlist_t *, const char *,
+    v8plus_buffer_t *);
+extern int nvpair_value_v8plus_buffer(const nvpair_t *, v8plus_buffer_t *);
+extern void v8plus_buffer_hold(const v8plus_buffer_t *);
+extern void v8plus_buffer_rele(const v8plus_buffer_t *);
+
 /*
  * Place or release a hold on the V8 representation of the specified C object.
  * This is rarely necessary; v8plus_defer() performs this action for you, but
@@ -154,7 +190,8 @@ extern void v8plus_jsfunc_rele_direct(v8plus_jsfunc_t);
  * a method call but have stashed a reference to the object somewhere and are
  * not calling v8plus_defer(), you must call this first.  Holds and releases
  * must be balanced.  Use of the object within a thread after releasing is a
- * bug.
+ * bug.  Holds and releases may be made on any thread, but other threads may
+ * only add holds to an object that is already held.
  */
 extern void v8plus_obj_hold(const void *);
 extern void v8plus_obj_rele(const void *);
@@ -183,6 +220,25 @@ typedef void (*v8plus_completion_f)(void *, void *, void *);
 
 extern void v8plus_defer(void *, void *, v8plus_worker_f, v8plus_completion_f);
 
+/*
+ * Incremental jobs perform work that must be done on the event loop thread,
+ * and so cannot be deferred to a worker thread, without blocking the loop
+ * for its whole duration.  The step function is called repeatedly on the
+ * event loop thread with the object and context for up to the given time
+ * slice in microseconds (0 for a default of 1ms) each turn of the loop,
+ * until it returns B_TRUE to indicate that the work is complete; the done
+ * function, if not NULL, is then called with the same arguments.  Each step
+ * should do only a small amount of work.  The object, if not NULL, is held
+ * for the duration, and the event loop is kept running until the job is
+ * complete.  Must be called on the event loop thread.
+ */
+typedef struct v8plus_incremental v8plus_incremental_t;
+typedef boolean_t (*v8plus_step_f)(void *, void *);
+typedef void (*v8plus_step_done_f)(void *, void *);
+
+extern void v8plus_incremental(void *, void *, v8plus_step_f,
+    v8plus_step_done_f, uint_t);
+
 /*
  * Call an opaque JavaScript function from C.  The caller is responsible for
  * freeing the returned list.  The first argument is not const because it is
@@ -216,13 +272,335 @@ extern nvlist_t *v8plus_method_call(void *, const char *, const nvlist_t *);
 extern nvlist_t *v8plus_method_call_direct(void *, const char *,
     const nvlist_t *);
 
+/*
+ * Submit many calls to the event loop thread at once, with a single queue
+ * operation and a single wakeup.  Each descriptor names either a method of
+ * a native object, if vbc_obj is non-NULL, or a JavaScript function.
+ * v8plus_call_batch() waits once for all of the calls to be made and stores
+ * their results, in order, in the caller's array, which must have room for
+ * ncalls entries; each is as would be returned by v8plus_call() or
+ * v8plus_method_call() and must be freed by the caller.  If any call threw,
+ * its result is NULL and -1 is returned with the first such exception
+ * pending; if the calls could not be queued, every result is NULL and -1 is
+ * returned with an exception pending.  Otherwise 0 is returned.
+ * v8plus_post_batch() does not wait and discards the results; as with
+ * v8plus_call_post(), it takes ownership of each argument list, and it
+ * returns 0 or, if the calls could not be queued, -1 with an exception
+ * pending.
+ */
+typedef struct v8plus_batch_call {
+	void *vbc_obj;
+	const char *vbc_name;
+	v8plus_jsfunc_t vbc_func;
+	const nvlist_t *vbc_args;
+} v8plus_batch_call_t;
+
+extern int v8plus_call_batch(const v8plus_batch_call_t *, uint_t,
+    nvlist_t **);
+extern int v8plus_post_batch(const v8plus_batch_call_t *, uint_t);
+
+/*
+ * Non-blocking variants of v8plus_call() and v8plus_method_call().  Rather
+ * than sleeping until the event loop thread has made the call, these return
+ * at once with a future from which the result may later be collected by any
+ * thread.  Unless the call is made at once on the event loop thread, the
+ * future takes its own copies of the argument list and method name, so the
+ * caller may free them on return.  If an internal error occurs, NULL is
+ * returned and an exception is pending.  See the documentation.
+ *
+ * v8plus_future_done() reports whether the result has arrived.
+ * v8plus_future_wait() blocks for at most timeout_ms milliseconds (forever if
+ * negative) and returns 0 or ETIMEDOUT.  v8plus_future_result() waits if
+ * necessary and returns the result just as the synchronous call would have,
+ * making any exception pending in the calling thread; the caller owns the
+ * returned list.  v8plus_future_free() releases the future, and may be called
+ * before the call has completed if the result is no longer wanted.
+ *
+ * v8plus_future_cancel() prevents a call that has not yet started from being
+ * made, returning B_FALSE if it is too late; the future completes, with an
+ * ECANCELED exception as its result, once the event loop thread reaches it.
+ *
+ * v8plus_future_then() arranges for a continuation to be run on a thread in
+ * the libuv worker pool when the result arrives, or immediately in the caller
+ * if it already has.  The future is freed when the continuation returns and
+ * must not otherwise be used once a continuation has been attached.
+ */
+typedef struct v8plus_async_call v8plus_future_t;
+typedef void (*v8plus_future_f)(v8plus_future_t *, void *);
+
+extern v8plus_future_t *v8plus_call_async(v8plus_jsfunc_t, const nvlist_t *);
+extern v8plus_future_t *v8plus_method_call_async(void *, const char *,
+    const nvlist_t *);
+extern boolean_t v8plus_future_done(v8plus_future_t *);
+extern int v8plus_future_wait(v8plus_future_t *, int);
+extern nvlist_t *v8plus_future_result(v8plus_future_t *);
+extern void v8plus_future_then(v8plus_future_t *, v8plus_future_f, void *);
+extern void v8plus_future_free(v8plus_future_t *);
+extern boolean_t v8plus_future_cancel(v8plus_future_t *);
+
+/*
+ * Variants of v8plus_call() and v8plus_method_call() that give up waiting at
+ * an absolute CLOCK_REALTIME deadline (or never, if it is NULL), returning
+ * NULL with an ETIMEDOUT exception pending.  The argument list and method
+ * name are copied.  A call that has not yet started when the deadline passes
+ * is cancelled; one that has is left to finish, and its result is discarded.
+ */
+extern nvlist_t *v8plus_call_timed(v8plus_jsfunc_t, const nvlist_t *,
+    const struct timespec *);
+extern nvlist_t *v8plus_method_call_timed(void *, const char *,
+    const nvlist_t *, const struct timespec *);
+
+/*
+ * Fire-and-forget variants of v8plus_call() and v8plus_method_call().  The
+ * call is queued for the event loop thread and these functions return at
+ * once without waiting for it to be made.  Ownership of the argument list,
+ * which may be NULL, passes to v8plus, which frees it after the call; the
+ * caller must not use it again.  The result of the call is discarded.  Any
+ * exception thrown by the call is passed, on the event loop thread, to the
+ * handler registered with v8plus_post_error_handler(); by default it is
+ * discarded.  If the call cannot be queued, -1 is returned and an exception
+ * is pending.  The method name must remain valid until the call is made.
+ */
+typedef void (*v8plus_post_error_f)(const nvlist_t *, void *);
+
+extern int v8plus_call_post(v8plus_jsfunc_t, nvlist_t *);
+extern int v8plus_method_post(void *, const char *, nvlist_t *);
+extern void v8plus_post_error_handler(v8plus_post_error_f, void *);
+
+/*
+ * Coalescing variants of the above, for updates of which only the newest
+ * matters.  If an update to the same method of the same object, or to the
+ * same function with the same caller-chosen key, is still queued, its
+ * arguments are replaced (and freed) rather than a second call being queued;
+ * the update keeps its place in the queue.  Unlike the plain variants, these
+ * queue the call even when made from the event loop thread.
+ */
+extern int v8plus_call_post_latest(v8plus_jsfunc_t, uint64_t, nvlist_t *);
+extern int v8plus_method_post_latest(void *, const char *, nvlist_t *);
+
+/*
+ * Calls made from other threads are queued in one of several priority lanes.
+ * v8plus_call_lane() sets the lane used by subsequent calls, posts, batches
+ * and futures made by the calling thread, and returns the lane previously in
+ * effect; the default is V8PLUS_LANE_NORMAL.  Releases of objects, functions
+ * and event loop holds always use V8PLUS_LANE_HIGH, but never overtake calls
+ * posted before them.  Calls in different lanes are otherwise not ordered
+ * with respect to one another.
+ *
+ * The event loop thread drains the lanes by weighted round robin, running up
+ * to a lane's weight in calls before moving on to the next; the default
+ * weights are 16, 4 and 1.  v8plus_lane_weight() changes a lane's weight; it
+ * must be called from the event loop thread and returns 0 or -1 with an
+ * exception pending.
+ */
+typedef enum v8plus_lane {
+	V8PLUS_LANE_HIGH = 0,
+	V8PLUS_LANE_NORMAL,
+	V8PLUS_LANE_BULK,
+	V8PLUS_LANE_COUNT
+} v8plus_lane_t;
+
+extern v8plus_lane_t v8plus_call_lane(v8plus_lane_t);
+extern int v8plus_lane_weight(v8plus_lane_t, uint_t);
+
+/*
+ * By default, a JavaScript function or method called from another thread
+ * that returns a Promise yields an empty object as its result.
+ * v8plus_await_promises() sets whether calls made by the calling thread whose
+ * results are wanted (synchronous and timed calls, and futures) instead wait
+ * for a returned Promise to settle, completing with the value with which it
+ * is fulfilled or the exception with which it is rejected; it returns the
+ * setting previously in effect.  This requires Node 0.12 or later.  It does
+ * not apply to batches, or to synchronous calls made on the event loop
+ * thread itself, which cannot wait.
+ */
+extern boolean_t v8plus_await_promises(boolean_t);
+
+/*
+ * Typed arrays are always passed to C as nvlist arrays of the corresponding
+ * type (V8PLUS_TYPE_INT8_ARRAY and so on, and V8PLUS_TYPE_NUMBER_ARRAY for
+ * floating-point arrays), regardless of this setting; they could not be
+ * passed at all before, and are never passed as objects.  By default,
+ * ordinary JavaScript arrays are passed as objects as they always have
+ * been; v8plus_dense_arrays() sets whether
+ * non-empty arrays whose elements are all numbers, all booleans or all
+ * strings are instead passed as V8PLUS_TYPE_NUMBER_ARRAY,
+ * V8PLUS_TYPE_BOOLEAN_ARRAY or V8PLUS_TYPE_STRING_ARRAY values, and returns
+ * the setting previously in effect.  Array values returned to JavaScript
+ * become arrays of booleans or strings, or typed arrays for the number and
+ * integer types (Node 0.12 and later).
+ */
+extern boolean_t v8plus_dense_arrays(boolean_t);
+
+/*
+ * The cross-thread call queue may be bounded with v8plus_queue_limit(),
+ * which may be called from any thread; a limit of 0, the default, means no
+ * limit.  Releases are never subject to the limit.  When a thread submits a
+ * call that would take the queue above its limit, what happens depends on
+ * the policy the thread has chosen with v8plus_queue_policy(), which returns
+ * the policy previously in effect:
+ *
+ * V8PLUS_QUEUE_BLOCK: wait until there is room (the default).
+ * V8PLUS_QUEUE_FAIL: fail with an EAGAIN exception pending.
+ * V8PLUS_QUEUE_DROP: silently discard posted calls, for which nobody is
+ * waiting; calls whose results are wanted fail as for V8PLUS_QUEUE_FAIL.
+ *
+ * Calls made from the event loop thread itself are never refused.
+ * v8plus_queue_stats() reports the current and greatest depth of the queue
+ * and how many submissions have been blocked, rejected or dropped.
+ */
+typedef enum v8plus_queue_policy {
+	V8PLUS_QUEUE_BLOCK = 1,
+	V8PLUS_QUEUE_FAIL,
+	V8PLUS_QUEUE_DROP
+} v8plus_queue_policy_t;
+
+typedef struct v8plus_queue_stats {
+	uint_t vqs_depth;
+	uint_t vqs_max_depth;
+	uint_t vqs_limit;
+	uint64_t vqs_blocked;
+	uint64_t vqs_rejected;
+	uint64_t vqs_dropped;
+} v8plus_queue_stats_t;
+
+extern void v8plus_queue_limit(uint_t);
+extern v8plus_queue_policy_t v8plus_queue_policy(v8plus_queue_policy_t);
+extern void v8plus_queue_stats(v8plus_queue_stats_t *);
+
+/*
+ * Each call queued for the event loop thread is timestamped when queued,
+ * when it starts to run, and when it finishes, and the time it spent waiting
+ * in the queue and running is recorded, by kind of call, in log-linear
+ * histograms.  v8plus_call_stats() summarises the histograms for one kind of
+ * call, returning 0, or -1 with an exception pending if the kind is invalid.
+ * v8plus_call_stats_reset() discards all recorded data, and
+ * v8plus_call_timing() turns timing on or off; it is on by default.  Calls
+ * made directly on the event loop thread are not recorded.  These functions
+ * must be called from the event loop thread.
+ */
+typedef enum v8plus_call_kind {
+	V8PLUS_CALL_METHOD = 0,
+	V8PLUS_CALL_OBJECT_RELEASE,
+	V8PLUS_CALL_FUNCTION,
+	V8PLUS_CALL_FUNCTION_RELEASE,
+	V8PLUS_CALL_EVENTLOOP_RELEASE,
+	V8PLUS_CALL_KINDS
+} v8plus_call_kind_t;
+
+typedef struct v8plus_latency {
+	uint64_t vl_total_ns;
+	uint64_t vl_max_ns;
+	uint64_t vl_p50_ns;
+	uint64_t vl_p90_ns;
+	uint64_t vl_p99_ns;
+	uint64_t vl_p999_ns;
+} v8plus_latency_t;
+
+typedef struct v8plus_call_stats {
+	uint64_t vcs_count;
+	v8plus_latency_t vcs_wait;
+	v8plus_latency_t vcs_exec;
+} v8plus_call_stats_t;
+
+extern int v8plus_call_stats(v8plus_call_kind_t, v8plus_call_stats_t *);
+extern void v8plus_call_stats_reset(void);
+extern void v8plus_call_timing(boolean_t);
+
+/*
+ * Calls made from other threads are run on the event loop thread in batches,
+ * one batch per turn of the event loop.  The drain policy bounds how much
+ * work each turn may do before yielding to other event sources:
+ *
+ * V8PLUS_DRAIN_ITEMS: at most max_items calls per turn (the default, with
+ * max_items of 1000).
+ * V8PLUS_DRAIN_TIME: calls are run until max_usec microseconds have elapsed.
+ * V8PLUS_DRAIN_ADAPTIVE: the number of calls per turn is adjusted according
+ * to the recent cost of each call so that a turn takes about max_usec
+ * microseconds, up to a limit of max_items calls.
+ *
+ * v8plus_drain_policy() must be called from the event loop thread; it
+ * returns 0 or -1 with an exception pending.  v8plus_drain_stats() reports
+ * how many turns have been taken and how many of them were cut short by
+ * each budget.  The policy may also be inspected and set from JavaScript
+ * with the v8plus_drain_policy() function attached to every module.
+ */
+typedef enum v8plus_drain_policy {
+	V8PLUS_DRAIN_ITEMS = 1,
+	V8PLUS_DRAIN_TIME,
+	V8PLUS_DRAIN_ADAPTIVE
+} v8plus_drain_policy_t;
+
+typedef struct v8plus_drain_stats {
+	uint64_t vds_turns;
+	uint64_t vds_items;
+	uint64_t vds_item_limited;
+	uint64_t vds_time_limited;
+	uint64_t vds_max_turn_ns;
+} v8plus_drain_stats_t;
+
+extern int v8plus_drain_policy(v8plus_drain_policy_t, uint_t, uint_t);
+extern void v8plus_drain_stats(v8plus_drain_stats_t *);
+
+/*
+ * A channel carries records of bytes from any number of threads to a
+ * JavaScript function far more cheaply than a call per record.  Writers copy
+ * each record into a bounded ring; the event loop thread passes everything
+ * written since its last turn to the function at once, as a single Buffer
+ * holding the records back to back, an array of the offsets at which each
+ * record ends, and the channel's id.  If the function returns false, as
+ * Readable.prototype.push() does, no more batches are delivered until
+ * JavaScript calls the v8plus_channel_resume() function attached to every
+ * module with the id.
+ *
+ * v8plus_channel_create() must be called from the event loop thread on which
+ * the function was received; it takes a hold on the function.  The capacity
+ * is rounded up to a power of two, and no record may be larger than half of
+ * it.  v8plus_channel_writable() returns B_FALSE while delivery is paused or
+ * more than hiwat bytes (by default half the capacity) are in the ring;
+ * writers should then stop.  v8plus_channel_write() may be called from any
+ * thread and does not block; it returns 0 or, if there is no room, -1 with
+ * an EAGAIN exception pending.  v8plus_channel_close(), on the event loop
+ * thread, delivers anything left (unless delivery is paused, in which case
+ * it is discarded) and frees the channel; nothing may write to it once it
+ * has been called, and it may not be closed twice.
+ */
+typedef struct v8plus_channel v8plus_channel_t;
+
+extern v8plus_channel_t *v8plus_channel_create(v8plus_jsfunc_t, size_t,
+    size_t);
+extern int v8plus_channel_write(v8plus_channel_t *, const void *, size_t);
+extern boolean_t v8plus_channel_writable(v8plus_channel_t *);
+extern void v8plus_channel_close(v8plus_channel_t *);
+
+/*
+ * A counter block is a named array of counters or gauges that C code may
+ * update from any thread and that JavaScript may read at any time without
+ * involving the event loop, through a Float64Array sharing the block's
+ * memory returned by the v8plus_counters(name) function attached to every
+ * module (Node 0.12 and later).  Values are doubles, so integer counts are
+ * exact up to 2^53.  v8plus_counters_create() returns the block with the
+ * given name, creating it with all values zero if it does not exist; it
+ * returns NULL with an exception pending if it cannot be created or exists
+ * with a different number of counters.  Blocks are never freed.
+ * v8plus_counter_add(), v8plus_counter_set() and v8plus_counter_get() update
+ * and read a single value atomically.
+ */
+typedef struct v8plus_counters v8plus_counters_t;
+
+extern v8plus_counters_t *v8plus_counters_create(const char *, uint_t);
+extern void v8plus_counter_add(v8plus_counters_t *, uint_t, double);
+extern void v8plus_counter_set(v8plus_counters_t *, uint_t, double);
+extern double v8plus_counter_get(v8plus_counters_t *, uint_t);
+
 /*
  * These functions allow the consumer to hold the V8 event loop open for
  * potential input from other threads.  If your process blocks in another
  * thread, e.g. an event subscription thread, you must signal to v8plus
  * that the event loop should remain active.  Calls to v8plus_eventloop_hold()
  * and v8plus_eventloop_rele() should be balanced.  It is safe to call
- * v8plus_eventloop_rele() from outside the event loop thread.
+ * v8plus_eventloop_rele() from outside the event loop thread, and
+ * v8plus_eventloop_hold() as well while the event loop is already held.
  *
  * Note: Holds obtained via v8plus_obj_hold() and v8plus_jsfunc_hold() will
  * also automatically hold the event loop, removing the need to use this
@@ -232,6 +610,45 @@ extern void v8plus_eventloop_hold(void);
 extern void v8plus_eventloop_rele(void);
 extern void v8plus_eventloop_rele_direct(void);
 
+/*
+ * Native timers run a C callback on the event loop thread after timeout
+ * milliseconds and then, if repeat is nonzero, every repeat milliseconds
+ * until stopped; timers that are due together are run together.  An active
+ * timer holds the event loop as v8plus_eventloop_hold() does.  Both functions
+ * must be called on the event loop thread.  v8plus_timer_stop() frees the
+ * timer and must be called exactly once for every timer started, including
+ * one-shot timers that have fired; it may be called from the timer's own
+ * callback.
+ */
+typedef struct v8plus_timer v8plus_timer_t;
+typedef void (*v8plus_timer_f)(v8plus_timer_t *, void *);
+
+extern v8plus_timer_t *v8plus_timer_start(v8plus_timer_f, void *, uint64_t,
+    uint64_t);
+extern void v8plus_timer_stop(v8plus_timer_t *);
+
+/*
+ * File descriptor watches run a C callback on the event loop thread whenever
+ * the descriptor is ready for any of the events requested, passing the
+ * events that are ready, or V8PLUS_FD_ERROR if polling the descriptor
+ * failed.  An active watch keeps the event loop running.  The events of
+ * interest may be changed with v8plus_fd_watch_events(), 0 suspending the
+ * watch.  v8plus_fd_unwatch() frees the watch, after which its callback is
+ * not called again; it may be called from that callback but does not close
+ * the descriptor.  All three functions must be called on the event loop
+ * thread.
+ */
+#define	V8PLUS_FD_READABLE	0x1
+#define	V8PLUS_FD_WRITABLE	0x2
+#define	V8PLUS_FD_ERROR		0x4
+
+typedef struct v8plus_fd_watch v8plus_fd_watch_t;
+typedef void (*v8plus_fd_f)(v8plus_fd_watch_t *, int, int, void *);
+
+extern v8plus_fd_watch_t *v8plus_fd_watch(int, int, v8plus_fd_f, void *);
+extern int v8plus_fd_watch_events(v8plus_fd_watch_t *, int);
+extern void v8plus_fd_unwatch(v8plus_fd_watch_t *);
+
 /*
  * These methods are analogous to strerror(3c) and similar functions; they
  * translate among error names, codes, and default messages.  There is
@@ -92,8 +92,47 @@
 #define	V8_OBJECT_NEW(isolate)						\
 	v8::Object::New(USE_ISOLATE_ONLY(isolate))
 
-#define	V8PLUS_NVPAIR_TO_V8_VALUE(isolate, nvpair)			\
-	v8plus::nvpair_to_v8_Value(ISOLATE_OR_NULL(isolate), nvpair)
+/*
+ * Node 9.3 allows modules to be loaded into worker threads, each of which
+ * runs its own event loop; the loop belonging to an isolate must be used in
+ * place of the default loop for anything associated with that isolate.
+ */
+#if NODE_VERSION_AT_LEAST(9, 3, 0)
+#define	V8PLUS_EVENT_LOOP(isolate)	node::GetCurrentEventLoop(isolate)
+#else
+#define	V8PLUS_EVENT_LOOP(isolate)	uv_default_loop()
+#endif
+
+/*
+ * node::Buffer::New() returned a wrapper object until 0.11.3, after which it
+ * returns the JavaScript object; 0.12 added the isolate.
+ */
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+#define	V8_BUFFER_NEW(isolate, data, len)				\
+	node::Buffer::New(isolate, data, len)
+#elif NODE_VERSION_AT_LEAST(0, 11, 3)
+#define	V8_BUFFER_NEW(isolate, data, len)				\
+	node::Buffer::New(data, len)
+#else
+#define	V8_BUFFER_NEW(isolate, data, len)				\
+	v8::Local<v8::Object>::New(node::Buffer::New(data, len)->handle_)
+#endif
+
+/*
+ * The elements of a typed array are reached through its ArrayBuffer's
+ * contents in Node 4 and later; in 0.12 the array's external elements are
+ * the same memory, already offset to the start of the view.
+ */
+#if NODE_VERSION_AT_LEAST(4, 0, 0)
+#define	V8_TYPED_ARRAY_DATA(ta)						\
+	((char *)(ta)->Buffer()->GetContents().Data() + (ta)->ByteOffset())
+#elif NODE_VERSION_AT_LEAST(0, 12, 0)
+#define	V8_TYPED_ARRAY_DATA(ta)						\
+	((char *)(ta)->GetIndexedPropertiesExternalArrayData())
+#endif
+
+#define	V8PLUS_NVPAIR_TO_V8_VALUE(isolate, nvlist, nvpair)		\
+	v8plus::nvpair_to_v8_Value(ISOLATE_OR_NULL(isolate), nvlist, nvpair)
 
 /*
  * This is all very gross.  V8 has a lot of pointless churn in the form of
@@ -177,7 +216,7 @@ _f(const v8::Arguments &_p)
 
 #define	HANDLE_SCOPE(_x)	v8::HandleScope _x
 #define	V8_ARGUMENTS		v8::Arguments
-#define	V8_PF_ASSIGN(_d, _s)	_d = v8::Persistent<v8::Function>::New(_s)
+#define	V8_PF_ASSIGN(_d, _s)	_d = v8::Persistent<v8::Object>::New(_s)
 
 #define	V8_JS_FUNC_RETURN(_a, _v)	return (_v)
 #define	V8_JS_FUNC_RETURN_CLOSE(_a, _s, _v)	return ((_s).Close(_v))
@@ -193,6 +232,9 @@ _f(const v8::Arguments &_p)
  * 14+ has prefixed member names and context-aware registration.
  * 13+ has only context-aware registration.
  * 12 and older have neither.
+ *
+ * Where we can, we register as context-aware, without which Node will not
+ * load a module into a worker thread.
  */
 #if NODE_MODULE_VERSION - 13 > 0
 #define	NODE_MODULE_STRUCT	node::node_module
@@ -208,9 +250,10 @@ do {						\
 	_nmp->nm_flags = _mdp->vmd_nodeflags;	\
 	_nmp->nm_dso_handle = NULL;		\
 	_nmp->nm_filename = _mdp->vmd_filename;	\
-	_nmp->nm_register_func =		\
-	    (node::addon_register_func)v8plus::ObjectWrap::init;	\
-	_nmp->nm_context_register_func = NULL;	\
+	_nmp->nm_register_func = NULL;		\
+	_nmp->nm_context_register_func =	\
+	    (node::addon_context_register_func)	\
+	    v8plus::ObjectWrap::init_context;	\
 	_nmp->nm_modname = _mdp->vmd_modname;	\
 	_nmp->nm_priv = _mdp;			\
 	_nmp->nm_link = NULL;			\
@@ -269,6 +312,11 @@ class ObjectWrap;
 class ObjectWrap : public node::ObjectWrap {
 public:
 	static void init(v8::Handle<v8::Object>, v8::Handle<v8::Value>, void *);
+#if NODE_MODULE_VERSION - 13 > 0
+	static void init_context(v8::Handle<v8::Object>, v8::Handle<v8::Value>,
+	    v8::Handle<v8::Context>, void *);
+#endif
+	static void fini(void);
 	static V8_JS_FUNC_DECL(cons);
 	static ObjectWrap *objlookup(const void *);
 	v8::Handle<v8::Value> call(const char *, int, v8::Handle<v8::Value>[]);
@@ -276,7 +324,8 @@ public:
 	void public_Unref(void);
 
 private:
-	static std::unordered_map<void *, ObjectWrap *> _objhash;
+	static __thread std::unordered_map<void *, ObjectWrap *> *_objhash_p;
+	static std::unordered_map<void *, ObjectWrap *> &objhash(void);
 	void *_c_impl;
 	void *_defn;
 
@@ -286,11 +335,14 @@ private:
 	static V8_JS_FUNC_DECL(_new);
 	static V8_JS_FUNC_DECL(_entry);
 	static V8_JS_FUNC_DECL(_static_entry);
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+	static V8_JS_FUNC_DECL(_counters);
+#endif
 };
 
 extern nvlist_t *v8_Arguments_to_nvlist(const V8_ARGUMENTS &);
 extern v8::Handle<v8::Value> nvpair_to_v8_Value(ISOLATE_OR_UNUSED(_),
-    const nvpair_t *);
+    const nvlist_t *, const nvpair_t *);
 extern v8::Handle<v8::Value> exception(const nvlist_t *);
 
 }; /* namespace v8plus */
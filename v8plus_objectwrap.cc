@@ -5,6 +5,7 @@
 #include <sys/types.h>
 #include <sys/debug.h>
 #include <string.h>
+#include <errno.h>
 #include <new>
 #include <unordered_map>
 #include <stdlib.h>
@@ -22,7 +23,12 @@ typedef struct v8plus_func_ctx {
 } v8plus_func_ctx_t;
 }
 
-std::unordered_map<void *, v8plus::ObjectWrap *> v8plus::ObjectWrap::_objhash;
+/*
+ * Objects belong to the event loop thread on which they were created; each
+ * such thread has its own table of them.
+ */
+__thread std::unordered_map<void *, v8plus::ObjectWrap *> *
+    v8plus::ObjectWrap::_objhash_p;
 
 /*
  * There are three degrees of freedom that together determine how we are
@@ -107,18 +113,27 @@ v8plus::ObjectWrap::init(v8::Handle<v8::Object> target,
 	    integrated_module;
 #endif
 
-	for (i = 0; i < mdp->vmd_static_method_count; i++) {
+	/*
+	 * The consumer's static functions are followed by those v8plus
+	 * itself provides to every module.
+	 */
+	for (i = 0; i < mdp->vmd_static_method_count +
+	    v8plus_builtin_static_count; i++) {
+		const v8plus_static_descr_t *sdp =
+		    (i < mdp->vmd_static_method_count) ?
+		    &mdp->vmd_static_methods[i] :
+		    &v8plus_builtin_statics[i - mdp->vmd_static_method_count];
+
 		fcp = new (std::nothrow) v8plus_func_ctx_t;
-		name = mdp->vmd_static_methods[i].sd_name;
+		name = sdp->sd_name;
 
 		if (fcp == NULL) {
 			v8plus_panic("out of memory for context for [%s]%s.%s",
-			    mdp->vmd_modname, mdp->vmd_js_class_name,
-			    mdp->vmd_static_methods[i].sd_name);
+			    mdp->vmd_modname, mdp->vmd_js_class_name, name);
 		}
 
 		fcp->vfc_defn = mdp;
-		fcp->vfc_static = &mdp->vmd_static_methods[i];
+		fcp->vfc_static = sdp;
 		fcp->vfc_method = NULL;
 
 		v8::Local<v8::External> ext = V8_EXTERNAL_NEW(iso, fcp);
@@ -186,7 +201,86 @@ v8plus::ObjectWrap::init(v8::Handle<v8::Object> target,
 		    GetFunction());
 	}
 
-	v8plus_crossthread_init();
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+	/*
+	 * Counter blocks are returned as typed arrays, which cannot pass
+	 * through an nvlist, so this is attached directly rather than as one
+	 * of the builtin statics.
+	 */
+	v8::Local<v8::Function> cfh = V8_FUNCTMPL_NEW(iso, _counters,
+	    v8::Local<v8::Value>())->GetFunction();
+
+	cfh->SetName(V8_STRING_NEW(iso, "v8plus_counters"));
+	target->Set(V8_SYMBOL_NEW(iso, "v8plus_counters"), cfh);
+#endif
+
+	v8plus_crossthread_init(V8PLUS_EVENT_LOOP(iso));
+}
+
+#if NODE_VERSION_AT_LEAST(10, 0, 0)
+static void
+v8plus_env_cleanup(void *arg __UNUSED)
+{
+	v8plus_crossthread_fini();
+}
+#endif
+
+#if NODE_MODULE_VERSION - 13 > 0
+/*
+ * We register as context-aware, so that Node will load us into worker
+ * threads as well as the main thread.  Each environment into which we are
+ * loaded, and its event loop, may later be torn down without the process
+ * exiting, as when a worker thread exits; when that happens, we tear down
+ * our own state for the loop.
+ */
+void
+v8plus::ObjectWrap::init_context(v8::Handle<v8::Object> target,
+    v8::Handle<v8::Value> module, v8::Handle<v8::Context> context __UNUSED,
+    void *priv)
+{
+	init(target, module, priv);
+
+#if NODE_VERSION_AT_LEAST(10, 0, 0)
+	DECLARE_ISOLATE_FROM_OBJECT(iso, target);
+
+	node::AddEnvironmentCleanupHook(iso, v8plus_env_cleanup, NULL);
+#endif
+}
+#endif
+
+/*
+ * Destroy every object still alive on this thread's event loop as it exits,
+ * running the consumer's destructor for each.  The destructor removes the
+ * object from the table, so the objects are gathered first.
+ */
+void
+v8plus::ObjectWrap::fini(void)
+{
+	std::unordered_map<void *, v8plus::ObjectWrap *>::iterator it;
+	v8plus::ObjectWrap **ops;
+	size_t i, n;
+
+	if (_objhash_p == NULL)
+		return;
+
+	n = objhash().size();
+	if ((ops = new (std::nothrow) v8plus::ObjectWrap *[n]) == NULL)
+		v8plus_panic("out of memory for objects to destroy");
+
+	for (i = 0, it = objhash().begin(); it != objhash().end(); ++it)
+		ops[i++] = it->second;
+	for (i = 0; i < n; i++)
+		delete ops[i];
+
+	delete[] ops;
+	delete _objhash_p;
+	_objhash_p = NULL;
+}
+
+extern "C" void
+v8plus_obj_fini(void)
+{
+	v8plus::ObjectWrap::fini();
 }
 
 V8_JS_FUNC_DEFN(v8plus::ObjectWrap::_new, args)
@@ -223,7 +317,8 @@ V8_JS_FUNC_DEFN(v8plus::ObjectWrap::_new, args)
 	}
 
 	op->_defn = fcp->vfc_defn;
-	_objhash.insert(std::make_pair(op->_c_impl, op));
+	objhash().insert(std::make_pair(op->_c_impl, op));
+	v8plus_obj_register(op->_c_impl);
 	op->Wrap(args.This());
 
 	V8_JS_FUNC_RETURN(args, args.This());
@@ -244,8 +339,9 @@ v8plus::ObjectWrap::~ObjectWrap()
 		return;
 	}
 
+	v8plus_obj_unregister(_c_impl);
 	mdp->vmd_dtor(_c_impl);
-	(void) _objhash.erase(_c_impl);
+	(void) objhash().erase(_c_impl);
 }
 
 V8_JS_FUNC_DEFN(v8plus::ObjectWrap::cons, args)
@@ -268,12 +364,21 @@ V8_JS_FUNC_DEFN(v8plus::ObjectWrap::cons, args)
 	V8_JS_FUNC_RETURN_CLOSE(args, scope, instance);
 }
 
+std::unordered_map<void *, v8plus::ObjectWrap *> &
+v8plus::ObjectWrap::objhash(void)
+{
+	if (_objhash_p == NULL)
+		_objhash_p = new std::unordered_map<void *, ObjectWrap *>();
+
+	return (*_objhash_p);
+}
+
 v8plus::ObjectWrap *
 v8plus::ObjectWrap::objlookup(const void *cop)
 {
 	std::unordered_map<void *, v8plus::ObjectWrap *>::iterator it;
 
-	if ((it = _objhash.find(const_cast<void *>(cop))) == _objhash.end())
+	if ((it = objhash().find(const_cast<void *>(cop))) == objhash().end())
 		v8plus_panic("unable to find C++ wrapper for %p\n", cop);
 
 	return (it->second);
@@ -326,7 +431,7 @@ V8_JS_FUNC_DEFN(v8plus::ObjectWrap::_entry, args)
 			v8plus_panic("bad encoded value in return");
 		} else {
 			v8::Handle<v8::Value> r =
-			    V8PLUS_NVPAIR_TO_V8_VALUE(iso, rpp);
+			    V8PLUS_NVPAIR_TO_V8_VALUE(iso, c_out, rpp);
 			nvlist_free(c_out);
 			V8_JS_FUNC_RETURN_CLOSE(args, scope, r);
 		}
@@ -374,7 +479,7 @@ V8_JS_FUNC_DEFN(v8plus::ObjectWrap::_static_entry, args)
 			v8plus_panic("bad encoded value in return");
 		} else {
 			v8::Handle<v8::Value> r =
-			    V8PLUS_NVPAIR_TO_V8_VALUE(iso, rpp);
+			    V8PLUS_NVPAIR_TO_V8_VALUE(iso, c_out, rpp);
 			nvlist_free(c_out);
 			V8_JS_FUNC_RETURN_CLOSE(args, scope, r);
 		}
@@ -384,6 +489,43 @@ V8_JS_FUNC_DEFN(v8plus::ObjectWrap::_static_entry, args)
 	V8_JS_FUNC_RETURN_UNDEFINED;
 }
 
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+/*
+ * Returns a Float64Array over the memory of the named counter block.  The
+ * block is never freed, so the array's backing store is left external and
+ * is never released by V8.
+ */
+V8_JS_FUNC_DEFN(v8plus::ObjectWrap::_counters, args)
+{
+	HANDLE_SCOPE(scope);
+	DECLARE_ISOLATE_FROM_ARGS(iso, args);
+	uint_t count;
+	void *words;
+
+	v8plus_clear_exception();
+
+	if (args.Length() != 1 || !args[0]->IsString()) {
+		(void) v8plus_error(V8PLUSERR_BADARG,
+		    "counter block name must be a string");
+		V8_JS_FUNC_RETURN(args, V8PLUS_THROW_PENDING());
+	}
+
+	v8::String::Utf8Value name(args[0]);
+
+	if ((words = v8plus_counters_lookup(*name, &count)) == NULL) {
+		(void) v8plus_syserr(ENOENT, "no counter block named %s",
+		    *name);
+		V8_JS_FUNC_RETURN(args, V8PLUS_THROW_PENDING());
+	}
+
+	v8::Local<v8::ArrayBuffer> ab = v8::ArrayBuffer::New(iso, words,
+	    count * sizeof (double));
+
+	V8_JS_FUNC_RETURN_CLOSE(args, scope,
+	    v8::Float64Array::New(ab, 0, count));
+}
+#endif
+
 v8::Handle<v8::Value>
 v8plus::ObjectWrap::call(const char *name,
     int argc, v8::Handle<v8::Value> argv[])
@@ -6,13 +6,16 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <alloca.h>
 #include <dlfcn.h>
 #include <libnvpair.h>
 #include <node.h>
+#include <node_buffer.h>
 #include <v8.h>
 #include <unordered_map>
 #include <string>
+#include <vector>
 #include "v8plus_c_impl.h"
 #include "v8plus_impl.h"
 
@@ -48,10 +51,13 @@
 #define	V8_EXCEPTION_CTOR_ARGS	v8::Handle<v8::String>
 #endif
 
+/*
+ * A handle to a function, or to a Buffer passed to C in place; both are
+ * held and released in the same way.
+ */
 typedef struct cb_hdl {
-	v8::Handle<v8::Function> ch_hdl;
-	v8::Persistent<v8::Function> ch_phdl;
-	uint_t ch_refs;
+	v8::Handle<v8::Object> ch_hdl;
+	v8::Persistent<v8::Object> ch_phdl;
 	boolean_t ch_persist;
 
 /*
@@ -69,7 +75,6 @@ typedef struct cb_hdl {
 		} else {
 			this->ch_hdl = src.ch_hdl;
 		}
-		this->ch_refs = src.ch_refs;
 		this->ch_persist = src.ch_persist;
 	}
 	struct cb_hdl &operator=(const struct cb_hdl &src) {
@@ -79,7 +84,6 @@ typedef struct cb_hdl {
 		} else {
 			this->ch_hdl = src.ch_hdl;
 		}
-		this->ch_refs = src.ch_refs;
 		this->ch_persist = src.ch_persist;
 
 		return (*this);
@@ -87,8 +91,79 @@ typedef struct cb_hdl {
 #endif
 } cb_hdl_t;
 
-static std::unordered_map<uint64_t, cb_hdl_t> cbhash;
-static uint64_t cbnext;
+typedef std::unordered_map<uint64_t, cb_hdl_t> cbhash_t;
+
+/*
+ * Function handles belong to the event loop (and thus the isolate) on which
+ * they were created, so each event loop thread has its own table.  Handle
+ * numbers start from a per-loop base so that a handle alone identifies the
+ * loop to which calls and releases must be sent.
+ */
+static __thread cbhash_t *cbhash_p;
+static __thread uint64_t cbnext;
+
+static cbhash_t &
+cbhash(void)
+{
+	if (cbhash_p == NULL) {
+		cbhash_p = new cbhash_t();
+		cbnext = v8plus_jsfunc_base();
+	}
+
+	return (*cbhash_p);
+}
+
+/*
+ * Enters an object into the handle table with a single hold, returning its
+ * handle.  The last release will call v8plus_eventloop_rele_direct() to
+ * release the event loop hold implicit in a jsfunc hold.  So that our holds
+ * and releases are balanced, we take an event loop hold here.
+ */
+static uint64_t
+cbhash_add(const v8::Handle<v8::Object> &oh)
+{
+	cb_hdl_t ch;
+
+	ch.ch_hdl = oh;
+	ch.ch_persist = _B_FALSE;
+
+	v8plus_eventloop_hold();
+
+	while (cbhash().find(cbnext) != cbhash().end())
+		++cbnext;
+	cbhash().insert(std::make_pair(cbnext, ch));
+	v8plus_jsfunc_register(cbnext);
+
+	return (cbnext);
+}
+
+static v8::Handle<v8::Object>
+cbhash_object(uint64_t f)
+{
+	cbhash_t::iterator it;
+
+	if ((it = cbhash().find(f)) == cbhash().end())
+		v8plus_panic("callback hash tag %llu not found",
+		    (unsigned long long)f);
+
+	if (it->second.ch_persist)
+		return (V8_LOCAL(it->second.ch_phdl, v8::Object));
+
+	return (it->second.ch_hdl);
+}
+
+static v8::Handle<v8::Function>
+cbhash_function(uint64_t f)
+{
+	v8::Handle<v8::Object> oh = cbhash_object(f);
+
+	if (!oh->IsFunction())
+		v8plus_panic("callback hash tag %llu is not a function",
+		    (unsigned long long)f);
+
+	return (v8::Handle<v8::Function>::Cast(oh));
+}
+
 static void (*__real_nvlist_free)(nvlist_t *);
 static int nvlist_add_v8_Value(nvlist_t *,
     const char *, const v8::Handle<v8::Value> &);
@@ -118,6 +193,85 @@ cstr(const v8::String::Utf8Value &v)
 	if (((_e) = nvlist_add_##_t##_array((_l), (_n), (_v), (_c))) != 0) \
 		return (_e)
 
+/*
+ * Callers often pass us many objects with the same properties, such as an
+ * array of records.  To avoid converting each property name to a C string
+ * for every such object, each event loop thread keeps, for each number of
+ * properties up to a limit, the names of the properties of the last object
+ * converted that had that many, along with their C strings; a property whose
+ * name is the same string as the cached one at its position, as it almost
+ * always is for objects of the same shape, then reuses the C string.  A
+ * nested object of the same size as the one containing it cannot use the
+ * same slot while the outer object is being converted.
+ */
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+#define	KEYCACHE_MAX_KEYS	64
+
+typedef struct keycache_slot {
+	boolean_t kcs_busy;
+	v8::Persistent<v8::Value> kcs_keys[KEYCACHE_MAX_KEYS];
+	std::string kcs_names[KEYCACHE_MAX_KEYS];
+} keycache_slot_t;
+
+static __thread keycache_slot_t *keycache[KEYCACHE_MAX_KEYS];
+static __thread v8::Persistent<v8::String> *object_name_p;
+
+static keycache_slot_t *
+keycache_get(uint_t nkeys)
+{
+	keycache_slot_t *ksp;
+
+	if (nkeys == 0 || nkeys > KEYCACHE_MAX_KEYS)
+		return (NULL);
+
+	if ((ksp = keycache[nkeys - 1]) == NULL)
+		ksp = keycache[nkeys - 1] = new keycache_slot_t();
+
+	if (ksp->kcs_busy)
+		return (NULL);
+
+	ksp->kcs_busy = _B_TRUE;
+
+	return (ksp);
+}
+
+static const char *
+keycache_name(v8::Isolate *iso, keycache_slot_t *ksp, uint_t i,
+    const v8::Local<v8::Value> &mk)
+{
+	if (ksp->kcs_keys[i].IsEmpty() || !mk->StrictEquals(
+	    v8::Local<v8::Value>::New(iso, ksp->kcs_keys[i]))) {
+		v8::String::Utf8Value mks(mk);
+
+		ksp->kcs_names[i] = cstr(mks);
+		ksp->kcs_keys[i].Reset(iso, mk);
+	}
+
+	return (ksp->kcs_names[i].c_str());
+}
+#endif
+
+/*
+ * Most objects passed to us are plain Objects, which we can recognise by
+ * comparing the constructor name with an internalized "Object" rather than
+ * by converting it to a C string.
+ */
+static boolean_t
+is_plain_object(ISOLATE_OR_UNUSED(iso), const v8::Local<v8::String> &th)
+{
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+	if (object_name_p == NULL) {
+		object_name_p = new v8::Persistent<v8::String>(iso,
+		    V8_SYMBOL_NEW(iso, "Object"));
+	}
+
+	return (th->StrictEquals(v8::Local<v8::String>::New(iso,
+	    *object_name_p)) ? _B_TRUE : _B_FALSE);
+#else
+	return (_B_FALSE);
+#endif
+}
+
 static int
 v8_Object_to_nvlist(const v8::Handle<v8::Value> &vh, nvlist_t *lp)
 {
@@ -125,15 +279,18 @@ v8_Object_to_nvlist(const v8::Handle<v8::Value> &vh, nvlist_t *lp)
 	DECLARE_ISOLATE_FROM_OBJECT(iso, oh);
 	v8::Local<v8::Array> keys = oh->GetPropertyNames();
 	v8::Local<v8::String> th = oh->GetConstructorName();
-	v8::String::Utf8Value tv(th);
-	const char *type = cstr(tv);
 	boolean_t is_excp = _B_FALSE;
-	uint_t i;
-	int err;
+	uint_t i, nkeys;
+	int err = 0;
 
-	/* XXX this is vile; can we handle this generally? */
-	if (strcmp(type, "Object") != 0) {
-		if (strcmp(type, "Error") == 0 ||
+	if (!is_plain_object(ISOLATE_OR_NULL(iso), th)) {
+		v8::String::Utf8Value tv(th);
+		const char *type = cstr(tv);
+
+		/* XXX this is vile; can we handle this generally? */
+		if (strcmp(type, "Object") == 0) {
+			/* nothing to record */
+		} else if (strcmp(type, "Error") == 0 ||
 		    strcmp(type, "TypeError") == 0 ||
 		    strcmp(type, "RangeError") == 0 ||
 		    strcmp(type, "ReferenceError") == 0 ||
@@ -169,25 +326,152 @@ v8_Object_to_nvlist(const v8::Handle<v8::Value> &vh, nvlist_t *lp)
 			return (err);
 	}
 
-	for (i = 0; i < keys->Length(); i++) {
-		char knname[11];
-		v8::Local<v8::Value> mk;
-		v8::Local<v8::Value> mv;
-		const char *k;
+	nkeys = keys->Length();
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+	keycache_slot_t *ksp = keycache_get(nkeys);
+
+	if (ksp != NULL) {
+		for (i = 0; i < nkeys && err == 0; i++) {
+			v8::Local<v8::Value> mk = keys->Get(i);
+			v8::Local<v8::Value> mv = oh->Get(mk);
+
+			err = nvlist_add_v8_Value(lp,
+			    keycache_name(iso, ksp, i, mk), mv);
+		}
+		ksp->kcs_busy = _B_FALSE;
 
-		(void) snprintf(knname, sizeof (knname), "%u", i);
-		mk = keys->Get(V8_STRING_NEW(iso, knname));
-		mv = oh->Get(mk);
+		return (err);
+	}
+#endif
+
+	for (i = 0; i < nkeys; i++) {
+		v8::Local<v8::Value> mk = keys->Get(i);
+		v8::Local<v8::Value> mv = oh->Get(mk);
 		v8::String::Utf8Value mks(mk);
-		k = cstr(mks);
 
-		if ((err = nvlist_add_v8_Value(lp, k, mv)) != 0)
+		if ((err = nvlist_add_v8_Value(lp, cstr(mks), mv)) != 0)
 			return (err);
 	}
 
 	return (0);
 }
 
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+#define	LA_TA(_l, _n, _th, _ct, _t, _e)					\
+	LA_VA(_l, _t, _n, (_ct *)V8_TYPED_ARRAY_DATA(_th), (_th)->Length(), _e)
+
+/*
+ * Typed arrays are added as arrays of the corresponding integer type, and
+ * floating-point arrays as arrays of doubles (see v8plus_arg_value()), so
+ * that C gets the elements in one piece.
+ */
+static int
+nvlist_add_typed_array(nvlist_t *lp, const char *name,
+    const v8::Handle<v8::Value> &vh)
+{
+	v8::Local<v8::TypedArray> th = v8::Local<v8::TypedArray>::Cast(vh);
+	int err = 0;
+
+	if (vh->IsInt8Array()) {
+		LA_TA(lp, name, th, int8_t, int8, err);
+	} else if (vh->IsUint8Array() || vh->IsUint8ClampedArray()) {
+		LA_TA(lp, name, th, uint8_t, uint8, err);
+	} else if (vh->IsInt16Array()) {
+		LA_TA(lp, name, th, int16_t, int16, err);
+	} else if (vh->IsUint16Array()) {
+		LA_TA(lp, name, th, uint16_t, uint16, err);
+	} else if (vh->IsInt32Array()) {
+		LA_TA(lp, name, th, int32_t, int32, err);
+	} else if (vh->IsUint32Array()) {
+		LA_TA(lp, name, th, uint32_t, uint32, err);
+	} else if (vh->IsFloat64Array()) {
+		LA_TA(lp, name, th, int64_t, int64, err);
+	} else if (vh->IsFloat32Array()) {
+		const float *fp = (const float *)V8_TYPED_ARRAY_DATA(th);
+		uint_t i, n = th->Length();
+		double *dp;
+
+		dp = new double[n];
+		for (i = 0; i < n; i++)
+			dp[i] = fp[i];
+		err = nvlist_add_int64_array(lp, name, (int64_t *)dp, n);
+		delete[] dp;
+	} else {
+		return (EINVAL);
+	}
+
+	if (err == 0 && (vh->IsFloat64Array() || vh->IsFloat32Array()))
+		err = v8plus_number_array_mark(lp, name);
+
+	return (err);
+}
+
+#undef	LA_TA
+
+/*
+ * Arrays whose elements are all numbers, all booleans or all strings are
+ * added as nvlist arrays when dense arrays are enabled.  Returns ENOTSUP for
+ * any other array, which is then added as an object as usual.
+ */
+static int
+nvlist_add_dense_array(nvlist_t *lp, const char *name,
+    const v8::Handle<v8::Value> &vh)
+{
+	v8::Local<v8::Array> ah = v8::Local<v8::Array>::Cast(vh);
+	uint_t i, n = ah->Length();
+	v8::Local<v8::Value> eh;
+	int err;
+
+	if (n == 0)
+		return (ENOTSUP);
+
+	eh = ah->Get(0);
+	if (eh->IsNumber()) {
+		double *dp = new double[n];
+
+		for (i = 0; i < n; i++) {
+			if (!(eh = ah->Get(i))->IsNumber()) {
+				delete[] dp;
+				return (ENOTSUP);
+			}
+			dp[i] = eh->NumberValue();
+		}
+		err = nvlist_add_int64_array(lp, name, (int64_t *)dp, n);
+		delete[] dp;
+		if (err == 0)
+			err = v8plus_number_array_mark(lp, name);
+	} else if (eh->IsBoolean()) {
+		boolean_t *bp = new boolean_t[n];
+
+		for (i = 0; i < n; i++) {
+			if (!(eh = ah->Get(i))->IsBoolean()) {
+				delete[] bp;
+				return (ENOTSUP);
+			}
+			bp[i] = eh->BooleanValue() ? _B_TRUE : _B_FALSE;
+		}
+		err = nvlist_add_boolean_array(lp, name, bp, n);
+		delete[] bp;
+	} else if (eh->IsString()) {
+		std::vector<std::string> sv(n);
+		std::vector<char *> sp(n);
+
+		for (i = 0; i < n; i++) {
+			if (!(eh = ah->Get(i))->IsString())
+				return (ENOTSUP);
+			v8::String::Utf8Value s(eh);
+			sv[i] = cstr(s);
+			sp[i] = const_cast<char *>(sv[i].c_str());
+		}
+		err = nvlist_add_string_array(lp, name, &sp[0], n);
+	} else {
+		return (ENOTSUP);
+	}
+
+	return (err);
+}
+#endif
+
 static void
 v8plus_throw_v8_exception(const v8::Handle<v8::Value> &vh)
 {
@@ -208,8 +492,13 @@ v8plus_throw_v8_exception(const v8::Handle<v8::Value> &vh)
  * Booleans and their Object type are encoded as boolean_value.
  * Numbers and their Object type are encoded as double.
  * Strings and their Object type are encoded as C strings (and assumed UTF-8).
- * Any Object (including an Array) is encoded as an nvlist whose elements
- * are the Object's own properties.
+ * Typed arrays are encoded as arrays of the corresponding type, and Arrays
+ * of all numbers, all booleans or all strings likewise if dense arrays are
+ * enabled (Node 0.12 and later).
+ * Buffers are encoded in place as the handle, address and length of their
+ * contents, in a uint64 array.
+ * Any other Object (including an Array) is encoded as an nvlist whose
+ * elements are the Object's own properties.
  * Null is encoded as a byte with value 0.
  * Undefined is encoded as the valueless boolean.
  *
@@ -247,28 +536,36 @@ nvlist_add_v8_Value(nvlist_t *lp, const char *name,
 		boolean_t vv = vh->BooleanValue() ? _B_TRUE : _B_FALSE;
 		LA_V(lp, boolean_value, name, vv, err);
 	} else if (vh->IsFunction()) {
-		cb_hdl_t ch;
-
-		ch.ch_hdl = v8::Handle<v8::Function>::Cast(vh);
-		ch.ch_refs = 1;
-		ch.ch_persist = _B_FALSE;
+		/*
+		 * We create the callback handle with a single hold; i.e. it
+		 * is created in the held state.
+		 */
+		uint64_t f = cbhash_add(v8::Handle<v8::Object>::Cast(vh));
 
+		LA_VA(lp, string, V8PLUS_JSF_COOKIE, NULL, 0, err);
+		LA_VA(lp, uint64, name, &f, 1, err);
+	} else if (node::Buffer::HasInstance(vh)) {
 		/*
-		 * We create the callback handle with its reference count set
-		 * to 1; i.e. it is created in the held state.  Each call to
-		 * v8plus_jsfunc_rele() will call v8plus_eventloop_rele() to
-		 * release the event loop hold implicit in a jsfunc hold.
-		 * So that our holds and releases are balanced, we take an
-		 * event loop hold here:
+		 * A Buffer is passed in place as its handle, the address of
+		 * its contents and its length.  The handle's hold keeps the
+		 * Buffer alive for as long as the list we add it to.
 		 */
-		v8plus_eventloop_hold();
+		v8::Local<v8::Object> oh = vh->ToObject();
+		uint64_t bv[V8PLUS_BUFFER_NVALS];
 
-		while (cbhash.find(cbnext) != cbhash.end())
-			++cbnext;
-		cbhash.insert(std::make_pair(cbnext, ch));
+		bv[0] = cbhash_add(oh);
+		bv[1] = (uint64_t)(uintptr_t)node::Buffer::Data(oh);
+		bv[2] = (uint64_t)node::Buffer::Length(oh);
 
 		LA_VA(lp, string, V8PLUS_JSF_COOKIE, NULL, 0, err);
-		LA_VA(lp, uint64, name, &cbnext, 1, err);
+		LA_VA(lp, uint64, name, bv, V8PLUS_BUFFER_NVALS, err);
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+	} else if (vh->IsTypedArray()) {
+		return (nvlist_add_typed_array(lp, name, vh));
+	} else if (vh->IsArray() && v8plus_dense_arrays_enabled() &&
+	    (err = nvlist_add_dense_array(lp, name, vh)) != ENOTSUP) {
+		return (err);
+#endif
 	} else if (vh->IsObject()) {
 		nvlist_t *vlp;
 
@@ -317,6 +614,199 @@ v8plus::v8_Arguments_to_nvlist(const V8_ARGUMENTS &args)
 	return (lp);
 }
 
+/*
+ * Property names, and string values short enough that they are likely to
+ * be names of a sort as well, recur throughout the objects we return to
+ * JavaScript.  Rather than allocating a new string for each occurrence, we
+ * keep the most recently used of them as internalized strings in a cache
+ * with least-recently-used eviction.  Strings belong to an isolate, and so
+ * each event loop thread has its own cache.
+ */
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+#define	STRCACHE_MAX_ENTRIES	2048
+#define	STRCACHE_MAX_LEN	32
+
+typedef struct strcache_ent {
+	std::string sce_key;
+	v8::Persistent<v8::String> sce_str;
+	struct strcache_ent *sce_prev;		/* more recently used */
+	struct strcache_ent *sce_next;		/* less recently used */
+} strcache_ent_t;
+
+typedef struct strcache {
+	std::unordered_map<std::string, strcache_ent_t *> sc_map;
+	strcache_ent_t *sc_head;
+	strcache_ent_t *sc_tail;
+} strcache_t;
+
+static __thread strcache_t *strcache_p;
+
+static void
+strcache_unlink(strcache_t *scp, strcache_ent_t *ep)
+{
+	if (ep->sce_prev != NULL)
+		ep->sce_prev->sce_next = ep->sce_next;
+	else
+		scp->sc_head = ep->sce_next;
+
+	if (ep->sce_next != NULL)
+		ep->sce_next->sce_prev = ep->sce_prev;
+	else
+		scp->sc_tail = ep->sce_prev;
+}
+
+static void
+strcache_push(strcache_t *scp, strcache_ent_t *ep)
+{
+	ep->sce_prev = NULL;
+	ep->sce_next = scp->sc_head;
+	if (scp->sc_head != NULL)
+		scp->sc_head->sce_prev = ep;
+	else
+		scp->sc_tail = ep;
+	scp->sc_head = ep;
+}
+#endif
+
+static v8::Local<v8::String>
+cached_string(ISOLATE_OR_UNUSED(iso), const char *str)
+{
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+	std::unordered_map<std::string, strcache_ent_t *>::iterator it;
+	strcache_t *scp = strcache_p;
+	strcache_ent_t *ep;
+	v8::Local<v8::String> sh;
+
+	if (strlen(str) > STRCACHE_MAX_LEN)
+		return (V8_STRING_NEW(iso, str));
+
+	if (scp == NULL)
+		scp = strcache_p = new strcache_t();
+
+	if ((it = scp->sc_map.find(str)) != scp->sc_map.end()) {
+		ep = it->second;
+		if (ep != scp->sc_head) {
+			strcache_unlink(scp, ep);
+			strcache_push(scp, ep);
+		}
+		return (v8::Local<v8::String>::New(iso, ep->sce_str));
+	}
+
+	sh = V8_SYMBOL_NEW(iso, str);
+
+	if (scp->sc_map.size() >= STRCACHE_MAX_ENTRIES) {
+		ep = scp->sc_tail;
+		strcache_unlink(scp, ep);
+		scp->sc_map.erase(ep->sce_key);
+		ep->sce_str.Reset();
+	} else {
+		ep = new strcache_ent_t;
+	}
+
+	ep->sce_key = str;
+	ep->sce_str.Reset(iso, sh);
+	strcache_push(scp, ep);
+	scp->sc_map.insert(std::make_pair(ep->sce_key, ep));
+
+	return (sh);
+#else
+	return (V8_STRING_NEW(iso, str));
+#endif
+}
+
+/*
+ * Members added by v8plus itself to mark what a list holds, which are not
+ * passed on to JavaScript.
+ */
+static boolean_t
+hidden_member(const nvpair_t *pp)
+{
+	const char *name = nvpair_name(const_cast<nvpair_t *>(pp));
+
+	return (strcmp(name, V8PLUS_OBJ_TYPE_MEMBER) == 0 ||
+	    strcmp(name, V8PLUS_JSF_COOKIE) == 0 ||
+	    strcmp(name, V8PLUS_NUM_COOKIE) == 0 ? _B_TRUE : _B_FALSE);
+}
+
+/*
+ * Objects built by adding properties one at a time take V8 through a chain
+ * of hidden class transitions, and objects with the same properties added in
+ * a different order end up with different hidden classes.  Callers commonly
+ * return many objects with the same properties in the same order, so we
+ * keep an object template for each such sequence of names seen, from which
+ * an object already having those properties, and thus the final hidden
+ * class, can be created in one step; setting the properties then changes
+ * only their values.  Templates belong to an isolate, so each event loop
+ * thread has its own set.  V8 keeps every template it has instantiated for
+ * the life of the context, whether or not we still refer to it, so the set
+ * is never emptied: once it is full, objects of shapes not already in it are
+ * built as before, as are objects with more properties than are likely to be
+ * kept in fast mode.
+ */
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+#define	SHAPECACHE_MAX_ENTRIES	512
+#define	SHAPECACHE_MAX_PROPS	64
+
+typedef std::unordered_map<std::string,
+    v8::Persistent<v8::ObjectTemplate> *> shapecache_t;
+
+static __thread shapecache_t *shapecache_p;
+#endif
+
+static v8::Local<v8::Object>
+shaped_object(ISOLATE_OR_UNUSED(iso), const nvlist_t *lp)
+{
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+	shapecache_t::iterator it;
+	shapecache_t *scp = shapecache_p;
+	v8::Persistent<v8::ObjectTemplate> *ptp;
+	v8::Local<v8::ObjectTemplate> th;
+	nvpair_t *pp = NULL;
+	std::string shape;
+	uint_t n = 0;
+
+	while ((pp =
+	    nvlist_next_nvpair(const_cast<nvlist_t *>(lp), pp)) != NULL) {
+		if (hidden_member(pp))
+			continue;
+		if (++n > SHAPECACHE_MAX_PROPS)
+			return (V8_OBJECT_NEW(iso));
+		shape.append(nvpair_name(pp));
+		shape.push_back('\0');
+	}
+
+	if (n == 0)
+		return (V8_OBJECT_NEW(iso));
+
+	if (scp == NULL)
+		scp = shapecache_p = new shapecache_t();
+
+	if ((it = scp->find(shape)) != scp->end()) {
+		th = v8::Local<v8::ObjectTemplate>::New(iso, *it->second);
+		return (th->NewInstance());
+	}
+
+	if (scp->size() >= SHAPECACHE_MAX_ENTRIES)
+		return (V8_OBJECT_NEW(iso));
+
+	th = v8::ObjectTemplate::New(iso);
+	while ((pp =
+	    nvlist_next_nvpair(const_cast<nvlist_t *>(lp), pp)) != NULL) {
+		if (hidden_member(pp))
+			continue;
+		th->Set(cached_string(iso, nvpair_name(pp)),
+		    V8_UNDEFINED(iso));
+	}
+
+	ptp = new v8::Persistent<v8::ObjectTemplate>(iso, th);
+	scp->insert(std::make_pair(shape, ptp));
+
+	return (th->NewInstance());
+#else
+	return (V8_OBJECT_NEW(iso));
+#endif
+}
+
 static void
 decorate_object(ISOLATE_OR_UNUSED(iso), v8::Local<v8::Object> &oh,
     const nvlist_t *lp)
@@ -325,10 +815,10 @@ decorate_object(ISOLATE_OR_UNUSED(iso), v8::Local<v8::Object> &oh,
 
 	while ((pp =
 	    nvlist_next_nvpair(const_cast<nvlist_t *>(lp), pp)) != NULL) {
-		if (strcmp(nvpair_name(pp), V8PLUS_OBJ_TYPE_MEMBER) == 0)
+		if (hidden_member(pp))
 			continue;
-		oh->Set(V8_STRING_NEW(iso, nvpair_name(pp)),
-		    V8PLUS_NVPAIR_TO_V8_VALUE(iso, pp));
+		oh->Set(cached_string(iso, nvpair_name(pp)),
+		    V8PLUS_NVPAIR_TO_V8_VALUE(iso, lp, pp));
 	}
 }
 
@@ -353,7 +843,7 @@ create_and_populate(ISOLATE_OR_UNUSED(iso), const nvlist_t *lp,
 		oh = array->ToObject();
 		is_array = _B_TRUE;
 	} else if (strcmp(type, "Object") == 0) {
-		oh = V8_OBJECT_NEW(iso);
+		oh = shaped_object(iso, lp);
 	} else {
 		/*
 		 * If this is neither an Array, nor an Object, we assume the
@@ -433,8 +923,63 @@ create_and_populate(ISOLATE_OR_UNUSED(iso), const nvlist_t *lp,
 		return (v8::_jt::New(USE_ISOLATE(_iso) (_xt)_v)); \
 	} while (0)
 
+/*
+ * Arrays of booleans and strings are created from all of their elements at
+ * once where V8 allows it, rather than by setting each index in turn.
+ */
+#if NODE_VERSION_AT_LEAST(10, 0, 0)
+#define	RETURN_JS_ARRAY(_iso, _p, _ct, _pt, _ev) \
+	do { \
+		_ct *_vp; \
+		uint_t _i, _n; \
+		(void) nvpair_value_##_pt##_array( \
+		    const_cast<nvpair_t *>(_p), &_vp, &_n); \
+		std::vector<v8::Local<v8::Value> > _ev_v(_n); \
+		for (_i = 0; _i < _n; _i++) \
+			_ev_v[_i] = (_ev); \
+		return (v8::Array::New(_iso, _ev_v.data(), _n)); \
+	} while (0)
+#else
+#define	RETURN_JS_ARRAY(_iso, _p, _ct, _pt, _ev) \
+	do { \
+		_ct *_vp; \
+		uint_t _i, _n; \
+		(void) nvpair_value_##_pt##_array( \
+		    const_cast<nvpair_t *>(_p), &_vp, &_n); \
+		v8::Local<v8::Array> _ah = \
+		    v8::Array::New(USE_ISOLATE(_iso) _n); \
+		for (_i = 0; _i < _n; _i++) \
+			_ah->Set(_i, (_ev)); \
+		return (_ah); \
+	} while (0)
+#endif
+
+/*
+ * Integer and number arrays become typed arrays over a single copy of the
+ * elements where we have them, and ordinary arrays of numbers otherwise.
+ */
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+#define	RETURN_JS_TYPED_ARRAY(_iso, _p, _jt, _ct, _pt) \
+	do { \
+		_ct *_vp; \
+		uint_t _n; \
+		(void) nvpair_value_##_pt##_array( \
+		    const_cast<nvpair_t *>(_p), &_vp, &_n); \
+		v8::Local<v8::ArrayBuffer> _bh = \
+		    v8::ArrayBuffer::New(_iso, _n * sizeof (_ct)); \
+		v8::Local<v8::_jt> _th = v8::_jt::New(_bh, 0, _n); \
+		bcopy(_vp, V8_TYPED_ARRAY_DATA(_th), _n * sizeof (_ct)); \
+		return (_th); \
+	} while (0)
+#else
+#define	RETURN_JS_TYPED_ARRAY(_iso, _p, _jt, _ct, _pt) \
+	RETURN_JS_ARRAY(_iso, _p, _ct, _pt, \
+	    v8::Number::New(USE_ISOLATE(_iso) (double)_vp[_i]))
+#endif
+
 v8::Handle<v8::Value>
-v8plus::nvpair_to_v8_Value(ISOLATE_OR_UNUSED(iso), const nvpair_t *pp)
+v8plus::nvpair_to_v8_Value(ISOLATE_OR_UNUSED(iso), const nvlist_t *lp,
+    const nvpair_t *pp)
 {
 	switch (nvpair_type(const_cast<nvpair_t *>(pp))) {
 	case DATA_TYPE_BOOLEAN:
@@ -476,11 +1021,10 @@ v8plus::nvpair_to_v8_Value(ISOLATE_OR_UNUSED(iso), const nvpair_t *pp)
 
 		(void) nvpair_value_string(const_cast<nvpair_t *>(pp), &vp);
 
-		return (V8_STRING_NEW(iso, vp));
+		return (cached_string(iso, vp));
 	}
 	case DATA_TYPE_UINT64_ARRAY:
 	{
-		std::unordered_map<uint64_t, cb_hdl_t>::iterator it;
 		uint64_t *vp;
 		uint_t nv;
 		int err;
@@ -488,14 +1032,50 @@ v8plus::nvpair_to_v8_Value(ISOLATE_OR_UNUSED(iso), const nvpair_t *pp)
 		if ((err = nvpair_value_uint64_array(const_cast<nvpair_t *>(pp),
 		    &vp, &nv)) != 0)
 			v8plus_panic("bad JSFUNC pair: %s", strerror(err));
-		if (nv != 1)
+		if (nv != 1 && nv != V8PLUS_BUFFER_NVALS)
 			v8plus_panic("bad uint64 array length %u", nv);
-		if ((it = cbhash.find(*vp)) == cbhash.end())
-			v8plus_panic("callback hash tag %llu not found",
-			    (unsigned long long)*vp);
 
-		return (it->second.ch_hdl);
+		return (cbhash_object(*vp));
+	}
+	case DATA_TYPE_INT64_ARRAY:
+	{
+		/*
+		 * Number arrays carry the bits of doubles; any other int64
+		 * array was added by C code and holds integers.
+		 */
+		if (!v8plus_number_array_marked(lp,
+		    nvpair_name(const_cast<nvpair_t *>(pp)))) {
+			RETURN_JS_ARRAY(iso, pp, int64_t, int64,
+			    v8::Number::New(USE_ISOLATE(iso) (double)_vp[_i]));
+		}
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+		RETURN_JS_TYPED_ARRAY(iso, pp, Float64Array, int64_t, int64);
+#else
+		double _d;
+
+		RETURN_JS_ARRAY(iso, pp, int64_t, int64,
+		    (bcopy(&_vp[_i], &_d, sizeof (_d)),
+		    v8::Number::New(USE_ISOLATE(iso) _d)));
+#endif
 	}
+	case DATA_TYPE_BOOLEAN_ARRAY:
+		RETURN_JS_ARRAY(iso, pp, boolean_t, boolean,
+		    v8::Boolean::New(USE_ISOLATE(iso) _vp[_i] != _B_FALSE));
+	case DATA_TYPE_STRING_ARRAY:
+		RETURN_JS_ARRAY(iso, pp, char *, string,
+		    cached_string(iso, _vp[_i]));
+	case DATA_TYPE_INT8_ARRAY:
+		RETURN_JS_TYPED_ARRAY(iso, pp, Int8Array, int8_t, int8);
+	case DATA_TYPE_UINT8_ARRAY:
+		RETURN_JS_TYPED_ARRAY(iso, pp, Uint8Array, uint8_t, uint8);
+	case DATA_TYPE_INT16_ARRAY:
+		RETURN_JS_TYPED_ARRAY(iso, pp, Int16Array, int16_t, int16);
+	case DATA_TYPE_UINT16_ARRAY:
+		RETURN_JS_TYPED_ARRAY(iso, pp, Uint16Array, uint16_t, uint16);
+	case DATA_TYPE_INT32_ARRAY:
+		RETURN_JS_TYPED_ARRAY(iso, pp, Int32Array, int32_t, int32);
+	case DATA_TYPE_UINT32_ARRAY:
+		RETURN_JS_TYPED_ARRAY(iso, pp, Uint32Array, uint32_t, uint32);
 	case DATA_TYPE_NVLIST:
 	{
 		nvlist_t *lp;
@@ -514,6 +1094,8 @@ v8plus::nvpair_to_v8_Value(ISOLATE_OR_UNUSED(iso), const nvpair_t *pp)
 }
 
 #undef	RETURN_JS
+#undef	RETURN_JS_ARRAY
+#undef	RETURN_JS_TYPED_ARRAY
 
 static uint_t
 nvlist_length(const nvlist_t *lp)
@@ -541,7 +1123,7 @@ nvlist_to_v8_argv(ISOLATE_OR_UNUSED(iso), const nvlist_t *lp, int *argcp,
 		if (nvlist_lookup_nvpair(const_cast<nvlist_t *>(lp),
 		    name, &pp) != 0)
 			break;
-		argv[i] = V8PLUS_NVPAIR_TO_V8_VALUE(iso, pp);
+		argv[i] = V8PLUS_NVPAIR_TO_V8_VALUE(iso, lp, pp);
 	}
 
 	*argcp = i;
@@ -555,58 +1137,204 @@ v8plus::exception(const nvlist_t *lp)
 	return (create_and_populate(ISOLATE_OR_NULL(iso), lp, "Error"));
 }
 
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+/*
+ * A call made in awaiting mode that returns a Promise completes only once the
+ * Promise has settled, when the settle function is called on the event loop
+ * thread with the result, or with NULL and the rejection pending as an
+ * exception.  Exactly one of the two handlers runs, as the rejection handler
+ * is attached to the Promise returned by attaching the other.
+ */
+typedef struct promise_ctx {
+	v8plus_settle_f pc_settle;
+	void *pc_arg;
+} promise_ctx_t;
+
+static V8_JS_FUNC_DEFN(promise_resolved, args)
+{
+	HANDLE_SCOPE(scope);
+	promise_ctx_t *pcp = reinterpret_cast<promise_ctx_t *>(
+	    args.Data().As<v8::External>()->Value());
+	nvlist_t *rp;
+	int err;
+
+	if ((err = nvlist_alloc(&rp, NV_UNIQUE_NAME, 0)) != 0) {
+		rp = v8plus_nverr(err, NULL);
+	} else if ((err = nvlist_add_v8_Value(rp, "res", args[0])) != 0) {
+		nvlist_free(rp);
+		rp = v8plus_nverr(err, "res");
+	}
+
+	pcp->pc_settle(pcp->pc_arg, rp);
+	delete pcp;
+
+	V8_JS_FUNC_RETURN_UNDEFINED;
+}
+
+static V8_JS_FUNC_DEFN(promise_rejected, args)
+{
+	HANDLE_SCOPE(scope);
+	promise_ctx_t *pcp = reinterpret_cast<promise_ctx_t *>(
+	    args.Data().As<v8::External>()->Value());
+
+	v8plus_throw_v8_exception(args[0]);
+	pcp->pc_settle(pcp->pc_arg, NULL);
+	delete pcp;
+
+	V8_JS_FUNC_RETURN_UNDEFINED;
+}
+
+static void
+promise_await(v8::Isolate *iso, const v8::Handle<v8::Value> &vh,
+    v8plus_settle_f settle, void *arg)
+{
+	promise_ctx_t *pcp = new promise_ctx_t;
+	v8::Local<v8::Value> ext;
+
+	pcp->pc_settle = settle;
+	pcp->pc_arg = arg;
+	ext = V8_EXTERNAL_NEW(iso, pcp);
+
+	/*
+	 * These are plain functions rather than instances of templates, as
+	 * V8 never frees a template and we make a new pair for each call.
+	 */
+	vh.As<v8::Promise>()->Then(
+	    v8::Function::New(iso, promise_resolved, ext))->Catch(
+	    v8::Function::New(iso, promise_rejected, ext));
+}
+#endif
+
+extern "C" void
+v8plus_run_microtasks(void)
+{
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+	v8::Isolate::GetCurrent()->RunMicrotasks();
+#endif
+}
+
+/*
+ * Convert the value returned by a direct call into its result list, unless
+ * the caller wants to await a Promise and this is one.
+ */
+static nvlist_t *
+direct_call_result(ISOLATE_OR_UNUSED(iso), const v8::Handle<v8::Value> &res,
+    v8plus_settle_f settle, void *arg, boolean_t *pendingp)
+{
+	nvlist_t *rp;
+	int err;
+
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+	if (settle != NULL && res->IsPromise()) {
+		promise_await(iso, res, settle, arg);
+		*pendingp = _B_TRUE;
+		return (NULL);
+	}
+#endif
+
+	if ((err = nvlist_alloc(&rp, NV_UNIQUE_NAME, 0)) != 0)
+		return (v8plus_nverr(err, NULL));
+
+	if ((err = nvlist_add_v8_Value(rp, "res", res)) != 0) {
+		nvlist_free(rp);
+		return (v8plus_nverr(err, "res"));
+	}
+
+	return (rp);
+}
+
 extern "C" nvlist_t *
 v8plus_call_direct(v8plus_jsfunc_t f, const nvlist_t *lp)
+{
+	return (v8plus_call_direct_await(f, lp, NULL, NULL, NULL));
+}
+
+extern "C" nvlist_t *
+v8plus_call_direct_await(v8plus_jsfunc_t f, const nvlist_t *lp,
+    v8plus_settle_f settle, void *arg, boolean_t *pendingp)
 {
 	HANDLE_SCOPE(scope);
-	std::unordered_map<uint64_t, cb_hdl_t>::iterator it;
+	v8::Handle<v8::Function> fh;
 	const int max_argc = nvlist_length(lp);
-	int argc, err;
+	int argc;
 	v8::Handle<v8::Value> argv[max_argc];
 	v8::Handle<v8::Value> res;
-	nvlist_t *rp;
 	DECLARE_ISOLATE_FROM_CURRENT(iso);
 
-	if ((it = cbhash.find(f)) == cbhash.end())
-		v8plus_panic("callback hash tag %llu not found",
-		    (unsigned long long)f);
+	fh = cbhash_function(f);
 
 	argc = max_argc;
 	nvlist_to_v8_argv(ISOLATE_OR_NULL(iso), lp, &argc, argv);
 
-	if ((err = nvlist_alloc(&rp, NV_UNIQUE_NAME, 0)) != 0)
-		return (v8plus_nverr(err, NULL));
-
 	v8::TryCatch tc;
-	if (it->second.ch_persist) {
-		res = V8_LOCAL(it->second.ch_phdl, v8::Function)->Call(
-		    V8_GET_GLOBAL(iso), argc, argv);
-	} else {
-		res = it->second.ch_hdl->Call(V8_GET_GLOBAL(iso), argc, argv);
-	}
+	res = fh->Call(V8_GET_GLOBAL(iso), argc, argv);
 	if (tc.HasCaught()) {
 		v8plus_throw_v8_exception(tc.Exception());
 		tc.Reset();
-		nvlist_free(rp);
 		return (NULL);
-	} else if ((err = nvlist_add_v8_Value(rp, "res", res)) != 0) {
-		nvlist_free(rp);
-		return (v8plus_nverr(err, "res"));
 	}
 
-	return (rp);
+	return (direct_call_result(ISOLATE_OR_NULL(iso), res, settle, arg,
+	    pendingp));
+}
+
+/*
+ * Deliver a batch of records from a channel: the records back to back in one
+ * Buffer, the offset at which each ends, and the channel's id.  Returns
+ * B_FALSE if the function returned false to ask for no more for now; an
+ * exception thrown by the function is left pending.
+ */
+extern "C" boolean_t
+v8plus_channel_call_direct(v8plus_jsfunc_t f, uint64_t id, const void *buf,
+    size_t len, const uint32_t *ends, uint_t n)
+{
+	HANDLE_SCOPE(scope);
+	v8::Handle<v8::Function> fh;
+	v8::Handle<v8::Value> argv[3];
+	v8::Handle<v8::Value> res;
+	v8::Local<v8::Array> ah;
+	uint_t i;
+	DECLARE_ISOLATE_FROM_CURRENT(iso);
+
+	fh = cbhash_function(f);
+
+	ah = V8_ARRAY_NEW(iso);
+	for (i = 0; i < n; i++)
+		ah->Set(i, v8::Number::New(USE_ISOLATE(iso) (double)ends[i]));
+
+	argv[0] = V8_BUFFER_NEW(iso, (const char *)buf, len);
+	argv[1] = ah;
+	argv[2] = v8::Number::New(USE_ISOLATE(iso) (double)id);
+
+	v8::TryCatch tc;
+	res = fh->Call(V8_GET_GLOBAL(iso), 3, argv);
+	if (tc.HasCaught()) {
+		v8plus_throw_v8_exception(tc.Exception());
+		tc.Reset();
+		return (_B_TRUE);
+	}
+
+	return (res->IsFalse() ? _B_FALSE : _B_TRUE);
 }
 
 extern "C" nvlist_t *
 v8plus_method_call_direct(void *cop, const char *name, const nvlist_t *lp)
+{
+	return (v8plus_method_call_direct_await(cop, name, lp, NULL, NULL,
+	    NULL));
+}
+
+extern "C" nvlist_t *
+v8plus_method_call_direct_await(void *cop, const char *name,
+    const nvlist_t *lp, v8plus_settle_f settle, void *arg,
+    boolean_t *pendingp)
 {
 	HANDLE_SCOPE(scope);
 	v8plus::ObjectWrap *op = v8plus::ObjectWrap::objlookup(cop);
 	const int max_argc = nvlist_length(lp);
-	int argc, err;
+	int argc;
 	v8::Handle<v8::Value> argv[max_argc];
 	v8::Handle<v8::Value> res;
-	nvlist_t *rp;
 	DECLARE_ISOLATE_FROM_CURRENT(iso);
 
 	if (v8plus_in_event_thread() != _B_TRUE)
@@ -615,22 +1343,16 @@ v8plus_method_call_direct(void *cop, const char *name, const nvlist_t *lp)
 	argc = max_argc;
 	nvlist_to_v8_argv(ISOLATE_OR_NULL(iso), lp, &argc, argv);
 
-	if ((err = nvlist_alloc(&rp, NV_UNIQUE_NAME, 0)) != 0)
-		return (v8plus_nverr(err, NULL));
-
 	v8::TryCatch tc;
 	res = op->call(name, argc, argv);
 	if (tc.HasCaught()) {
 		v8plus_throw_v8_exception(tc.Exception());
 		tc.Reset();
-		nvlist_free(rp);
 		return (NULL);
-	} else if ((err = nvlist_add_v8_Value(rp, "res", res)) != 0) {
-		nvlist_free(rp);
-		return (v8plus_nverr(err, "res"));
 	}
 
-	return (rp);
+	return (direct_call_result(ISOLATE_OR_NULL(iso), res, settle, arg,
+	    pendingp));
 }
 
 extern "C" int
@@ -647,18 +1369,23 @@ nvlist_lookup_v8plus_jsfunc(const nvlist_t *lp, const char *name,
 		return (err);
 
 	if (nv != 1)
-		v8plus_panic("bad array size %u for callback hash tag", nv);
+		return (EINVAL);
 
 	*vp = *lvp;
 	return (0);
 }
 
+/*
+ * Called on the event loop thread for the first hold placed by
+ * v8plus_jsfunc_hold(), so that the function outlives the call that
+ * passed it to us.
+ */
 extern "C" void
-v8plus_jsfunc_hold(v8plus_jsfunc_t f)
+v8plus_jsfunc_persist(uint64_t f)
 {
 	std::unordered_map<uint64_t, cb_hdl_t>::iterator it;
 
-	if ((it = cbhash.find(f)) == cbhash.end())
+	if ((it = cbhash().find(f)) == cbhash().end())
 		v8plus_panic("callback hash tag %llu not found",
 		    (unsigned long long)f);
 
@@ -666,46 +1393,62 @@ v8plus_jsfunc_hold(v8plus_jsfunc_t f)
 		V8_PF_ASSIGN(it->second.ch_phdl, it->second.ch_hdl);
 		it->second.ch_persist = _B_TRUE;
 	}
-	++it->second.ch_refs;
-
-	/*
-	 * If the consumer puts a hold on a callback, we should also put a hold
-	 * on the V8 event loop to prevent it dematerialising beneath us.
-	 */
-	v8plus_eventloop_hold();
 }
 
+/*
+ * Called on the event loop thread once the last hold on a function has been
+ * released, on whatever thread that happened.
+ */
 extern "C" void
-v8plus_jsfunc_rele_direct(v8plus_jsfunc_t f)
+v8plus_jsfunc_unref(uint64_t f)
 {
-	v8::Local<v8::Function> lfh;
 	std::unordered_map<uint64_t, cb_hdl_t>::iterator it;
 
-	if ((it = cbhash.find(f)) == cbhash.end())
+	if ((it = cbhash().find(f)) == cbhash().end())
 		v8plus_panic("callback hash tag %llu not found",
 		    (unsigned long long)f);
 
-	if (it->second.ch_refs == 0)
-		v8plus_panic("releasing unheld callback hash tag %llu",
-		    (unsigned long long)f);
-
-	if (--it->second.ch_refs == 0) {
-		if (it->second.ch_persist) {
+	if (it->second.ch_persist) {
 #if NODE_VERSION_AT_LEAST(0, 12, 0)
-			it->second.ch_phdl.Reset();
+		it->second.ch_phdl.Reset();
 #else
-			it->second.ch_phdl.Dispose();
+		it->second.ch_phdl.Dispose();
 #endif
-		}
-		cbhash.erase(it);
 	}
+	cbhash().erase(it);
 
 	/*
-	 * Release the event loop hold we took in v8plus_jsfunc_hold():
+	 * Release the event loop hold we took when the handle was created:
 	 */
 	v8plus_eventloop_rele_direct();
 }
 
+/*
+ * Called on the event loop thread as the loop exits, to drop every function
+ * still in its table, however many holds remain on it.
+ */
+extern "C" void
+v8plus_jsfunc_fini(void)
+{
+	cbhash_t::iterator it;
+
+	if (cbhash_p == NULL)
+		return;
+
+	for (it = cbhash_p->begin(); it != cbhash_p->end(); ++it) {
+		if (!it->second.ch_persist)
+			continue;
+#if NODE_VERSION_AT_LEAST(0, 12, 0)
+		it->second.ch_phdl.Reset();
+#else
+		it->second.ch_phdl.Dispose();
+#endif
+	}
+
+	delete cbhash_p;
+	cbhash_p = NULL;
+}
+
 static size_t
 library_name(const char *base, const char *version, char *buf, size_t len)
 {
@@ -765,7 +1508,7 @@ nvlist_free(nvlist_t *lp)
 				v8plus_panic(
 				    "unable to obtain callback hash tag");
 			}
-			if (nv != 1) {
+			if (nv != 1 && nv != V8PLUS_BUFFER_NVALS) {
 				v8plus_panic(
 				    "bad array size %u for callback hash tag",
 				    nv);
@@ -777,6 +1520,40 @@ nvlist_free(nvlist_t *lp)
 	__real_nvlist_free(lp);
 }
 
+extern "C" int
+nvpair_value_v8plus_buffer(const nvpair_t *pp, v8plus_buffer_t *vp)
+{
+	uint64_t *lvp;
+	uint_t nv;
+	int err;
+
+	if ((err = nvpair_value_uint64_array((nvpair_t *)pp, &lvp, &nv)) != 0)
+		return (err);
+
+	if (nv != V8PLUS_BUFFER_NVALS)
+		return (EINVAL);
+
+	vp->vb_hdl = lvp[0];
+	vp->vb_data = (void *)(uintptr_t)lvp[1];
+	vp->vb_len = (size_t)lvp[2];
+
+	return (0);
+}
+
+extern "C" int
+nvlist_lookup_v8plus_buffer(const nvlist_t *lp, const char *name,
+    v8plus_buffer_t *vp)
+{
+	nvpair_t *pp;
+	int err;
+
+	err = nvlist_lookup_nvpair(const_cast<nvlist_t *>(lp), name, &pp);
+	if (err != 0)
+		return (err);
+
+	return (nvpair_value_v8plus_buffer(pp, vp));
+}
+
 extern "C" int
 nvpair_value_v8plus_jsfunc(const nvpair_t *pp, v8plus_jsfunc_t *vp)
 {
@@ -787,13 +1564,20 @@ nvpair_value_v8plus_jsfunc(const nvpair_t *pp, v8plus_jsfunc_t *vp)
 	if ((err = nvpair_value_uint64_array((nvpair_t *)pp, &lvp, &nv)) != 0)
 		return (err);
 
+	if (nv != 1)
+		return (EINVAL);
+
 	*vp = *lvp;
 
 	return (0);
 }
 
+/*
+ * Called on the event loop thread for the first hold on an object, and once
+ * the last hold on it has been released.
+ */
 extern "C" void
-v8plus_obj_hold(const void *cop)
+v8plus_obj_ref(const void *cop)
 {
 	v8plus::ObjectWrap *op = v8plus::ObjectWrap::objlookup(cop);
 	op->public_Ref();
@@ -806,13 +1590,13 @@ v8plus_obj_hold(const void *cop)
 }
 
 extern "C" void
-v8plus_obj_rele_direct(const void *cop)
+v8plus_obj_unref(const void *cop)
 {
 	v8plus::ObjectWrap *op = v8plus::ObjectWrap::objlookup(cop);
 	op->public_Unref();
 
 	/*
-	 * Release the event loop hold we took in v8plus_obj_hold():
+	 * Release the event loop hold we took in v8plus_obj_ref():
 	 */
 	v8plus_eventloop_rele_direct();
 }